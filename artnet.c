@@ -6,12 +6,14 @@
 #include <ch.h>
 #include <hal.h>
 #include <string.h>
+#include <stddef.h>
+#include <math.h>
 
 // Debug
 #include "debug.h"
 
-// Struct holding all artnet globals, status, etc
-artnet_status_t gArtStatus = {0};
+// Node instances, only written by artnetInit
+static artnet_status_t *gArtInstances[ARTNET_INSTANCES];
 
 // Constants, report code text, hopefully goes into flash!!
 static const char * const gReportCodeTable[] =
@@ -35,6 +37,80 @@ static const char * const gReportCodeTable[] =
   "Factory reset has occurred."
 };
 
+// WS2812 SPI encoding of each byte, 1 is 110 and 0 is 100, MSB first
+static const uint32_t gPixelSpi3[256] =
+{
+  0x924924, 0x924926, 0x924934, 0x924936, 0x9249a4, 0x9249a6, 0x9249b4, 0x9249b6,
+  0x924d24, 0x924d26, 0x924d34, 0x924d36, 0x924da4, 0x924da6, 0x924db4, 0x924db6,
+  0x926924, 0x926926, 0x926934, 0x926936, 0x9269a4, 0x9269a6, 0x9269b4, 0x9269b6,
+  0x926d24, 0x926d26, 0x926d34, 0x926d36, 0x926da4, 0x926da6, 0x926db4, 0x926db6,
+  0x934924, 0x934926, 0x934934, 0x934936, 0x9349a4, 0x9349a6, 0x9349b4, 0x9349b6,
+  0x934d24, 0x934d26, 0x934d34, 0x934d36, 0x934da4, 0x934da6, 0x934db4, 0x934db6,
+  0x936924, 0x936926, 0x936934, 0x936936, 0x9369a4, 0x9369a6, 0x9369b4, 0x9369b6,
+  0x936d24, 0x936d26, 0x936d34, 0x936d36, 0x936da4, 0x936da6, 0x936db4, 0x936db6,
+  0x9a4924, 0x9a4926, 0x9a4934, 0x9a4936, 0x9a49a4, 0x9a49a6, 0x9a49b4, 0x9a49b6,
+  0x9a4d24, 0x9a4d26, 0x9a4d34, 0x9a4d36, 0x9a4da4, 0x9a4da6, 0x9a4db4, 0x9a4db6,
+  0x9a6924, 0x9a6926, 0x9a6934, 0x9a6936, 0x9a69a4, 0x9a69a6, 0x9a69b4, 0x9a69b6,
+  0x9a6d24, 0x9a6d26, 0x9a6d34, 0x9a6d36, 0x9a6da4, 0x9a6da6, 0x9a6db4, 0x9a6db6,
+  0x9b4924, 0x9b4926, 0x9b4934, 0x9b4936, 0x9b49a4, 0x9b49a6, 0x9b49b4, 0x9b49b6,
+  0x9b4d24, 0x9b4d26, 0x9b4d34, 0x9b4d36, 0x9b4da4, 0x9b4da6, 0x9b4db4, 0x9b4db6,
+  0x9b6924, 0x9b6926, 0x9b6934, 0x9b6936, 0x9b69a4, 0x9b69a6, 0x9b69b4, 0x9b69b6,
+  0x9b6d24, 0x9b6d26, 0x9b6d34, 0x9b6d36, 0x9b6da4, 0x9b6da6, 0x9b6db4, 0x9b6db6,
+  0xd24924, 0xd24926, 0xd24934, 0xd24936, 0xd249a4, 0xd249a6, 0xd249b4, 0xd249b6,
+  0xd24d24, 0xd24d26, 0xd24d34, 0xd24d36, 0xd24da4, 0xd24da6, 0xd24db4, 0xd24db6,
+  0xd26924, 0xd26926, 0xd26934, 0xd26936, 0xd269a4, 0xd269a6, 0xd269b4, 0xd269b6,
+  0xd26d24, 0xd26d26, 0xd26d34, 0xd26d36, 0xd26da4, 0xd26da6, 0xd26db4, 0xd26db6,
+  0xd34924, 0xd34926, 0xd34934, 0xd34936, 0xd349a4, 0xd349a6, 0xd349b4, 0xd349b6,
+  0xd34d24, 0xd34d26, 0xd34d34, 0xd34d36, 0xd34da4, 0xd34da6, 0xd34db4, 0xd34db6,
+  0xd36924, 0xd36926, 0xd36934, 0xd36936, 0xd369a4, 0xd369a6, 0xd369b4, 0xd369b6,
+  0xd36d24, 0xd36d26, 0xd36d34, 0xd36d36, 0xd36da4, 0xd36da6, 0xd36db4, 0xd36db6,
+  0xda4924, 0xda4926, 0xda4934, 0xda4936, 0xda49a4, 0xda49a6, 0xda49b4, 0xda49b6,
+  0xda4d24, 0xda4d26, 0xda4d34, 0xda4d36, 0xda4da4, 0xda4da6, 0xda4db4, 0xda4db6,
+  0xda6924, 0xda6926, 0xda6934, 0xda6936, 0xda69a4, 0xda69a6, 0xda69b4, 0xda69b6,
+  0xda6d24, 0xda6d26, 0xda6d34, 0xda6d36, 0xda6da4, 0xda6da6, 0xda6db4, 0xda6db6,
+  0xdb4924, 0xdb4926, 0xdb4934, 0xdb4936, 0xdb49a4, 0xdb49a6, 0xdb49b4, 0xdb49b6,
+  0xdb4d24, 0xdb4d26, 0xdb4d34, 0xdb4d36, 0xdb4da4, 0xdb4da6, 0xdb4db4, 0xdb4db6,
+  0xdb6924, 0xdb6926, 0xdb6934, 0xdb6936, 0xdb69a4, 0xdb69a6, 0xdb69b4, 0xdb69b6,
+  0xdb6d24, 0xdb6d26, 0xdb6d34, 0xdb6d36, 0xdb6da4, 0xdb6da6, 0xdb6db4, 0xdb6db6
+};
+
+// Offset of each wire colour in the DMX slots of a pixel
+static const uint8_t gPixelOrder[][4] =
+{
+  { 0, 1, 2, 0 }, // RGB
+  { 0, 2, 1, 0 }, // RBG
+  { 1, 0, 2, 0 }, // GRB
+  { 1, 2, 0, 0 }, // GBR
+  { 2, 0, 1, 0 }, // BRG
+  { 2, 1, 0, 0 }, // BGR
+  { 0, 1, 2, 3 }, // RGBW
+  { 1, 0, 2, 3 }  // GRBW
+};
+
+// RDM PIDs whose responses don't change, answered from the cache.
+// Some take an argument (a PID, personality, slot or sensor number),
+// which the response repeats in its first bytes, it is part of the key.
+static const struct
+{
+  uint16_t pid;
+  uint8_t argLen;
+} gRdmStaticPids[] =
+{
+  { RDM_PID_SUPPORTED_PARAMETERS,        0 },
+  { RDM_PID_PARAMETER_DESCRIPTION,       2 },
+  { RDM_PID_PRODUCT_DETAIL_ID_LIST,      0 },
+  { RDM_PID_DEVICE_MODEL_DESCRIPTION,    0 },
+  { RDM_PID_MANUFACTURER_LABEL,          0 },
+  { RDM_PID_SOFTWARE_VERSION_LABEL,      0 },
+  { RDM_PID_BOOT_SOFTWARE_VERSION_ID,    0 },
+  { RDM_PID_BOOT_SOFTWARE_VERSION_LABEL, 0 },
+  { RDM_PID_PERSONALITY_DESCRIPTION,     1 },
+  { RDM_PID_SLOT_INFO,                   0 },
+  { RDM_PID_SLOT_DESCRIPTION,            2 },
+  { RDM_PID_DEFAULT_SLOT_VALUE,          0 },
+  { RDM_PID_SENSOR_DEFINITION,           1 }
+};
+
 /*******************************************/
 /* PRIVATE FUNCTIONS                       */
 /*******************************************/
@@ -79,12 +155,12 @@ static void artnetPrntnum(unsigned long num, int base, char sign, char *outbuf)
  * bool v4         - use v4 spec ip addres or not
  *                   v4 uses 10.x.x.x others 2.x.x.x
  */
-static uint32_t artnetDefaultIp(bool v4)
+static uint32_t artnetDefaultIp(artnet_status_t *st, bool v4)
 {
   return ustackIpToA((v4 == true) ? 10 : 2,
-                     gArtStatus.cfg->iface->cfg->mac[3] + OEM,
-                     gArtStatus.cfg->iface->cfg->mac[4],
-                     gArtStatus.cfg->iface->cfg->mac[5]);
+                     st->cfg->iface->cfg->mac[3] + OEM,
+                     st->cfg->iface->cfg->mac[4],
+                     st->cfg->iface->cfg->mac[5]);
 }
 
 /**
@@ -113,19 +189,191 @@ static void artnetGetReportText(uint8_t reportCode, char *report)
 }
 */
 
+static void artnetSendQueued(ustack_iface_t *iface);
+
+/**
+ * Finds the instance a received packet is for
+ *
+ * ustack_iface_t *iface - interface it came in
+ * uint16_t port         - UDP destination port
+ * bool sacn             - is port the sACN one ?
+ */
+static artnet_status_t *artnetFindInstance(ustack_iface_t *iface, uint16_t port, bool sacn)
+{
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_INSTANCES; i++)
+  {
+    artnet_status_t *st = gArtInstances[i];
+
+    if(st == NULL || st->cfg->iface != iface)
+      continue;
+
+    if(sacn ? (st->cfg->sacnEnabled && st->cfg->sacnPort == port) : (st->cfg->port == port))
+      return st;
+  }
+
+  return NULL;
+}
+
+/**
+ * Is another instance listening on this port ?
+ *
+ * uint16_t port - UDP port
+ */
+static bool artnetPortShared(artnet_status_t *st, uint16_t port)
+{
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_INSTANCES; i++)
+  {
+    artnet_status_t *other = gArtInstances[i];
+
+    if(other == NULL || other == st)
+      continue;
+
+    if(other->cfg->port == port || (other->cfg->sacnEnabled && other->cfg->sacnPort == port))
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * Queues a send to the stack thread, the stack only
+ * gives the interface back so the instance keeps
+ * what it has to send
+ *
+ * uint8_t what - artnet_send_en
+ */
+static void artnetQueueSend(artnet_status_t *st, uint8_t what)
+{
+  chSysLock();
+  st->sendPending |= what;
+  chSysUnlock();
+
+  ustackQueueSendPacket(artnetSendQueued);
+}
+
+/**
+ * Takes a free TX buffer to build a reply
+ *
+ * returns NULL when all are in use, the reply is dropped
+ */
+static artnet_tx_t *artnetTxAlloc(artnet_status_t *st)
+{
+  uint8_t i;
+
+  chSysLock();
+  for(i = 0; i < ARTNET_TX_BUFFERS; i++)
+  {
+    if(st->tx[i].state == ARTNET_TX_FREE)
+    {
+      st->tx[i].state = ARTNET_TX_FILLING;
+      chSysUnlock();
+      return &st->tx[i];
+    }
+  }
+  st->txDropped++;
+  chSysUnlock();
+
+  return NULL;
+}
+
+/**
+ * Queues a built reply to the stack thread
+ *
+ * uint8_t *mac    - destination MAC
+ * uint32_t ip     - destination IP, host order
+ * uint16_t len    - the payload length
+ */
+static void artnetTxQueue(artnet_status_t *st, artnet_tx_t *tx, const uint8_t *mac, uint32_t ip, uint16_t len)
+{
+  memcpy(tx->mac, mac, 6);
+  tx->ip = ip;
+  tx->port = st->cfg->port;
+  tx->len = len;
+
+  chSysLock();
+  tx->order = st->txOrder++;
+  tx->state = ARTNET_TX_QUEUED;
+  chSysUnlock();
+
+  artnetQueueSend(st, ARTNET_SEND_TXPOOL);
+}
+
+/**
+ * Sends the queued replies of an instance, oldest
+ * first, from the stack thread
+ */
+static void artnetTxSend(artnet_status_t *st, ustack_iface_t *iface)
+{
+  uint8_t *payload = iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t);
+
+  for(;;)
+  {
+    artnet_tx_t *tx = NULL;
+    uint16_t age = 0;
+    uint8_t i;
+
+    for(i = 0; i < ARTNET_TX_BUFFERS; i++)
+    {
+      if(st->tx[i].state != ARTNET_TX_QUEUED)
+        continue;
+
+      if(tx == NULL || (uint16_t)(st->txOrder - st->tx[i].order) > age)
+      {
+        tx = &st->tx[i];
+        age = st->txOrder - tx->order;
+      }
+    }
+
+    if(tx == NULL)
+      return;
+
+    memcpy(payload, tx->data, tx->len);
+    ustackUdpSend(iface, tx->mac, tx->ip, tx->port, tx->port, tx->len);
+
+    chSysLock();
+    tx->state = ARTNET_TX_FREE;
+    chSysUnlock();
+  }
+}
+
+/**
+ * Records a startup milestone, the first time only
+ *
+ * uint8_t milestone - artnet_boot_en
+ */
+static void artnetBootMark(artnet_status_t *st, uint8_t milestone)
+{
+  // Bits are only ever set, so this is safe unlocked
+  if(st->bootReached & (1 << milestone))
+    return;
+
+  // The service and stack threads both mark
+  chSysLock();
+  if(!(st->bootReached & (1 << milestone)))
+  {
+    st->boot[milestone] = chVTGetSystemTimeX();
+    st->bootReached |= (1 << milestone);
+  }
+  chSysUnlock();
+}
+
 /**
  * Thread to blink leds
  *
  */
 static THD_FUNCTION(LocateThread, arg)
 {
-  (void)arg;
+  artnet_status_t *st = (artnet_status_t*)arg;
   chRegSetThreadName("Locate Thread");
 
   while (!chThdShouldTerminateX())
   {
-    palTogglePad(gArtStatus.cfg->ledGreen.port, gArtStatus.cfg->ledGreen.pad);
-    palTogglePad(gArtStatus.cfg->ledRed.port, gArtStatus.cfg->ledRed.pad);
+    palTogglePad(st->cfg->ledGreen.port, st->cfg->ledGreen.pad);
+    palTogglePad(st->cfg->ledRed.port, st->cfg->ledRed.pad);
     chThdSleepMilliseconds(250);
   }
   
@@ -137,19 +385,19 @@ static THD_FUNCTION(LocateThread, arg)
  * normal operation
  *
  */
-static void artnetSetLedsNormal(void)
+static void artnetSetLedsNormal(artnet_status_t *st)
 {
-  if(gArtStatus.locateThread != NULL)
+  if(st->locateThread != NULL)
   {
-    chThdTerminate(gArtStatus.locateThread);
-    chThdWait(gArtStatus.locateThread);
-    gArtStatus.locateThread = NULL;
+    chThdTerminate(st->locateThread);
+    chThdWait(st->locateThread);
+    st->locateThread = NULL;
   }
 
-  palSetPad(gArtStatus.cfg->ledGreen.port, gArtStatus.cfg->ledGreen.pad);
-  palClearPad(gArtStatus.cfg->ledRed.port, gArtStatus.cfg->ledRed.pad);
+  palSetPad(st->cfg->ledGreen.port, st->cfg->ledGreen.pad);
+  palClearPad(st->cfg->ledRed.port, st->cfg->ledRed.pad);
 
-  gArtStatus.statusLeds = ARTNET_STATUS_INDICATOR_NORMAL;
+  st->statusLeds = ARTNET_STATUS_INDICATOR_NORMAL;
 }
 
 /**
@@ -157,19 +405,19 @@ static void artnetSetLedsNormal(void)
  * mute state
  *
  */
-static void artnetSetLedssMute(void)
+static void artnetSetLedssMute(artnet_status_t *st)
 {
-  if(gArtStatus.locateThread != NULL)
+  if(st->locateThread != NULL)
   {
-    chThdTerminate(gArtStatus.locateThread);
-    chThdWait(gArtStatus.locateThread);
-    gArtStatus.locateThread = NULL;
+    chThdTerminate(st->locateThread);
+    chThdWait(st->locateThread);
+    st->locateThread = NULL;
   }
 
-  palClearPad(gArtStatus.cfg->ledGreen.port, gArtStatus.cfg->ledGreen.pad);
-  palClearPad(gArtStatus.cfg->ledRed.port, gArtStatus.cfg->ledRed.pad);
+  palClearPad(st->cfg->ledGreen.port, st->cfg->ledGreen.pad);
+  palClearPad(st->cfg->ledRed.port, st->cfg->ledRed.pad);
 
-  gArtStatus.statusLeds = ARTNET_STATUS_INDICATOR_MUTE;
+  st->statusLeds = ARTNET_STATUS_INDICATOR_MUTE;
 }
 
 /**
@@ -177,1003 +425,7113 @@ static void artnetSetLedssMute(void)
  * both led's
  *
  */
-static void artnetSetLedsLocate(void)
+static void artnetSetLedsLocate(artnet_status_t *st)
 {
   // spawn a heap thread with them blinking
-  if(gArtStatus.locateThread == NULL)
+  if(st->locateThread == NULL)
   {
-    palSetPad(gArtStatus.cfg->ledGreen.port, gArtStatus.cfg->ledGreen.pad);
-    palSetPad(gArtStatus.cfg->ledRed.port, gArtStatus.cfg->ledRed.pad);
-    gArtStatus.locateThread = chThdCreateFromHeap(NULL,
-                                                  THD_WORKING_AREA_SIZE(128),
-                                                  "LocateThread",
-                                                  NORMALPRIO - 1,
-                                                  LocateThread, NULL);
+    palSetPad(st->cfg->ledGreen.port, st->cfg->ledGreen.pad);
+    palSetPad(st->cfg->ledRed.port, st->cfg->ledRed.pad);
+    st->locateThread = chThdCreateFromHeap(NULL,
+                                           THD_WORKING_AREA_SIZE(128),
+                                           "LocateThread",
+                                           NORMALPRIO - 1,
+                                           LocateThread, st);
   }
 
-  gArtStatus.statusLeds = ARTNET_STATUS_INDICATOR_LOCATE;
+  st->statusLeds = ARTNET_STATUS_INDICATOR_LOCATE;
 }
 
 /**
- * Restarts ethernet, to apply
- * ethernet config changes
+ * Publishes the status and routing snapshot
  *
+ * Seqlock, the sequence is odd while we write so
+ * readers retry, we never wait for them. Only the
+ * packet thread, or init, calls this.
  */
-static void artnetRestart(uint32_t ip, uint32_t nm, uint16_t port)
+static void artnetPublish(artnet_status_t *st)
 {
-  dbg(":: ARTNET :: Restarting Ethernet");
-  
-  if(port != gArtStatus.cfg->port)
-  {
-    ustackUdpRemoveListener(gArtStatus.cfg->port);
-    gArtStatus.cfg->port = port;
-  }
+  artnet_snapshot_t *snap = &st->snap;
+  uint8_t i;
 
-  if(ip != 0 && ip != gArtStatus.cfg->iface->cfg->ip)
-    gArtStatus.cfg->iface->cfg->ip = ip;
+  st->snapSeq++;
+  __sync_synchronize();
 
-  if(nm != 0 && nm != gArtStatus.cfg->iface->cfg->netmask)
-    gArtStatus.cfg->iface->cfg->netmask = nm;
-  
-  gArtStatus.pollCount = 0;
-  gArtStatus.lastDmxPacket = 0;
-  gArtStatus.lastIpSrc = 0;
+  memcpy(snap->shortName, st->cfg->shortName, ARTNET_SHORT_NAME_LENGTH);
+  memcpy(snap->longName, st->cfg->longName, ARTNET_LONG_NAME_LENGTH);
+  snap->ip = st->cfg->iface->cfg->ip;
+  snap->netmask = st->cfg->iface->cfg->netmask;
+  snap->port = st->cfg->port;
+  snap->statusLeds = st->statusLeds;
+  snap->reportCode = st->reportCode;
 
-  artnetSetLedsNormal();
-  
-  gArtStatus.reportCode = ARTNET_RCPOWEROK;
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
 
-  // Artnet
-  dbgf(":: ARTNET :: Binding Artnet to Port: %d\r\n", gArtStatus.cfg->port);
-  ustackUdpAddListener(gArtStatus.cfg->port, artnetParser);
+    snap->groups[i].ports = grp->ports;
+    snap->groups[i].net = grp->net;
+    snap->groups[i].subnet = grp->subnet;
+    memcpy(snap->groups[i].portType, grp->portType, ARTNET_MAX_PORTS);
+    memcpy(snap->groups[i].outputStatus, grp->outputStatus, ARTNET_MAX_PORTS);
+    memcpy(snap->groups[i].swin, grp->swin, ARTNET_MAX_PORTS);
+    memcpy(snap->groups[i].swout, grp->swout, ARTNET_MAX_PORTS);
+  }
+
+  __sync_synchronize();
+  st->snapSeq++;
+}
+
+/**
+ * CRC-16/CCITT
+ *
+ * uint16_t crc - initial value, 0xffff to start
+ */
+static uint16_t artnetCrc16(const uint8_t *data, uint16_t len, uint16_t crc)
+{
+  uint8_t b;
 
-  if(gArtStatus.cfg->sacnEnabled)
+  while(len--)
   {
-    // sACN
-    dbgf(":: ARTNET :: Binding sACN to Port: %d\r\n", gArtStatus.cfg->sacnPort);
-    ustackUdpAddListener(gArtStatus.cfg->sacnPort, sacnParser);
+    crc ^= (uint16_t)(*data++) << 8;
+    for(b = 0; b < 8; b++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
   }
+
+  return crc;
 }
 
 /**
- * builds a node report code
+ * Config journal
  *
- * uint8_t report - the output holding the report code string
+ * Each sector starts with a header, magic and generation,
+ * followed by 4 byte aligned records of one config item,
+ * type, length, CRC and the item. The valid sector with
+ * the highest generation is the one in use, its records
+ * replayed in order give the config. When it fills up the
+ * whole config is written to the next one, its header
+ * last, and the old one erased.
+ */
+
+#define ARTNET_JOURNAL_MAGIC 0x314a4e41   // "ANJ1"
+#define ARTNET_JOURNAL_HDR 8
+
+typedef enum
+{
+  ARTNET_JREC_SHORTNAME = 1,
+  ARTNET_JREC_LONGNAME,
+  ARTNET_JREC_NETWORK,
+  ARTNET_JREC_GROUP,
+  ARTNET_JREC_END = 0xff          // Erased flash
+} artnet_jrec_en;
+
+/**
+ * Serializes a journal item from the persisted config
+ *
+ * uint8_t type  - artnet_jrec_en
+ * uint8_t group - group of ARTNET_JREC_GROUP
+ * uint8_t *buf  - room for the largest item
  *
+ * Returns its length
  */
-static void artnetBuildReportCode(uint8_t *report)
+static uint8_t artnetJournalItem(artnet_persist_t *cfg, uint8_t type, uint8_t group, uint8_t *buf)
 {
-  char tmp[4] = { '0', '0', '0', '0' };
+  switch(type)
+  {
+    case ARTNET_JREC_SHORTNAME:
+      memcpy(buf, cfg->shortName, ARTNET_SHORT_NAME_LENGTH);
+      return ARTNET_SHORT_NAME_LENGTH;
 
-  memset(gArtStatus.report, 0, ARTNET_REPORT_LENGTH);
-  
-  if(gArtStatus.reportCode < ARTNET_RCMAXCODE)
-    artnetPrntnum(gArtStatus.reportCode, 16, ' ', tmp);
+    case ARTNET_JREC_LONGNAME:
+      memcpy(buf, cfg->longName, ARTNET_LONG_NAME_LENGTH);
+      return ARTNET_LONG_NAME_LENGTH;
 
-  report[0] = '#';
-  report[1] = '0';
-  report[2] = '0';
-  report[3] = (gArtStatus.reportCode > 0xf) ? tmp[0] : '0';
-  report[4] = (gArtStatus.reportCode > 0xf) ? tmp[1] : tmp[0];
+    case ARTNET_JREC_NETWORK:
+      memcpy(&buf[0], &cfg->ip, 4);
+      memcpy(&buf[4], &cfg->netmask, 4);
+      memcpy(&buf[8], &cfg->port, 2);
+      return 10;
 
-  tmp[0] = '0'; tmp[1] = '0'; tmp[2] = '0'; tmp[3] = '0';
-  artnetPrntnum(gArtStatus.pollCount, 10, ' ', tmp);
+    case ARTNET_JREC_GROUP:
+      buf[0] = group;
+      buf[1] = cfg->groups[group].net;
+      buf[2] = cfg->groups[group].subnet;
+      memcpy(&buf[3], cfg->groups[group].outputStatus, ARTNET_MAX_PORTS);
+      memcpy(&buf[3 + ARTNET_MAX_PORTS], cfg->groups[group].swin, ARTNET_MAX_PORTS);
+      memcpy(&buf[3 + 2 * ARTNET_MAX_PORTS], cfg->groups[group].swout, ARTNET_MAX_PORTS);
+      return 3 + 3 * ARTNET_MAX_PORTS;
+  }
 
-  report[5] = '[';
+  return 0;
+}
+
+/**
+ * Replays a journal record into the persisted config
+ *
+ * Returns false if it doesn't make sense
+ */
+static bool artnetJournalApply(artnet_persist_t *cfg, uint8_t type, uint8_t len, uint8_t *buf)
+{
+  switch(type)
+  {
+    case ARTNET_JREC_SHORTNAME:
+      if(len != ARTNET_SHORT_NAME_LENGTH) return false;
+      memcpy(cfg->shortName, buf, len);
+      return true;
 
-  if(gArtStatus.pollCount < 10)  { report[6] = tmp[3]; report[7] = tmp[2]; report[8] = tmp[1]; report[9] = tmp[0]; }
-  if(gArtStatus.pollCount > 9)   { report[6] = tmp[3]; report[7] = tmp[2]; report[8] = tmp[0]; report[9] = tmp[1]; }
-  if(gArtStatus.pollCount > 99)  { report[6] = tmp[3]; report[7] = tmp[0]; report[8] = tmp[1]; report[9] = tmp[2]; }
-  if(gArtStatus.pollCount > 999) { report[6] = tmp[0]; report[7] = tmp[1]; report[8] = tmp[2]; report[9] = tmp[3]; }
+    case ARTNET_JREC_LONGNAME:
+      if(len != ARTNET_LONG_NAME_LENGTH) return false;
+      memcpy(cfg->longName, buf, len);
+      return true;
 
-  report[10] = ']';
+    case ARTNET_JREC_NETWORK:
+      if(len != 10) return false;
+      memcpy(&cfg->ip, &buf[0], 4);
+      memcpy(&cfg->netmask, &buf[4], 4);
+      memcpy(&cfg->port, &buf[8], 2);
+      return true;
+
+    case ARTNET_JREC_GROUP:
+      if(len != 3 + 3 * ARTNET_MAX_PORTS || buf[0] >= ARTNET_GROUPS) return false;
+      cfg->groups[buf[0]].net = buf[1];
+      cfg->groups[buf[0]].subnet = buf[2];
+      memcpy(cfg->groups[buf[0]].outputStatus, &buf[3], ARTNET_MAX_PORTS);
+      memcpy(cfg->groups[buf[0]].swin, &buf[3 + ARTNET_MAX_PORTS], ARTNET_MAX_PORTS);
+      memcpy(cfg->groups[buf[0]].swout, &buf[3 + 2 * ARTNET_MAX_PORTS], ARTNET_MAX_PORTS);
+      return true;
+  }
 
-  memcpy(&report[11], gReportCodeTable[gArtStatus.reportCode], ARTNET_REPORT_LENGTH - 11);
+  return false;
 }
 
 /**
- * Clear a DMX ouput setting all channels at 0
+ * Appends an item of the persisted config to the journal
  *
- * artnet_group_t grp - the group of the port
- * uint8_t port       - the port number
+ * Returns false if the sector has no room for it
  */
-static bool artnetClearDmxOutput(artnet_group_t *grp, uint8_t port)
+static bool artnetJournalAppend(artnet_status_t *st, uint8_t type, uint8_t group)
 {
-  if(port >= grp->ports) return false;
+  artnet_flash_t *flash = st->cfg->flash;
+  uint8_t rec[4 + ARTNET_LONG_NAME_LENGTH];
+  uint8_t len = artnetJournalItem(&st->journal, type, group, &rec[4]);
+  uint16_t size = (4 + len + 3) & ~3;
+  uint16_t crc;
 
-  uint8_t tmp[512] = {0};
-  grp->dmxcb(port, 512, tmp);
+  if(st->journalOffset + size > flash->sectorSize)
+    return false;
+
+  rec[0] = type;
+  rec[1] = len;
+  crc = artnetCrc16(rec, 2, 0xffff);
+  crc = artnetCrc16(&rec[4], len, crc);
+  rec[2] = crc >> 8;
+  rec[3] = crc & 0xff;
+  memset(&rec[4 + len], 0xff, size - 4 - len);
+
+  flash->write(flash->arg, st->journalSector * flash->sectorSize + st->journalOffset, rec, size);
+  st->journalOffset += size;
 
   return true;
 }
 
 /**
- * ArtPollReply
+ * Writes the whole persisted config to the next sector,
+ * which becomes the one in use
  *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * All Devices      | Receive               | No action.
- *                  | Unicast Transmit      | Not Allowed.
- *                  | Directed Broadcast    | Directed broadcast this packet in response
- *                                            to an ArtPoll
- * --------------------------------------------------------------------------------------
+ * Only the sector written is erased, the old one stays
+ * until the ring comes back to it, a lower generation.
+ */
+static void artnetJournalCompact(artnet_status_t *st)
+{
+  artnet_flash_t *flash = st->cfg->flash;
+  uint32_t hdr[2];
+  uint8_t g;
+
+  st->journalSector = (st->journalSector + 1) % flash->sectors;
+  st->journalOffset = ARTNET_JOURNAL_HDR;
+  flash->erase(flash->arg, st->journalSector);
+
+  artnetJournalAppend(st, ARTNET_JREC_SHORTNAME, 0);
+  artnetJournalAppend(st, ARTNET_JREC_LONGNAME, 0);
+  artnetJournalAppend(st, ARTNET_JREC_NETWORK, 0);
+  for(g = 0; g < ARTNET_GROUPS; g++)
+    artnetJournalAppend(st, ARTNET_JREC_GROUP, g);
+
+  // Header last, a half written sector is never valid
+  hdr[0] = ARTNET_JOURNAL_MAGIC;
+  hdr[1] = ++st->journalGen;
+  flash->write(flash->arg, st->journalSector * flash->sectorSize, hdr, sizeof(hdr));
+}
+
+/**
+ * Loads the config from the journal, at boot
  *
- * A device, in response to a Controller’s ArtPoll, sends the ArtPollReply. This packet 
- * is also broadcast to the Directed Broadcast address by all Art-Net devices on power up.
+ * Reads one sector at most, never writes. With no valid
+ * sector the config we were given starts the journal,
+ * that and any compaction are left to the storage thread.
  *
+ * Returns true if the config came from the journal
  */
-static void artnetSendPollReply(artnet_packet_u *artnet)
+static bool artnetJournalLoad(artnet_status_t *st)
 {
-  uint8_t i;
+  artnet_flash_t *flash = st->cfg->flash;
+  uint8_t rec[4 + ARTNET_LONG_NAME_LENGTH];
+  uint32_t hdr[2];
+  bool found = false;
+  uint8_t i, g;
 
-  memcpy(artnet->pollreply.id, "Art-Net\0", 8);
-  artnet->pollreply.opCode = ARTNET_OPCODE_REPLY;
-  artnet->pollreply.ip = htonl(gArtStatus.cfg->iface->cfg->ip);
+  if(flash->sectors < 2)
+    return false;
 
-  artnet->pollreply.port = gArtStatus.cfg->port;
-  artnet->pollreply.ver = VERSION;
-  artnet->pollreply.oem = htons(ARTNET_OEM);
-  artnet->pollreply.ubea = 0;
-  
-  artnet->pollreply.status = gArtStatus.statusLeds | ARTNET_STATUS_PROG_NETWORK;
+  // What we have now, replaying goes on top
+  memcpy(st->journal.shortName, st->cfg->shortName, ARTNET_SHORT_NAME_LENGTH);
+  memcpy(st->journal.longName, st->cfg->longName, ARTNET_LONG_NAME_LENGTH);
+  st->journal.ip = st->cfg->iface->cfg->ip;
+  st->journal.netmask = st->cfg->iface->cfg->netmask;
+  st->journal.port = st->cfg->port;
+  for(g = 0; g < ARTNET_GROUPS; g++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[g];
+
+    st->journal.groups[g].net = grp->net;
+    st->journal.groups[g].subnet = grp->subnet;
+    memcpy(st->journal.groups[g].outputStatus, grp->outputStatus, ARTNET_MAX_PORTS);
+    memcpy(st->journal.groups[g].swin, grp->swin, ARTNET_MAX_PORTS);
+    memcpy(st->journal.groups[g].swout, grp->swout, ARTNET_MAX_PORTS);
+  }
+
+  for(i = 0; i < flash->sectors; i++)
+  {
+    if(!flash->read(flash->arg, i * flash->sectorSize, hdr, sizeof(hdr)))
+      continue;
+
+    if(hdr[0] != ARTNET_JOURNAL_MAGIC || hdr[1] == 0xffffffff)
+      continue;
+
+    if(!found || hdr[1] > st->journalGen)
+    {
+      found = true;
+      st->journalSector = i;
+      st->journalGen = hdr[1];
+    }
+  }
 
-  if(gArtStatus.cfg->rdmEnabled)
-    artnet->pollreply.status |= ARTNET_STATUS_RDM_ENABLED;
+  st->journalReady = true;
+
+  if(!found)
+  {
+    st->journalSector = flash->sectors - 1;
+    st->journalGen = 0;
+    st->journalCompact = true;
+    return false;
+  }
 
-  artnet->pollreply.estaCode = 0;
-  memcpy(artnet->pollreply.shortName, gArtStatus.cfg->shortName, ARTNET_SHORT_NAME_LENGTH);
-  memcpy(artnet->pollreply.longName, gArtStatus.cfg->longName, ARTNET_LONG_NAME_LENGTH);
+  // Replay up to the end, or the first bad record
+  st->journalOffset = ARTNET_JOURNAL_HDR;
 
-  artnetBuildReportCode(artnet->pollreply.nodereport);
+  while(st->journalOffset + 4 <= flash->sectorSize)
+  {
+    uint32_t at = st->journalSector * flash->sectorSize + st->journalOffset;
+    uint16_t crc;
 
-  artnet->pollreply.swvideo = 0;
-  artnet->pollreply.swmacro = 0;
-  artnet->pollreply.swremote = 0;
+    if(!flash->read(flash->arg, at, rec, 4) || rec[0] == ARTNET_JREC_END)
+      break;
 
-  artnet->pollreply.sp1 = artnet->pollreply.sp2 = artnet->pollreply.sp3 = 0;
+    if(rec[1] > ARTNET_LONG_NAME_LENGTH || st->journalOffset + 4 + rec[1] > flash->sectorSize ||
+       !flash->read(flash->arg, at + 4, &rec[4], rec[1]))
+      break;
 
-  artnet->pollreply.style = STNODE;
-  memcpy(artnet->pollreply.mac, gArtStatus.cfg->iface->cfg->mac, 6);
-  artnet->pollreply.bindIp = artnet->pollreply.ip;
+    crc = artnetCrc16(rec, 2, 0xffff);
+    crc = artnetCrc16(&rec[4], rec[1], crc);
 
-  artnet->pollreply.status2 = ARTNET_STATUS2_ARTNETV4;
+    if(crc != ((rec[2] << 8) | rec[3]) || !artnetJournalApply(&st->journal, rec[0], rec[1], &rec[4]))
+      break;
 
-  if(gArtStatus.cfg->sacnEnabled)
-    artnet->pollreply.status2 |= ARTNET_STATUS2_HAS_SACN;
-  
-  memset(artnet->pollreply.filler, 0, 26);
+    st->journalOffset += (4 + rec[1] + 3) & ~3;
+  }
 
-  for(i = 0; i < ARTNET_GROUPS; i++)
+  // What follows a bad record can't be appended to
+  if(st->journalOffset + 4 <= flash->sectorSize)
   {
-    uint8_t j;
-    artnet_group_t *grp = &gArtStatus.cfg->groups[i];
+    flash->read(flash->arg, st->journalSector * flash->sectorSize + st->journalOffset, rec, 1);
+    if(rec[0] != ARTNET_JREC_END)
+      st->journalCompact = true;
+  }
 
-    artnet->pollreply.net = grp->net;
-    artnet->pollreply.sub = grp->subnet;
-    
-    artnet->pollreply.numbports = htons(grp->ports);
-    for(j = 0; j < 4; j++)
-    {
-      artnet->pollreply.portTypes[j] = grp->portType[j];
-      artnet->pollreply.inputStatus[j] = grp->inputStatus[j];
-      artnet->pollreply.outputStatus[j] = grp->outputStatus[j];
-      artnet->pollreply.inputSubswitch[j] = grp->swin[j];
-      artnet->pollreply.outputSubswitch[j] = grp->swout[j];
-    }
-  
-    // which group this reply belongs to
-    artnet->pollreply.bindIndex = i;
-    
-    // Send it for each group
-    uint8_t bcastMac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-    ustackUdpSend(gArtStatus.cfg->iface,
-                  bcastMac,
-                  ustackGetDirectedBroadcast(gArtStatus.cfg->iface->cfg->ip,
-                                             gArtStatus.cfg->iface->cfg->netmask),
-                  gArtStatus.cfg->port, gArtStatus.cfg->port,
-                  sizeof(struct artnet_pollreply_t));
+  memcpy(st->cfg->shortName, st->journal.shortName, ARTNET_SHORT_NAME_LENGTH);
+  memcpy(st->cfg->longName, st->journal.longName, ARTNET_LONG_NAME_LENGTH);
+  if(st->journal.ip != 0)
+    st->cfg->iface->cfg->ip = st->journal.ip;
+  if(st->journal.netmask != 0)
+    st->cfg->iface->cfg->netmask = st->journal.netmask;
+  if(st->journal.port != 0)
+    st->cfg->port = st->journal.port;
+  for(g = 0; g < ARTNET_GROUPS; g++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[g];
 
-    gArtStatus.pollCount++;
-    if(gArtStatus.pollCount > 9999)
-      gArtStatus.pollCount = 0;
+    grp->net = st->journal.groups[g].net;
+    grp->subnet = st->journal.groups[g].subnet;
+    memcpy(grp->outputStatus, st->journal.groups[g].outputStatus, ARTNET_MAX_PORTS);
+    memcpy(grp->swin, st->journal.groups[g].swin, ARTNET_MAX_PORTS);
+    memcpy(grp->swout, st->journal.groups[g].swout, ARTNET_MAX_PORTS);
   }
+
+  return true;
 }
 
 /**
- * ArtIpProg
- *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No action.
- *                  | Unicast Transmit      | Controller transmits to a specific node IP address.
- *                  | Directed Broadcast    | No allowed.
- * --------------------------------------------------------------------------------------
- * Node             | Receive               | Reply by broadcasting ArtIpProgReply.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | Reply by broadcasting ArtIpProgReply.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- *
- * The ArtIpProg packet allows the IP settings of a Node to be reprogrammed.
- * The ArtIpProg packet is sent by a Controller to the private address of a Node. 
- * If the Node supports remote programming of IP address, it will respond with an 
- * ArtIpProgReply packet.
- * In all scenarios, the ArtIpProgReply is sent to the private address of the sender.
+ * Writes config changes to the journal, from
+ * the storage thread
  *
+ * Every ARTNET_JOURNAL_PERIOD_MS, only the items that
+ * differ from what's written, so consoles re-sending the
+ * same ArtAddress cost no flash. Compacts when full, or
+ * first thing if the load asked for it.
  */
-static void artnetHandleIPProg(artnet_packet_u *artnet)
+static void artnetJournalService(artnet_status_t *st)
 {
-  bool restartNic = false;
-  uint32_t ip = 0;
-  uint32_t nm = 0;
-  uint16_t aport = 0;
-  
-  if(artnet->ipprog.command != 0)
+  artnet_snapshot_t snap;
+  artnet_persist_t *j = &st->journal;
+  uint8_t g;
+
+  if(st->cfg->flash == NULL || !st->journalReady)
+    return;
+
+  if(st->journalCompact)
   {
-    if(artnet->ipprog.command & ARTNET_IPPROG_ENABLE)
-    {
-      if(artnet->ipprog.command & ARTNET_IPPROG_DEF)
-      {
-        // Set defaults
-        ip = artnetDefaultIp(true);
-        nm = artnetDefaultNetmask();
-        gArtStatus.cfg->port = ARTNET_PORT;
-        gArtStatus.reportCode = ARTNET_RCFACTORYRES;
-        restartNic = true;
-      }
-      else
-      {
-        if(artnet->ipprog.command & ARTNET_IPPROG_IP)
-        {
-          // Changed IP
-          ip = ntohl(artnet->ipprog.ip);
-          restartNic = true;
-        }
+    st->journalCompact = false;
+    artnetJournalCompact(st);
+  }
 
-        if(artnet->ipprog.command & ARTNET_IPPROG_SUB)
-        {
-          // Changed netmask
-          nm = ntohl(artnet->ipprog.subnet);
-          restartNic = true;
-        }
+  if(chTimeDiffX(st->journalLast, chVTGetSystemTimeX()) < TIME_MS2I(ARTNET_JOURNAL_PERIOD_MS))
+    return;
 
-        if(artnet->ipprog.command & ARTNET_IPPROG_PORT)
-        {
-          // Changed Port
-          aport = htons(artnet->ipprog.port);
-          restartNic = true;
-        }
-      }
-      
-    }
+  st->journalLast = chVTGetSystemTimeX();
+
+  // The packet thread keeps changing the config
+  artnetGetSnapshot(st, &snap);
+
+  if(memcmp(j->shortName, snap.shortName, ARTNET_SHORT_NAME_LENGTH) != 0)
+  {
+    memcpy(j->shortName, snap.shortName, ARTNET_SHORT_NAME_LENGTH);
+    if(!artnetJournalAppend(st, ARTNET_JREC_SHORTNAME, 0))
+      artnetJournalCompact(st);
+  }
+
+  if(memcmp(j->longName, snap.longName, ARTNET_LONG_NAME_LENGTH) != 0)
+  {
+    memcpy(j->longName, snap.longName, ARTNET_LONG_NAME_LENGTH);
+    if(!artnetJournalAppend(st, ARTNET_JREC_LONGNAME, 0))
+      artnetJournalCompact(st);
+  }
+
+  if(j->ip != snap.ip || j->netmask != snap.netmask || j->port != snap.port)
+  {
+    j->ip = snap.ip;
+    j->netmask = snap.netmask;
+    j->port = snap.port;
+    if(!artnetJournalAppend(st, ARTNET_JREC_NETWORK, 0))
+      artnetJournalCompact(st);
+  }
+
+  for(g = 0; g < ARTNET_GROUPS; g++)
+  {
+    if(j->groups[g].net == snap.groups[g].net &&
+       j->groups[g].subnet == snap.groups[g].subnet &&
+       memcmp(j->groups[g].outputStatus, snap.groups[g].outputStatus, ARTNET_MAX_PORTS) == 0 &&
+       memcmp(j->groups[g].swin, snap.groups[g].swin, ARTNET_MAX_PORTS) == 0 &&
+       memcmp(j->groups[g].swout, snap.groups[g].swout, ARTNET_MAX_PORTS) == 0)
+      continue;
+
+    j->groups[g].net = snap.groups[g].net;
+    j->groups[g].subnet = snap.groups[g].subnet;
+    memcpy(j->groups[g].outputStatus, snap.groups[g].outputStatus, ARTNET_MAX_PORTS);
+    memcpy(j->groups[g].swin, snap.groups[g].swin, ARTNET_MAX_PORTS);
+    memcpy(j->groups[g].swout, snap.groups[g].swout, ARTNET_MAX_PORTS);
+    if(!artnetJournalAppend(st, ARTNET_JREC_GROUP, g))
+      artnetJournalCompact(st);
+  }
+}
+
+/**
+ * Forgets all ArtDmx sources and port owners
+ */
+static void artnetSourcesReset(artnet_status_t *st)
+{
+  memset(st->sources, 0, sizeof(st->sources));
+  memset(st->portOwner, 0xff, sizeof(st->portOwner));
+}
+
+/**
+ * Frees a port of its owner, its routing changed
+ *
+ * uint8_t port - the port index, see ARTNET_PORT_INDEX
+ */
+static void artnetPortRelease(artnet_status_t *st, uint8_t port)
+{
+  uint8_t owner = st->portOwner[port];
+
+  if(owner == 0xff)
+    return;
+
+  st->sources[owner].owns &= ~(1UL << port);
+  st->portOwner[port] = 0xff;
+}
+
+/**
+ * Restarts ethernet, to apply
+ * ethernet config changes
+ *
+ */
+static void artnetRestart(artnet_status_t *st, uint32_t ip, uint32_t nm, uint16_t port)
+{
+  dbg(":: ARTNET :: Restarting Ethernet");
+  
+  if(port != st->cfg->port)
+  {
+    if(!artnetPortShared(st, st->cfg->port))
+      ustackUdpRemoveListener(st->cfg->port);
+    st->cfg->port = port;
   }
+
+  if(ip != 0 && ip != st->cfg->iface->cfg->ip)
+    st->cfg->iface->cfg->ip = ip;
+
+  if(nm != 0 && nm != st->cfg->iface->cfg->netmask)
+    st->cfg->iface->cfg->netmask = nm;
   
-  memcpy(artnet->ipprogreply.id, "Art-Net\0", 8);
-  artnet->ipprogreply.opCode = ARTNET_OPCODE_IPREPLY;
-  artnet->ipprogreply.prot_ver_hi = ARTNET_VERSION;
-  artnet->ipprogreply.prot_ver_low = 0;
-  memset(artnet->ipprogreply.nu1, 0, 4);
-  artnet->ipprogreply.ip = ip;
-  artnet->ipprogreply.subnet = nm;
-  artnet->ipprogreply.port = htons(gArtStatus.cfg->port);
-  artnet->ipprogreply.status = 0;
-  memset(artnet->ipprogreply.nu2, 0, 7);
-
-  ustackUdpSend(gArtStatus.cfg->iface,
-                NULL,
-                0,
-                gArtStatus.cfg->port, gArtStatus.cfg->port,
-                sizeof(struct artnet_ipprog_reply_tp));
+  st->pollCount = 0;
+  artnetSourcesReset(st);
+
+  artnetSetLedsNormal(st);
   
-  if(restartNic)
+  st->reportCode = ARTNET_RCPOWEROK;
+
+  // Artnet
+  dbgf(":: ARTNET :: Binding Artnet to Port: %d\r\n", st->cfg->port);
+  if(!artnetPortShared(st, st->cfg->port))
+    ustackUdpAddListener(st->cfg->port, artnetParser);
+
+  if(st->cfg->sacnEnabled)
   {
-    chThdSleepMilliseconds(1000);
-    artnetRestart(ip, nm, aport);
+    // sACN
+    dbgf(":: ARTNET :: Binding sACN to Port: %d\r\n", st->cfg->sacnPort);
+    if(!artnetPortShared(st, st->cfg->sacnPort))
+      ustackUdpAddListener(st->cfg->sacnPort, sacnParser);
+    st->sacnGroupsDirty = true;
   }
+
+  artnetPublish(st);
 }
 
 /**
- * ArtAddress
+ * builds a node report code
  *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No action.
- *                  | Unicast Transmit      | Controller transmits to a specific node IP address.
- *                  | Directed Broadcast    | No allowed.
- * --------------------------------------------------------------------------------------
- * Node             | Receive               | Reply by broadcasting ArtPollReply.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | Reply by broadcasting ArtPollReply.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
+ * uint8_t report - the output holding the report code string
  *
- * A Controller or monitoring device on the network can reprogram numerous controls of a
- * node remotely. This, for example, would allow the lighting console to re-route DMX512 
- * data at remote locations. This is achieved by sending an ArtAddress packet to the Node’s 
- * IP address. (The IP address is returned in the ArtPoll packet). The node replies with an 
- * ArtPollReply packet.
+ */
+static void artnetBuildReportCode(artnet_status_t *st, uint8_t *report)
+{
+  char tmp[4] = { '0', '0', '0', '0' };
+
+  memset(st->report, 0, ARTNET_REPORT_LENGTH);
+  
+  if(st->reportCode < ARTNET_RCMAXCODE)
+    artnetPrntnum(st->reportCode, 16, ' ', tmp);
+
+  report[0] = '#';
+  report[1] = '0';
+  report[2] = '0';
+  report[3] = (st->reportCode > 0xf) ? tmp[0] : '0';
+  report[4] = (st->reportCode > 0xf) ? tmp[1] : tmp[0];
+
+  tmp[0] = '0'; tmp[1] = '0'; tmp[2] = '0'; tmp[3] = '0';
+  artnetPrntnum(st->pollCount, 10, ' ', tmp);
+
+  report[5] = '[';
+
+  if(st->pollCount < 10)  { report[6] = tmp[3]; report[7] = tmp[2]; report[8] = tmp[1]; report[9] = tmp[0]; }
+  if(st->pollCount > 9)   { report[6] = tmp[3]; report[7] = tmp[2]; report[8] = tmp[0]; report[9] = tmp[1]; }
+  if(st->pollCount > 99)  { report[6] = tmp[3]; report[7] = tmp[0]; report[8] = tmp[1]; report[9] = tmp[2]; }
+  if(st->pollCount > 999) { report[6] = tmp[0]; report[7] = tmp[1]; report[8] = tmp[2]; report[9] = tmp[3]; }
+
+  report[10] = ']';
+
+  memcpy(&report[11], gReportCodeTable[st->reportCode], ARTNET_REPORT_LENGTH - 11);
+}
+
+/**
+ * Stores a frame for the refresh
  *
- * Fields 5 to 13 contain the data that will be programmed into the node
+ * Only the caller touches write, no lock while copying.
  *
+ * artnet_frames_t *f - the frames
+ * uint8_t code       - start code
+ * uint16_t len       - how many slots
+ * uint8_t *data      - the slots
  */
-static void artnetHandleAddress(artnet_packet_u *artnet)
+static void artnetFramePut(artnet_frames_t *f, uint8_t code, uint16_t len, uint8_t *data)
 {
-  uint8_t i, group;
+  uint8_t tmp;
 
-  group = artnet->address.bindIndex;
+  memcpy(f->buf[f->write], data, len);
+  f->len[f->write] = len;
+  f->code[f->write] = code;
 
-  if(artnet->address.short_name[0] != 0)
-    memcpy(gArtStatus.cfg->shortName, artnet->address.short_name, ARTNET_SHORT_NAME_LENGTH);
+  chSysLock();
+  tmp = f->pending;
+  f->pending = f->write;
+  f->write = tmp;
+  if(f->fresh)
+    f->coalesced++;
+  f->fresh = true;
+  chSysUnlock();
+}
 
-  if(artnet->address.long_name[0] != 0)
-    memcpy(gArtStatus.cfg->longName, artnet->address.long_name, ARTNET_LONG_NAME_LENGTH);
+/**
+ * Takes the latest frame to the front
+ *
+ * artnet_frames_t *f - the frames
+ *
+ * Returns true if there was a new one
+ */
+static bool artnetFrameTake(artnet_frames_t *f)
+{
+  bool fresh;
+  uint8_t tmp;
 
-  // Find the group this artaddress belongs to
-  if(group > ARTNET_GROUPS)
-    group = 0;
-  
-  artnet_group_t *grp = &gArtStatus.cfg->groups[group];
+  chSysLock();
+  fresh = f->fresh;
+  if(fresh)
+  {
+    tmp = f->front;
+    f->front = f->pending;
+    f->pending = tmp;
+    f->fresh = false;
+  }
+  chSysUnlock();
 
-  if(grp != NULL)
+  return fresh;
+}
+
+/**
+ * Line time of a frame, in us
+ *
+ * artnet_refresh_t *ref - the port refresh config
+ * uint16_t len          - slots, start code not included
+ */
+static uint32_t artnetFrameUs(artnet_refresh_t *ref, uint16_t len)
+{
+  return (ref->breakUs ? ref->breakUs : ARTNET_REFRESH_BREAK_US) +
+         (ref->mabUs ? ref->mabUs : ARTNET_REFRESH_MAB_US) +
+         44UL * (1 + len);
+}
+
+/**
+ * Curves a frame through one table
+ *
+ * Four slots a word, the word store is what the
+ * compiler can't do for us on byte lookups.
+ */
+static void artnetCurveLut(const uint8_t *lut, uint8_t *out, const uint8_t *in, uint16_t len)
+{
+  uint16_t k = 0;
+
+  for(; k + 4 <= len; k += 4)
   {
-    if (artnet->address.net & 0x80)
-      grp->net = artnet->address.net & 0x7f;
-    else if(artnet->address.net == 0)
-      grp->net = 0;
-    
-    if (artnet->address.sub & 0x80)
-      grp->subnet = artnet->address.sub & 0x7f;
-    else if(artnet->address.sub == 0)
-      grp->subnet = 0;
-    
-    // Process only the amount of ports in the group
-    // ignore the rest
-    for(i = 0; i < grp->ports; i++)
+    uint32_t v;
+
+    memcpy(&v, &in[k], 4);
+    v = (uint32_t)lut[v & 0xff] |
+        ((uint32_t)lut[(v >> 8) & 0xff] << 8) |
+        ((uint32_t)lut[(v >> 16) & 0xff] << 16) |
+        ((uint32_t)lut[v >> 24] << 24);
+    memcpy(&out[k], &v, 4);
+  }
+
+  for(; k < len; k++)
+    out[k] = lut[in[k]];
+}
+
+/**
+ * Hands a frame to the port dmxcb
+ *
+ * Through the port curves, if it has any.
+ *
+ * uint8_t port      - the port index, see ARTNET_PORT_INDEX
+ * uint16_t *data16  - same frame in 16 bit, or NULL, for
+ *                     slots without a curve to dmx16cb
+ */
+static void artnetDeliverDmx(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data, uint16_t *data16)
+{
+  artnet_group_t *grp = &st->cfg->groups[port / ARTNET_MAX_PORTS];
+  uint8_t i;
+
+  artnetBootMark(st, ARTNET_BOOT_FIRSTDMX);
+
+#if !ARTNET_USE_CURVE16
+  (void)data16;
+#else
+  if(grp->dmx16cb != NULL)
+  {
+    uint16_t *out16 = st->curveOut16[port];
+    uint16_t k;
+
+    for(k = 0; k < len; k++)
+      out16[k] = (data16 != NULL) ? data16[k] : data[k] * 257;
+
+    if(st->curvePorts & (1UL << port))
     {
-      if(artnet->address.swin[i] & 0x80)
-        grp->swin[i] = artnet->address.swin[i] & 0x7f;
-      else if(artnet->address.swin[i] == 0) // Default ( group id + port )
-        grp->swin[i] = group + i;
+      for(i = 0; i < st->cfg->curveRangeCount; i++)
+      {
+        artnet_curve_range_t *r = &st->cfg->curveRange[i];
+        const uint16_t *lut = st->curveLut16[r->curve];
 
-      if(artnet->address.swout[i] & 0x80)
-        grp->swout[i] = artnet->address.swout[i] & 0x7f;
-      else if(artnet->address.swout[i] == 0) // Default ( group id + port )
-        grp->swout[i] = group + i;
+        if(r->port != port)
+          continue;
+
+        for(k = r->first; k < r->first + r->count && k < len; k++)
+          out16[k] = lut[data[k]];
+      }
     }
 
-    switch(artnet->address.command)
-    {
-        // AcNone
-      case ARTNET_ACNONE:
-        break;
+    grp->dmx16cb(port, len, out16);
+  }
+#endif
 
-        // AcCancelMerge
-      case ARTNET_ACCANCELMERGE:
-        break;
-        
-        // AcLedNormal
-      case ARTNET_ACLEDNORMAL:
-        artnetSetLedsNormal();
-        break;
-        // AcLedMute
-      case ARTNET_ACLEDMUTE:
-        artnetSetLedssMute();
-        break;
-        // AcLedLocate
-      case ARTNET_ACLEDLOCATE:
-        artnetSetLedsLocate();
-        break;
+  if(grp->dmxcb == NULL)
+    return;
 
-        // AcResetRx Flags
-      case ARTNET_ACRESETRX:
-        break;
-        
-        // Merge ---- we do not support merging !
-        // AcMergeLtp0
-      case ARTNET_ACMERGELTP0:
-        //grp->outputStatus[0] |= ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeLtp1
-      case ARTNET_ACMERGELTP1:
-        //grp->outputStatus[1] |= ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeLtp2
-      case ARTNET_ACMERGELTP2:
-        //grp->outputStatus[2] |= ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeLtp3
-      case ARTNET_ACMERGELTP3:
-        //grp->outputStatus[3] |= ARTNET_OUTPUT_LTP;
-        break;
+  if(!(st->curvePorts & (1UL << port)))
+  {
+    grp->dmxcb(port, len, data);
+    return;
+  }
 
-        // AcMergeHtp0
-      case ARTNET_ACMERGEHTP0: 
-        //grp->outputStatus[0] &= ~ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeHtp1
-      case ARTNET_ACMERGEHTP1: 
-        //grp->outputStatus[1] &= ~ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeHtp2
-      case ARTNET_ACMERGEHTP2: 
-        //grp->outputStatus[2] &= ~ARTNET_OUTPUT_LTP;
-        break;
-        // AcMergeHtp3
-      case ARTNET_ACMERGEHTP3: 
-        //grp->outputStatus[3] &= ~ARTNET_OUTPUT_LTP;
-        break;
+  memcpy(st->curveOut[port], data, len);
 
-      // Output
+  for(i = 0; i < st->cfg->curveRangeCount; i++)
+  {
+    artnet_curve_range_t *r = &st->cfg->curveRange[i];
 
-        // AcArtnetSel0
-      case ARTNET_ACARTNETSEL0:
-        grp->outputStatus[0] = 0;
-        break;
-        // AcArtnetSel1
-      case ARTNET_ACARTNETSEL1:
-        grp->outputStatus[1] = 0;
-        break;
-        // AcArtnetSel2
-      case ARTNET_ACARTNETSEL2:
-        grp->outputStatus[2] = 0;
-        break;
-        // AcArtnetSel3
-      case ARTNET_ACARTNETSEL3:
-        grp->outputStatus[3] = 0;
-        break;
+    if(r->port != port || r->first >= len)
+      continue;
 
-        // AcAcnSel0
-      case ARTNET_ACACNSEL0:
-        grp->outputStatus[0] |= ARTNET_OUTPUT_SACN;
-        break;
-        // AcAcnSel1
-      case ARTNET_ACACNSEL1:
-        grp->outputStatus[1] |= ARTNET_OUTPUT_SACN;
-        break;
-        // AcAcnSel2
-      case ARTNET_ACACNSEL2:
-        grp->outputStatus[2] |= ARTNET_OUTPUT_SACN;
-        break;
-        // AcAcnSel3
-      case ARTNET_ACACNSEL3:
-        grp->outputStatus[3] |= ARTNET_OUTPUT_SACN;
-        break;
-        
-        // Clear outputs
-        // AcClearOp0
-      case ARTNET_ACCLEAROP0:
-        artnetClearDmxOutput(grp, 0);
-        break;
-        // AcClearOp1
-      case ARTNET_ACCLEAROP1:
-        artnetClearDmxOutput(grp, 1);
-        break;
-        // AcClearOp2
-      case ARTNET_ACCLEAROP2:
-        artnetClearDmxOutput(grp, 2);
+    artnetCurveLut(st->curveLut[r->curve], &st->curveOut[port][r->first], &data[r->first],
+                   (r->first + r->count > len) ? len - r->first : r->count);
+  }
+
+  grp->dmxcb(port, len, st->curveOut[port]);
+}
+
+/**
+ * Outputs a DMX frame on a port
+ *
+ * Straight to the group callback, or stored for the
+ * refresh if the port has a refresh rate.
+ *
+ * uint8_t port  - the port index, see ARTNET_PORT_INDEX
+ * uint16_t len  - how many slots
+ * uint8_t *data - the slots
+ */
+static void artnetOutputFrame(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data)
+{
+  if(len > ARTNET_DMX_LENGTH)
+    len = ARTNET_DMX_LENGTH;
+
+  if(st->cfg->refresh[port].rateHz == 0)
+  {
+    artnetDeliverDmx(st, port, len, data, NULL);
+    return;
+  }
+
+  artnetFramePut(&st->output[port].dmx, 0, len, data);
+}
+
+#if ARTNET_USE_SHOW
+/**
+ * Show recorder and player, see artnet_show_t
+ */
+
+#define ARTNET_SHOW_MAGIC "ASH1"
+#define ARTNET_SHOW_RECORD_MAX (2 + 5 + 3 + ARTNET_DMX_LENGTH) // Key frame, the largest record
+
+static uint8_t *artnetShowPutVarint(uint8_t *p, uint32_t v)
+{
+  while(v >= 0x80)
+  {
+    *p++ = 0x80 | (v & 0x7f);
+    v >>= 7;
+  }
+  *p++ = v;
+
+  return p;
+}
+
+/**
+ * Records a frame output on a port, from the packet thread
+ *
+ * Slots are compared a word at a time, runs of changes
+ * less than 3 slots apart are merged, a delta as large
+ * as the key frame is dropped for the key frame.
+ * Unchanged frames are not recorded.
+ */
+static void artnetShowPut(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data)
+{
+  artnet_show_t *show = &st->show;
+  systime_t now = chVTGetSystemTimeX();
+  uint32_t ms = TIME_I2MS(chTimeDiffX(show->last, now));
+  uint8_t *old = show->frame[port];
+  uint8_t *rec, *hdr, *p;
+  uint16_t k, prevEnd = 0, runs = 0;
+  bool key;
+
+  chSysLock();
+  if(show->state != ARTNET_SHOW_RECORDING)
+  {
+    chSysUnlock();
+    return;
+  }
+  show->putting = true;
+  chSysUnlock();
+
+  // Room for the largest record, or hand this buffer to be written
+  if(show->fill[show->active] + ARTNET_SHOW_RECORD_MAX + 1 > ARTNET_SHOW_BUF)
+  {
+    chSysLock();
+    if(show->pending != 0xff)
+    {
+      show->overrun = true;
+      show->state = ARTNET_SHOW_STOPPING;
+      show->putting = false;
+      chSysUnlock();
+      return;
+    }
+    show->pending = show->active;
+    show->active ^= 1;
+    show->fill[show->active] = 0;
+    chSysUnlock();
+  }
+
+  rec = &show->buf[show->active][show->fill[show->active]];
+  hdr = artnetShowPutVarint(rec + 2, ms);
+  p = hdr;
+  rec[1] = port;
+
+  key = (show->len[port] != len) ||
+        chTimeDiffX(show->key[port], now) >= TIME_MS2I(ARTNET_SHOW_KEYFRAME_MS);
+
+  if(!key)
+  {
+    // Run count, 2 byte varint filled in at the end
+    p += 2;
+
+    for(k = 0; k < len; )
+    {
+      uint16_t start, end, j;
+
+      for(; k + 4 <= len; k += 4)
+      {
+        uint32_t a, b;
+
+        memcpy(&a, &data[k], 4);
+        memcpy(&b, &old[k], 4);
+        if(a != b)
+          break;
+      }
+      while(k < len && data[k] == old[k])
+        k++;
+      if(k >= len)
         break;
-        // AcClearOp3
-      case ARTNET_ACCLEAROP3:
-        artnetClearDmxOutput(grp, 3);
+
+      start = k;
+      end = k + 1;
+      for(j = k + 1; j < len && j - end < 3; j++)
+      {
+        if(data[j] != old[j])
+          end = j + 1;
+      }
+
+      // Not smaller than the key frame
+      if((p - hdr) + 6 + (end - start) >= len + 3)
+      {
+        key = true;
         break;
-    };
+      }
+
+      p = artnetShowPutVarint(p, start - prevEnd);
+      p = artnetShowPutVarint(p, end - start);
+      memcpy(p, &data[start], end - start);
+      p += end - start;
+
+      prevEnd = end;
+      k = end;
+      runs++;
+    }
+
+    if(!key && runs == 0)
+    {
+      show->putting = false;
+      return;
+    }
+
+    hdr[0] = 0x80 | (runs & 0x7f);
+    hdr[1] = runs >> 7;
+    rec[0] = ARTNET_SHOW_DELTA;
   }
-  
-  artnetSendPollReply(artnet);
+
+  if(key)
+  {
+    p = artnetShowPutVarint(hdr, len);
+    memcpy(p, data, len);
+    p += len;
+    rec[0] = ARTNET_SHOW_KEY;
+    show->key[port] = now;
+  }
+
+  memcpy(old, data, len);
+  show->len[port] = len;
+  show->last += TIME_MS2I(ms);
+  show->records++;
+  show->fill[show->active] += p - rec;
+
+  show->putting = false;
 }
 
 /**
- * ArtDmx
+ * Reads the show from the read-ahead
  *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | Application specific.
- *                  | Unicast Transmit      | Yes
- *                  | Directed Broadcast    | No
- * --------------------------------------------------------------------------------------
- * Node             | Receive               | Application specific
- *                  | Unicast Transmit      | Yes
- *                  | Broadcast             | No
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | Application specific.
- *                  | Unicast Transmit      | Yes
- *                  | Broadcast             | No
- * --------------------------------------------------------------------------------------
+ * Returns false if it doesn't hold len bytes, at
+ * the end of the storage or if it ran dry.
+ */
+static bool artnetShowRead(artnet_status_t *st, uint8_t *data, uint16_t len)
+{
+  artnet_show_t *show = &st->show;
+
+  if((uint16_t)(show->raHead - show->raTail) < len)
+    return false;
+
+  while(len-- > 0)
+    *data++ = show->ra[show->raTail++ % ARTNET_SHOW_READ];
+
+  return true;
+}
+
+static bool artnetShowReadVarint(artnet_status_t *st, uint32_t *v)
+{
+  uint8_t b, shift = 0;
+
+  *v = 0;
+  do
+  {
+    if(shift > 28 || !artnetShowRead(st, &b, 1))
+      return false;
+
+    *v |= (uint32_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while(b & 0x80);
+
+  return true;
+}
+
+/**
+ * Player back to the first record
  *
- * ArtDmx is the data packet used to transfer DMX512 data. The format is identical for 
- * Node to Controller, Node to Node and Controller to Node.
- * The Data is output through the DMX O/P port corresponding to the Universe setting. In 
- * the absence of received ArtDmx packets, each DMX O/P port re-transmits the same 
- * frame continuously.
+ * The storage thread refills the read-ahead from the
+ * start, the player waits for it, see artnetShowReady()
+ */
+static void artnetShowRewind(artnet_status_t *st)
+{
+  st->show.started = false;
+  st->show.raReset = true;
+}
+
+/**
+ * Does the read-ahead hold the next record ?
  *
- * The first complete DMX frame received at each input port is placed in an ArtDmx packet 
- * as above and transmitted as an ArtDmx packet containing the relevant Universe parameter.
- * Each subsequent DMX frame containing new data (different length or different contents) 
- * is also transmitted as an ArtDmx packet.
+ * Any record fits, or the storage thread is at the end.
+ */
+static bool artnetShowReady(artnet_status_t *st)
+{
+  artnet_show_t *show = &st->show;
+
+  if(show->raReset)
+    return false;
+
+  return show->raEof || (uint16_t)(show->raHead - show->raTail) >= ARTNET_SHOW_RECORD_MAX + 4;
+}
+
+/**
+ * Reads the header of the next record
  *
- * Nodes do not transmit ArtDmx for DMX 512 inputs that have not received data since power on.
- * However, an input that is active but not changing, will re-transmit the last valid ArtDmx 
- * packet at approximately 4-second intervals.
+ * Returns false at the end of the show
+ */
+static bool artnetShowNext(artnet_status_t *st)
+{
+  artnet_show_t *show = &st->show;
+  uint32_t ms;
+
+  if(!artnetShowRead(st, &show->nextType, 1) ||
+     (show->nextType != ARTNET_SHOW_KEY && show->nextType != ARTNET_SHOW_DELTA) ||
+     !artnetShowRead(st, &show->nextPort, 1) ||
+     show->nextPort >= ARTNET_GROUPS * ARTNET_MAX_PORTS ||
+     !artnetShowReadVarint(st, &ms))
+    return false;
+
+  show->wait = TIME_MS2I(ms);
+  return true;
+}
+
+/**
+ * Plays the record read the header of
  *
- * (Note. In order to converge the needs of Art-Net and sACN it is recommended that Art-Net 
- * devices actually use a re-transmit time of 800mS to 1000mS).
+ * Patches the port's current frame in place and
+ * outputs it, nothing else of the past is kept.
+ *
+ * Returns false if it doesn't decode
+ */
+static bool artnetShowPlayRecord(artnet_status_t *st)
+{
+  artnet_show_t *show = &st->show;
+  uint8_t port = show->nextPort;
+  uint8_t *frame = show->frame[port];
+  uint32_t len, runs, skip, count, pos = 0;
+
+  if(show->nextType == ARTNET_SHOW_KEY)
+  {
+    if(!artnetShowReadVarint(st, &len) || len > ARTNET_DMX_LENGTH ||
+       !artnetShowRead(st, frame, len))
+      return false;
+
+    show->len[port] = len;
+  }
+  else
+  {
+    if(!artnetShowReadVarint(st, &runs))
+      return false;
+
+    while(runs-- > 0)
+    {
+      if(!artnetShowReadVarint(st, &skip) || !artnetShowReadVarint(st, &count))
+        return false;
+
+      pos += skip;
+      if(pos + count > show->len[port] || !artnetShowRead(st, &frame[pos], count))
+        return false;
+
+      pos += count;
+    }
+  }
+
+  show->records++;
+  artnetOutputFrame(st, port, show->len[port], frame);
+
+  return true;
+}
+
+/**
+ * Writes a recorder staging buffer
+ *
+ * Always leaves a byte for the end record.
+ */
+static bool artnetShowWrite(artnet_status_t *st, uint8_t idx)
+{
+  artnet_show_t *show = &st->show;
+  artnet_show_io_t *io = st->cfg->showIo;
+  uint16_t n = show->fill[idx];
+
+  if(show->offset + n >= io->size || !io->write(io->arg, show->offset, show->buf[idx], n))
+  {
+    show->overrun = true;
+    return false;
+  }
+
+  show->offset += n;
+  show->fill[idx] = 0;
+
+  return true;
+}
+
+/**
+ * Show storage reads and writes, from the
+ * storage thread
+ *
+ * Writes the recorder staging buffers, keeps the
+ * player read-ahead full.
+ */
+static void artnetShowStorage(artnet_status_t *st)
+{
+  artnet_show_t *show = &st->show;
+  artnet_show_io_t *io = st->cfg->showIo;
+
+  if(io == NULL)
+    return;
+
+  switch(show->state)
+  {
+    case ARTNET_SHOW_RECORDING:
+    case ARTNET_SHOW_STOPPING:
+      if(show->pending != 0xff)
+      {
+        bool ok = artnetShowWrite(st, show->pending);
+
+        chSysLock();
+        show->pending = 0xff;
+        if(!ok)
+          show->state = ARTNET_SHOW_STOPPING;
+        chSysUnlock();
+      }
+
+      chSysLock();
+      if(show->state != ARTNET_SHOW_STOPPING || show->putting)
+      {
+        chSysUnlock();
+        break;
+      }
+      chSysUnlock();
+
+      // Nothing else is added now, the rest and the end,
+      // or the end alone in the byte kept for it
+      show->buf[show->active][show->fill[show->active]++] = ARTNET_SHOW_END;
+      if(!artnetShowWrite(st, show->active))
+      {
+        uint8_t end = ARTNET_SHOW_END;
+
+        io->write(io->arg, show->offset, &end, 1);
+      }
+
+      chSysLock();
+      show->state = ARTNET_SHOW_IDLE;
+      chSysUnlock();
+      break;
+
+    case ARTNET_SHOW_PLAYING:
+      if(show->raReset)
+      {
+        show->offset = 0;
+        show->raHead = show->raTail = 0;
+        show->raEof = false;
+        show->raReset = false;
+      }
+
+      while(!show->raEof)
+      {
+        uint16_t at = show->raHead % ARTNET_SHOW_READ;
+        uint16_t n = ARTNET_SHOW_READ - (uint16_t)(show->raHead - show->raTail);
+
+        // Contiguous, up to the end of the ring
+        if(n > ARTNET_SHOW_READ - at)
+          n = ARTNET_SHOW_READ - at;
+        if(n > io->size - show->offset)
+          n = io->size - show->offset;
+        if(n == 0)
+        {
+          if(show->offset >= io->size)
+            show->raEof = true;
+          break;
+        }
+
+        if(!io->read(io->arg, show->offset, &show->ra[at], n))
+        {
+          show->raEof = true;
+          break;
+        }
+
+        show->offset += n;
+        show->raHead += n;
+      }
+      break;
+  }
+}
+
+/**
+ * Show player and auto-play, from the
+ * housekeeping thread
+ *
+ * Reads only from the read-ahead, the storage
+ * thread does the slow part.
+ */
+static void artnetShowService(artnet_status_t *st)
+{
+  artnet_show_t *show = &st->show;
+  systime_t now = chVTGetSystemTimeX();
+  uint8_t i;
+
+  if(st->cfg->showIo == NULL)
+    return;
+
+  switch(show->state)
+  {
+    case ARTNET_SHOW_IDLE:
+      // Console gone, loop the show
+      if(st->cfg->showAutoPlayMs != 0 &&
+         chTimeDiffX(st->lastOutput, now) >= TIME_MS2I(st->cfg->showAutoPlayMs))
+      {
+        st->lastOutput = now;
+        if(artnetShowPlay(st, true))
+          show->autoPlay = true;
+      }
+      break;
+
+    case ARTNET_SHOW_PLAYING:
+      // Stopped from another thread, only now nothing
+      // else outputs, see artnetOutput(st)
+      if(show->stopReq)
+      {
+        chSysLock();
+        show->stopReq = false;
+        show->state = ARTNET_SHOW_IDLE;
+        chSysUnlock();
+        break;
+      }
+
+      if(!show->started)
+      {
+        uint8_t magic[4];
+
+        if(!artnetShowReady(st))
+          break;
+
+        if(!artnetShowRead(st, magic, 4) || memcmp(magic, ARTNET_SHOW_MAGIC, 4) != 0 ||
+           !artnetShowNext(st))
+        {
+          chSysLock();
+          show->state = ARTNET_SHOW_IDLE;
+          chSysUnlock();
+          break;
+        }
+
+        show->started = true;
+        show->last = now;
+      }
+
+      for(i = 0; i < 2 * ARTNET_GROUPS * ARTNET_MAX_PORTS; i++)
+      {
+        // Storage behind, the show runs late rather than skip
+        if(chTimeDiffX(show->last, now) < show->wait || !artnetShowReady(st))
+          break;
+
+        show->last += show->wait;
+
+        if(artnetShowPlayRecord(st) && artnetShowNext(st))
+          continue;
+
+        // End, or a bad record
+        if(show->loop && show->records > 0)
+        {
+          artnetShowRewind(st);
+          break;
+        }
+
+        chSysLock();
+        show->state = ARTNET_SHOW_IDLE;
+        chSysUnlock();
+        break;
+      }
+      break;
+  }
+}
+#endif
+
+/**
+ * Outputs a received DMX frame on a port
+ *
+ * Recorded if the show recorder runs, dropped while a
+ * show plays. If the show started because DMX stopped
+ * this asks the player to end, the frames that come
+ * before it did are dropped too, a port has a single
+ * writer.
+ *
+ * uint8_t port  - the port index, see ARTNET_PORT_INDEX
+ * uint16_t len  - how many slots
+ * uint8_t *data - the slots
+ */
+static void artnetOutput(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data)
+{
+  if(len > ARTNET_DMX_LENGTH)
+    len = ARTNET_DMX_LENGTH;
+
+#if ARTNET_USE_SHOW
+  st->lastOutput = chVTGetSystemTimeX();
+
+  if(st->show.state == ARTNET_SHOW_PLAYING)
+  {
+    if(st->show.autoPlay)
+      st->show.stopReq = true;
+    return;
+  }
+
+  if(st->show.state == ARTNET_SHOW_RECORDING)
+    artnetShowPut(st, port, len, data);
+#endif
+
+  artnetOutputFrame(st, port, len, data);
+}
+
+/**
+ * Outputs an alternate start code frame on a port
+ *
+ * Same as artnetOutput(st), the refresh fits it between
+ * DMX frames.
+ *
+ * uint8_t port      - the port index, see ARTNET_PORT_INDEX
+ * uint8_t startCode - the start code
+ * uint16_t len      - how many slots
+ * uint8_t *data     - the slots
+ */
+static void artnetOutputNzs(artnet_status_t *st, uint8_t port, uint8_t startCode, uint16_t len, uint8_t *data)
+{
+  artnet_group_t *grp = &st->cfg->groups[port / ARTNET_MAX_PORTS];
+
+  if(len > ARTNET_DMX_LENGTH)
+    len = ARTNET_DMX_LENGTH;
+
+  if(st->cfg->refresh[port].rateHz == 0)
+  {
+    if(grp->nzscb != NULL)
+      grp->nzscb(port, startCode, len, data);
+    return;
+  }
+
+  artnetFramePut(&st->output[port].nzs, startCode, len, data);
+}
+
+#if ARTNET_USE_INTERP
+/**
+ * Next interpolated frame of a port
+ *
+ * A new frame starts a fade from the current output,
+ * slots in a snap range or changing more than snapDelta
+ * start at the new value. The blend does two slots per
+ * 16 bit lane of a word, little endian, the weights add
+ * up to 256 so lanes can't carry into each other.
+ *
+ * bool fresh    - data is a new frame
+ * uint16_t len  - its length
+ * uint8_t *data - the frame
+ */
+static void artnetInterpFrame(artnet_status_t *st, uint8_t port, bool fresh,
+                              systime_t now, uint16_t len, uint8_t *data)
+{
+  artnet_interp_t *ip = &st->interp[port];
+  uint8_t snapDelta = st->cfg->refresh[port].snapDelta;
+  uint32_t t, wa, wb;
+  uint16_t k;
+
+  if(fresh)
+  {
+    sysinterval_t since = chTimeDiffX(ip->start, now);
+
+    if(!ip->started || ip->len != len || since > TIME_MS2I(ARTNET_INTERP_MAX_MS))
+    {
+      // Nothing to fade from, or a source too slow to fade
+      memcpy(ip->from, data, len);
+      ip->span = 0;
+    }
+    else
+    {
+      memcpy(ip->from, ip->out, len);
+      ip->span = (ip->span == 0) ? since : (ip->span * 3 + since) / 4;
+
+      for(k = 0; snapDelta != 0 && k < len; k++)
+      {
+        if(data[k] > ip->from[k] + snapDelta || ip->from[k] > data[k] + snapDelta)
+          ip->from[k] = data[k];
+      }
+
+      for(k = 0; k < st->cfg->interpSnapCount; k++)
+      {
+        artnet_interp_snap_t *snap = &st->cfg->interpSnap[k];
+
+        if(snap->port != port || snap->first >= len)
+          continue;
+
+        memcpy(&ip->from[snap->first], &data[snap->first],
+               (snap->first + snap->count > len) ? len - snap->first : snap->count);
+      }
+    }
+
+    memcpy(ip->to, data, len);
+    ip->started = true;
+    ip->len = len;
+    ip->start = now;
+  }
+
+  // Blend weight, 0 to 256
+  t = (ip->span == 0) ? 256 : (chTimeDiffX(ip->start, now) * 256UL) / ip->span;
+  if(t > 256)
+    t = 256;
+
+  wa = 256 - t;
+  wb = t;
+
+  for(k = 0; k + 4 <= ip->len; k += 4)
+  {
+    uint32_t a, b, even, odd;
+
+    memcpy(&a, &ip->from[k], 4);
+    memcpy(&b, &ip->to[k], 4);
+
+    even = (a & 0x00ff00ff) * wa + (b & 0x00ff00ff) * wb;
+    odd = ((a >> 8) & 0x00ff00ff) * wa + ((b >> 8) & 0x00ff00ff) * wb;
+
+#if ARTNET_USE_CURVE16
+    // 8.8 lanes, scaled to full 16 bit
+    ip->out16[k] = (even & 0xffff) + ((even & 0xffff) >> 8);
+    ip->out16[k + 1] = (odd & 0xffff) + ((odd & 0xffff) >> 8);
+    ip->out16[k + 2] = (even >> 16) + (even >> 24);
+    ip->out16[k + 3] = (odd >> 16) + (odd >> 24);
+#endif
+
+    a = ((even >> 8) & 0x00ff00ff) | (odd & 0xff00ff00);
+    memcpy(&ip->out[k], &a, 4);
+  }
+
+  for(; k < ip->len; k++)
+  {
+    uint16_t v = ip->from[k] * wa + ip->to[k] * wb;
+
+#if ARTNET_USE_CURVE16
+    ip->out16[k] = v + (v >> 8);
+#endif
+    ip->out[k] = v >> 8;
+  }
+}
+#endif
+
+/**
+ * Output refresh, from the housekeeping thread
+ *
+ * Each port with a rate outputs its latest frame when
+ * due, the same one again if nothing new came.
+ *
+ * A waiting NZS frame goes right after the DMX one when
+ * the period has room for both, else it takes the place
+ * of a repeat, never of a new DMX frame.
+ */
+static void artnetRefreshService(artnet_status_t *st)
+{
+  systime_t now = chVTGetSystemTimeX();
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_GROUPS * ARTNET_MAX_PORTS; i++)
+  {
+    artnet_refresh_t *ref = &st->cfg->refresh[i];
+    artnet_output_t *out = &st->output[i];
+    artnet_group_t *grp = &st->cfg->groups[i / ARTNET_MAX_PORTS];
+
+    if(ref->rateHz == 0)
+      continue;
+
+    if(chTimeDiffX(out->last, now) < out->period)
+      continue;
+
+    bool fresh = artnetFrameTake(&out->dmx);
+    if(fresh)
+      out->valid = true;
+
+    if(artnetFrameTake(&out->nzs))
+      out->nzsQueued = true;
+
+    bool sendDmx = out->valid;
+    bool sendNzs = out->nzsQueued;
+
+    uint32_t us = 1000000UL / ref->rateHz;
+    uint32_t dmxUs = artnetFrameUs(ref, out->dmx.len[out->dmx.front]);
+    uint32_t nzsUs = artnetFrameUs(ref, out->nzs.len[out->nzs.front]);
+
+    if(sendDmx && sendNzs && dmxUs + nzsUs > us)
+    {
+      if(fresh)
+        sendNzs = false;
+      else
+        sendDmx = false;
+    }
+
+    if(!sendDmx && !sendNzs)
+      continue;
+
+    // Rate, or what the line can do
+    uint32_t lineUs = (sendDmx ? dmxUs : 0) + (sendNzs ? nzsUs : 0);
+    if(us < lineUs)
+      us = lineUs;
+
+    if(sendDmx)
+    {
+#if ARTNET_USE_INTERP
+      if(ref->interpolate)
+      {
+        artnet_interp_t *ip = &st->interp[i];
+
+        artnetInterpFrame(st, i, fresh, now, out->dmx.len[out->dmx.front], out->dmx.buf[out->dmx.front]);
+#if ARTNET_USE_CURVE16
+        artnetDeliverDmx(st, i, ip->len, ip->out, ip->out16);
+#else
+        artnetDeliverDmx(st, i, ip->len, ip->out, NULL);
+#endif
+      }
+      else
+#endif
+        artnetDeliverDmx(st, i, out->dmx.len[out->dmx.front], out->dmx.buf[out->dmx.front], NULL);
+    }
+
+    if(sendNzs)
+    {
+      if(grp->nzscb != NULL)
+        grp->nzscb(i, out->nzs.code[out->nzs.front], out->nzs.len[out->nzs.front], out->nzs.buf[out->nzs.front]);
+      out->nzsQueued = false;
+    }
+
+    // Keep the pace, unless we fell behind
+    out->last += out->period;
+    out->period = TIME_US2I(us);
+    if(chTimeDiffX(out->last, now) >= out->period)
+      out->last = now;
+  }
+}
+
+/**
+ * Clear a DMX ouput setting all channels at 0
+ *
+ * artnet_group_t grp - the group of the port
+ * uint8_t port       - the port number
+ */
+static bool artnetClearDmxOutput(artnet_status_t *st, artnet_group_t *grp, uint8_t port)
+{
+  if(port >= grp->ports) return false;
+
+  uint8_t tmp[512] = {0};
+  artnetOutput(st, ARTNET_PORT_INDEX(grp - st->cfg->groups, port), 512, tmp);
+
+  return true;
+}
+
+/**
+ * Checks if a port is an output for the given Port-Address
+ *
+ * artnet_group_t grp - the group of the port
+ * uint8_t port       - the port number inside the group
+ * uint8_t net        - top 7 bits of the Port-Address
+ * uint8_t subuni     - sub-net and universe
+ */
+static bool artnetIsOutputPort(artnet_group_t *grp, uint8_t port, uint8_t net, uint8_t subuni)
+{
+  if(port >= grp->ports) return false;
+  if(!(grp->portType[port] & ARTNET_TYPE_OUTPUT)) return false;
+  if(grp->net != (net & 0x7f)) return false;
+  if(grp->subnet != (subuni >> 4)) return false;
+  if(grp->swout[port] != (subuni & 0x0f)) return false;
+
+  return true;
+}
+
+/**
+ * 15 bit Port-Address of an output port
+ *
+ * artnet_group_t grp - the group of the port
+ * uint8_t port       - the port number inside the group
+ */
+static uint16_t artnetPortAddress(artnet_group_t *grp, uint8_t port)
+{
+  return ((grp->net & 0x7f) << 8) | ((grp->subnet & 0x0f) << 4) | (grp->swout[port] & 0x0f);
+}
+
+/**
+ * ArtPollReply
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * All Devices      | Receive               | No action.
+ *                  | Unicast Transmit      | Not Allowed.
+ *                  | Directed Broadcast    | Directed broadcast this packet in response
+ *                                            to an ArtPoll
+ * --------------------------------------------------------------------------------------
+ *
+ * A device, in response to a Controller’s ArtPoll, sends the ArtPollReply. This packet 
+ * is also broadcast to the Directed Broadcast address by all Art-Net devices on power up.
+ *
+ * One per group, each built in its TX buffer and queued.
+ * A group without a free buffer is skipped, not the rest.
+ *
+ */
+static void artnetSendPollReply(artnet_status_t *st)
+{
+  uint8_t bcastMac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    uint8_t j;
+    artnet_group_t *grp = &st->cfg->groups[i];
+    artnet_tx_t *tx = artnetTxAlloc(st);
+    artnet_packet_u *artnet;
+
+    if(tx == NULL)
+      continue;
+
+    artnet = (artnet_packet_u*)tx->data;
+
+    memcpy(artnet->pollreply.id, "Art-Net\0", 8);
+    artnet->pollreply.opCode = ARTNET_OPCODE_REPLY;
+    artnet->pollreply.ip = htonl(st->cfg->iface->cfg->ip);
+
+    artnet->pollreply.port = st->cfg->port;
+    artnet->pollreply.ver = VERSION;
+    artnet->pollreply.oem = htons(ARTNET_OEM);
+    artnet->pollreply.ubea = 0;
+
+    artnet->pollreply.status = st->statusLeds | ARTNET_STATUS_PROG_NETWORK;
+
+    if(st->cfg->rdmEnabled)
+      artnet->pollreply.status |= ARTNET_STATUS_RDM_ENABLED;
+
+    artnet->pollreply.estaCode = 0;
+    memcpy(artnet->pollreply.shortName, st->cfg->shortName, ARTNET_SHORT_NAME_LENGTH);
+    memcpy(artnet->pollreply.longName, st->cfg->longName, ARTNET_LONG_NAME_LENGTH);
+
+    artnetBuildReportCode(st, artnet->pollreply.nodereport);
+
+    artnet->pollreply.swvideo = 0;
+    artnet->pollreply.swmacro = 0;
+    artnet->pollreply.swremote = 0;
+
+    artnet->pollreply.sp1 = artnet->pollreply.sp2 = artnet->pollreply.sp3 = 0;
+
+    artnet->pollreply.style = STNODE;
+    memcpy(artnet->pollreply.mac, st->cfg->iface->cfg->mac, 6);
+    artnet->pollreply.bindIp = artnet->pollreply.ip;
+
+    artnet->pollreply.status2 = ARTNET_STATUS2_ARTNETV4;
+
+    if(st->cfg->sacnEnabled)
+      artnet->pollreply.status2 |= ARTNET_STATUS2_HAS_SACN;
+
+    memset(artnet->pollreply.filler, 0, 26);
+
+    artnet->pollreply.net = grp->net;
+    artnet->pollreply.sub = grp->subnet;
+    
+    artnet->pollreply.numbports = htons(grp->ports);
+    for(j = 0; j < 4; j++)
+    {
+      artnet->pollreply.portTypes[j] = grp->portType[j];
+      artnet->pollreply.inputStatus[j] = grp->inputStatus[j];
+      artnet->pollreply.outputStatus[j] = grp->outputStatus[j];
+      artnet->pollreply.inputSubswitch[j] = grp->swin[j];
+      artnet->pollreply.outputSubswitch[j] = grp->swout[j];
+    }
+  
+    // which group this reply belongs to
+    artnet->pollreply.bindIndex = i;
+    
+    // Send it for each group
+    artnetTxQueue(st, tx, bcastMac,
+                  ustackGetDirectedBroadcast(st->cfg->iface->cfg->ip,
+                                             st->cfg->iface->cfg->netmask),
+                  sizeof(struct artnet_pollreply_t));
+
+    st->pollCount++;
+    if(st->pollCount > 9999)
+      st->pollCount = 0;
+  }
+}
+
+/**
+ * ArtIpProg
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No action.
+ *                  | Unicast Transmit      | Controller transmits to a specific node IP address.
+ *                  | Directed Broadcast    | No allowed.
+ * --------------------------------------------------------------------------------------
+ * Node             | Receive               | Reply by broadcasting ArtIpProgReply.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | Reply by broadcasting ArtIpProgReply.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * The ArtIpProg packet allows the IP settings of a Node to be reprogrammed.
+ * The ArtIpProg packet is sent by a Controller to the private address of a Node. 
+ * If the Node supports remote programming of IP address, it will respond with an 
+ * ArtIpProgReply packet.
+ * In all scenarios, the ArtIpProgReply is sent to the private address of the sender.
+ *
+ */
+static void artnetHandleIPProg(artnet_status_t *st, artnet_packet_u *artnet)
+{
+  bool restartNic = false;
+  uint32_t ip = 0;
+  uint32_t nm = 0;
+  uint16_t aport = 0;
+  artnet_tx_t *tx = artnetTxAlloc(st);
+  
+  if(artnet->ipprog.command != 0)
+  {
+    if(artnet->ipprog.command & ARTNET_IPPROG_ENABLE)
+    {
+      if(artnet->ipprog.command & ARTNET_IPPROG_DEF)
+      {
+        // Set defaults
+        ip = artnetDefaultIp(st, true);
+        nm = artnetDefaultNetmask();
+        st->cfg->port = ARTNET_PORT;
+        st->reportCode = ARTNET_RCFACTORYRES;
+        restartNic = true;
+      }
+      else
+      {
+        if(artnet->ipprog.command & ARTNET_IPPROG_IP)
+        {
+          // Changed IP
+          ip = ntohl(artnet->ipprog.ip);
+          restartNic = true;
+        }
+
+        if(artnet->ipprog.command & ARTNET_IPPROG_SUB)
+        {
+          // Changed netmask
+          nm = ntohl(artnet->ipprog.subnet);
+          restartNic = true;
+        }
+
+        if(artnet->ipprog.command & ARTNET_IPPROG_PORT)
+        {
+          // Changed Port
+          aport = htons(artnet->ipprog.port);
+          restartNic = true;
+        }
+      }
+      
+    }
+  }
+  
+  if(tx != NULL)
+  {
+    ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+    artnet_packet_u *reply = (artnet_packet_u*)tx->data;
+
+    memcpy(reply->ipprogreply.id, "Art-Net\0", 8);
+    reply->ipprogreply.opCode = ARTNET_OPCODE_IPREPLY;
+    reply->ipprogreply.prot_ver_hi = ARTNET_VERSION;
+    reply->ipprogreply.prot_ver_low = 0;
+    memset(reply->ipprogreply.nu1, 0, 4);
+    reply->ipprogreply.ip = ip;
+    reply->ipprogreply.subnet = nm;
+    reply->ipprogreply.port = htons(st->cfg->port);
+    reply->ipprogreply.status = 0;
+    memset(reply->ipprogreply.nu2, 0, 7);
+
+    // To the sender private address
+    artnetTxQueue(st, tx, st->cfg->iface->buffer + 6, ntohl(ipv4->srcIp),
+                  sizeof(struct artnet_ipprog_reply_tp));
+  }
+  
+  if(restartNic)
+  {
+    // Goes out from the old address, the request is done with
+    artnetTxSend(st, st->cfg->iface);
+    chThdSleepMilliseconds(1000);
+    artnetRestart(st, ip, nm, aport);
+  }
+}
+
+/**
+ * ArtAddress
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No action.
+ *                  | Unicast Transmit      | Controller transmits to a specific node IP address.
+ *                  | Directed Broadcast    | No allowed.
+ * --------------------------------------------------------------------------------------
+ * Node             | Receive               | Reply by broadcasting ArtPollReply.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | Reply by broadcasting ArtPollReply.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * A Controller or monitoring device on the network can reprogram numerous controls of a
+ * node remotely. This, for example, would allow the lighting console to re-route DMX512 
+ * data at remote locations. This is achieved by sending an ArtAddress packet to the Node’s 
+ * IP address. (The IP address is returned in the ArtPoll packet). The node replies with an 
+ * ArtPollReply packet.
+ *
+ * Fields 5 to 13 contain the data that will be programmed into the node
+ *
+ */
+static void artnetHandleAddress(artnet_status_t *st, artnet_packet_u *artnet)
+{
+  uint8_t i, group;
+
+  group = artnet->address.bindIndex;
+
+  if(artnet->address.short_name[0] != 0)
+    memcpy(st->cfg->shortName, artnet->address.short_name, ARTNET_SHORT_NAME_LENGTH);
+
+  if(artnet->address.long_name[0] != 0)
+    memcpy(st->cfg->longName, artnet->address.long_name, ARTNET_LONG_NAME_LENGTH);
+
+  // Find the group this artaddress belongs to
+  if(group >= ARTNET_GROUPS)
+    group = 0;
+  
+  artnet_group_t *grp = &st->cfg->groups[group];
+
+  if(grp != NULL)
+  {
+    uint16_t before[ARTNET_MAX_PORTS];
+
+    for(i = 0; i < grp->ports; i++)
+      before[i] = artnetPortAddress(grp, i);
+
+    if (artnet->address.net & 0x80)
+      grp->net = artnet->address.net & 0x7f;
+    else if(artnet->address.net == 0)
+      grp->net = 0;
+    
+    if (artnet->address.sub & 0x80)
+      grp->subnet = artnet->address.sub & 0x7f;
+    else if(artnet->address.sub == 0)
+      grp->subnet = 0;
+    
+    // Process only the amount of ports in the group
+    // ignore the rest
+    for(i = 0; i < grp->ports; i++)
+    {
+      if(artnet->address.swin[i] & 0x80)
+        grp->swin[i] = artnet->address.swin[i] & 0x7f;
+      else if(artnet->address.swin[i] == 0) // Default ( group id + port )
+        grp->swin[i] = group + i;
+
+      if(artnet->address.swout[i] & 0x80)
+        grp->swout[i] = artnet->address.swout[i] & 0x7f;
+      else if(artnet->address.swout[i] == 0) // Default ( group id + port )
+        grp->swout[i] = group + i;
+    }
+
+    switch(artnet->address.command)
+    {
+        // AcNone
+      case ARTNET_ACNONE:
+        break;
+
+        // AcCancelMerge
+      case ARTNET_ACCANCELMERGE:
+        break;
+        
+        // AcLedNormal
+      case ARTNET_ACLEDNORMAL:
+        artnetSetLedsNormal(st);
+        break;
+        // AcLedMute
+      case ARTNET_ACLEDMUTE:
+        artnetSetLedssMute(st);
+        break;
+        // AcLedLocate
+      case ARTNET_ACLEDLOCATE:
+        artnetSetLedsLocate(st);
+        break;
+
+        // AcResetRx Flags
+      case ARTNET_ACRESETRX:
+        break;
+        
+        // Merge ---- we do not support merging !
+        // AcMergeLtp0
+      case ARTNET_ACMERGELTP0:
+        //grp->outputStatus[0] |= ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeLtp1
+      case ARTNET_ACMERGELTP1:
+        //grp->outputStatus[1] |= ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeLtp2
+      case ARTNET_ACMERGELTP2:
+        //grp->outputStatus[2] |= ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeLtp3
+      case ARTNET_ACMERGELTP3:
+        //grp->outputStatus[3] |= ARTNET_OUTPUT_LTP;
+        break;
+
+        // AcMergeHtp0
+      case ARTNET_ACMERGEHTP0: 
+        //grp->outputStatus[0] &= ~ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeHtp1
+      case ARTNET_ACMERGEHTP1: 
+        //grp->outputStatus[1] &= ~ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeHtp2
+      case ARTNET_ACMERGEHTP2: 
+        //grp->outputStatus[2] &= ~ARTNET_OUTPUT_LTP;
+        break;
+        // AcMergeHtp3
+      case ARTNET_ACMERGEHTP3: 
+        //grp->outputStatus[3] &= ~ARTNET_OUTPUT_LTP;
+        break;
+
+      // Output
+
+        // AcArtnetSel0
+      case ARTNET_ACARTNETSEL0:
+        grp->outputStatus[0] = 0;
+        break;
+        // AcArtnetSel1
+      case ARTNET_ACARTNETSEL1:
+        grp->outputStatus[1] = 0;
+        break;
+        // AcArtnetSel2
+      case ARTNET_ACARTNETSEL2:
+        grp->outputStatus[2] = 0;
+        break;
+        // AcArtnetSel3
+      case ARTNET_ACARTNETSEL3:
+        grp->outputStatus[3] = 0;
+        break;
+
+        // AcAcnSel0
+      case ARTNET_ACACNSEL0:
+        grp->outputStatus[0] |= ARTNET_OUTPUT_SACN;
+        break;
+        // AcAcnSel1
+      case ARTNET_ACACNSEL1:
+        grp->outputStatus[1] |= ARTNET_OUTPUT_SACN;
+        break;
+        // AcAcnSel2
+      case ARTNET_ACACNSEL2:
+        grp->outputStatus[2] |= ARTNET_OUTPUT_SACN;
+        break;
+        // AcAcnSel3
+      case ARTNET_ACACNSEL3:
+        grp->outputStatus[3] |= ARTNET_OUTPUT_SACN;
+        break;
+        
+        // Clear outputs
+        // AcClearOp0
+      case ARTNET_ACCLEAROP0:
+        artnetClearDmxOutput(st, grp, 0);
+        break;
+        // AcClearOp1
+      case ARTNET_ACCLEAROP1:
+        artnetClearDmxOutput(st, grp, 1);
+        break;
+        // AcClearOp2
+      case ARTNET_ACCLEAROP2:
+        artnetClearDmxOutput(st, grp, 2);
+        break;
+        // AcClearOp3
+      case ARTNET_ACCLEAROP3:
+        artnetClearDmxOutput(st, grp, 3);
+        break;
+    };
+
+    // Re-routed ports start over, the old owner
+    // keeps sending its universe elsewhere
+    for(i = 0; i < grp->ports; i++)
+      if(artnetPortAddress(grp, i) != before[i])
+        artnetPortRelease(st, ARTNET_PORT_INDEX(group, i));
+
+    // Universes or protocol may have changed
+    st->sacnGroupsDirty = true;
+  }
+
+  artnetPublish(st);
+  
+  artnetSendPollReply(st);
+}
+
+/**
+ * Is the port soft patched ?
+ *
+ * uint8_t port - the port index, see ARTNET_PORT_INDEX
+ */
+static bool artnetIsPatched(artnet_status_t *st, uint8_t port)
+{
+  return st->patch[st->patchActive].length[port] != 0;
+}
+
+/**
+ * Pixel map a received universe
+ *
+ * Encodes the pixels it has of each strip into the strip
+ * buffer, one table lookup per colour byte, SPI3 bytes
+ * expand to 3 buffer bytes and PWM nibbles to 4.
+ *
+ * uint16_t portAddress - Port-Address of the data
+ * uint16_t len         - how many slots
+ * uint8_t *data        - the slots
+ * bool sacn            - did it come from sACN ?
+ */
+static void artnetPixelDmx(artnet_status_t *st, uint16_t portAddress, uint16_t len, uint8_t *data, bool sacn)
+{
+  uint8_t i;
+
+  for(i = 0; i < st->pixelActive; i++)
+  {
+    artnet_pixel_strip_t *strip = &st->cfg->pixel[i];
+    artnet_pixel_map_t *map = &st->pixelMap[i];
+    const uint8_t *order = gPixelOrder[strip->order];
+    uint16_t pixel, count, avail, k;
+    uint8_t *src, *out;
+
+    if(strip->sacn != sacn || portAddress < strip->portAddress || portAddress > map->lastAddress)
+      continue;
+
+    // Where this universe starts in the strip
+    if(portAddress == strip->portAddress)
+    {
+      pixel = 0;
+      count = map->first;
+      src = data + strip->start;
+      avail = (len > strip->start) ? len - strip->start : 0;
+    }
+    else
+    {
+      pixel = map->first + (portAddress - strip->portAddress - 1) * map->per;
+      count = map->per;
+      src = data;
+      avail = len;
+    }
+
+    if(pixel + count > strip->pixels)
+      count = strip->pixels - pixel;
+    if(count > avail / map->channels)
+      count = avail / map->channels;
+
+    out = strip->buf + map->offset + (uint32_t)pixel * map->stride;
+
+    switch(strip->wire)
+    {
+      case ARTNET_PIXEL_SPI3:
+        for(k = 0; k < count; k++, src += map->channels)
+        {
+          uint8_t c;
+
+          for(c = 0; c < map->channels; c++)
+          {
+            uint32_t v = gPixelSpi3[src[order[c]]];
+
+            *out++ = v >> 16;
+            *out++ = v >> 8;
+            *out++ = v;
+          }
+        }
+        break;
+
+      case ARTNET_PIXEL_PWM:
+        for(k = 0; k < count; k++, src += map->channels)
+        {
+          uint8_t c;
+
+          for(c = 0; c < map->channels; c++)
+          {
+            memcpy(out, &map->pwm[src[order[c]] >> 4], 4);
+            memcpy(out + 4, &map->pwm[src[order[c]] & 0x0f], 4);
+            out += 8;
+          }
+        }
+        break;
+
+      case ARTNET_PIXEL_APA102:
+        // The brightness byte is set by artnetPixelApply()
+        for(k = 0; k < count; k++, src += map->channels)
+        {
+          out[1] = src[order[0]];
+          out[2] = src[order[1]];
+          out[3] = src[order[2]];
+          out += 4;
+        }
+        break;
+    }
+
+    if(portAddress == map->lastAddress && strip->cb != NULL)
+      strip->cb(i, strip->buf, artnetPixelBufferSize(strip));
+  }
+}
+
+#if ARTNET_USE_CAPTURE
+/**
+ * Records a received packet in the capture ring
+ *
+ * One copy of up to ARTNET_CAPTURE_SNAPLEN bytes.
+ *
+ * uint16_t len - UDP payload length
+ */
+static void artnetCapture(artnet_status_t *st, ustack_iface_t *iface, uint16_t len, systime_t rx)
+{
+  artnet_capture_t *cap;
+  uint16_t flen = len + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t);
+
+  if(st->captureFrozen)
+    return;
+
+  cap = &st->capture[st->captureHead];
+  cap->time = rx;
+  cap->len = flen;
+  memcpy(cap->data, iface->buffer, (flen < ARTNET_CAPTURE_SNAPLEN) ? flen : ARTNET_CAPTURE_SNAPLEN);
+
+  st->captureHead = (st->captureHead + 1) % ARTNET_CAPTURE_ENTRIES;
+  if(st->captureCount < ARTNET_CAPTURE_ENTRIES)
+    st->captureCount++;
+
+  // Triggered, keep what follows then freeze
+  if(st->captureReason != 0)
+  {
+    if(st->capturePost == 0)
+      st->captureFrozen = true;
+    else
+      st->capturePost--;
+  }
+}
+
+/**
+ * Fires a capture trigger, if armed
+ *
+ * uint8_t reason - artnet_capture_trig_en
+ */
+static void artnetCaptureFire(artnet_status_t *st, uint8_t reason)
+{
+  if(!(st->captureTriggers & reason) || st->captureReason != 0)
+    return;
+
+  st->capturePost = ARTNET_CAPTURE_POST;
+  st->captureReason = reason;
+}
+
+/**
+ * Checks a port sequence for gaps
+ *
+ * uint8_t port - the port index, see ARTNET_PORT_INDEX
+ * uint8_t seq  - received sequence
+ * bool sacn    - sACN wraps through 0, Art-Net skips it
+ */
+static void artnetCaptureSeq(artnet_status_t *st, uint8_t port, uint8_t seq, bool sacn)
+{
+  uint8_t last = st->captureSeq[port];
+  uint8_t expected = last + 1;
+
+  if(!sacn && expected == 0)
+    expected = 1;
+
+  // Art-Net 0 is sequence disabled
+  if((sacn || (seq != 0 && last != 0)) && seq != expected)
+    artnetCaptureFire(st, ARTNET_CAPTURE_TRIG_SEQ);
+
+  st->captureSeq[port] = seq;
+}
+#endif
+
+/**
+ * Stream stats entry of a received universe
+ *
+ * Takes a free entry for a new one, else the one silent
+ * for the longest time if that is over ARTNET_STATS_STALE_MS,
+ * so a busy network doesn't churn the ones being watched.
+ *
+ * uint16_t universe - Art-Net Port-Address or sACN universe
+ * bool sacn         - which of them
+ *
+ * returns the entry, NULL if the table is full
+ */
+static artnet_stream_stats_t *artnetStatsFind(artnet_status_t *st, uint16_t universe, bool sacn, systime_t now)
+{
+  artnet_stream_stats_t *stats = NULL, *old = NULL;
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_STATS_STREAMS; i++)
+  {
+    artnet_stream_stats_t *s = &st->stats[i];
+
+    if(!s->started)
+    {
+      if(stats == NULL)
+        stats = s;
+      continue;
+    }
+
+    if(s->universe == universe && s->sacn == sacn)
+      return s;
+
+    if(old == NULL || chTimeDiffX(s->last, now) > chTimeDiffX(old->last, now))
+      old = s;
+  }
+
+  if(stats == NULL)
+  {
+    if(old == NULL || chTimeDiffX(old->last, now) < TIME_MS2I(ARTNET_STATS_STALE_MS))
+      return NULL;
+
+    stats = old;
+  }
+
+  memset(stats, 0, sizeof(artnet_stream_stats_t));
+  stats->sacn = sacn;
+  stats->universe = universe;
+
+  return stats;
+}
+
+/**
+ * Updates the stream quality of a received universe
+ *
+ * Constant time, the sequence gap gives the frames lost,
+ * within half the sequence range, else it's a late one.
+ *
+ * uint16_t universe - Art-Net Port-Address or sACN universe
+ * uint8_t seq       - received sequence
+ * bool sacn         - sACN wraps through 0, Art-Net skips it
+ */
+static void artnetStatsUpdate(artnet_status_t *st, uint16_t universe, uint8_t seq, bool sacn, systime_t now)
+{
+  artnet_stream_stats_t *stats = artnetStatsFind(st, universe, sacn, now);
+  uint32_t dt, dev;
+  uint16_t gap;
+
+  if(stats == NULL)
+    return;
+
+  stats->frames++;
+
+  // First one, nothing to compare with
+  if(!stats->started)
+  {
+    stats->started = true;
+    stats->seq = seq;
+    stats->last = now;
+    return;
+  }
+
+  dt = TIME_I2US(chTimeDiffX(stats->last, now));
+  stats->last = now;
+
+  stats->bins[dt / ARTNET_STATS_BIN_US < ARTNET_STATS_BINS ?
+              dt / ARTNET_STATS_BIN_US : ARTNET_STATS_BINS - 1]++;
+
+  if(stats->avgUs == 0)
+    stats->avgUs = dt;
+  else
+    stats->avgUs = stats->avgUs - (stats->avgUs >> 3) + (dt >> 3);
+
+  dev = dt > stats->avgUs ? dt - stats->avgUs : stats->avgUs - dt;
+  stats->jitterUs = stats->jitterUs - (stats->jitterUs >> 4) + (dev >> 4);
+
+  // Art-Net 0 is sequence disabled
+  if(!sacn && (seq == 0 || stats->seq == 0))
+  {
+    stats->seq = seq;
+    return;
+  }
+
+  if(sacn)
+    gap = (uint8_t)(seq - stats->seq);
+  else
+    gap = (seq + 255 - stats->seq) % 255;
+
+  if(gap == 0 || gap > (sacn ? 128 : 127))
+  {
+    stats->reordered++;
+    return;
+  }
+
+  stats->lost += gap - 1;
+  stats->seq = seq;
+}
+
+/**
+ * ArtDmx source entry of a controller and universe
+ *
+ * Takes a free entry for a new one, or the one not
+ * heard of for the longest time, its ports are free.
+ *
+ * returns the entry index
+ */
+static uint8_t artnetSourceFind(artnet_status_t *st, uint32_t ip, uint16_t universe, systime_t now)
+{
+  uint8_t i, idx = 0xff, old = 0;
+
+  for(i = 0; i < ARTNET_SOURCES; i++)
+  {
+    artnet_source_t *src = &st->sources[i];
+
+    if(!src->valid)
+    {
+      if(idx == 0xff)
+        idx = i;
+      continue;
+    }
+
+    if(src->ip == ip && src->universe == universe)
+      return i;
+
+    if(chTimeDiffX(src->lastSeen, now) > chTimeDiffX(st->sources[old].lastSeen, now) ||
+       !st->sources[old].valid)
+      old = i;
+  }
+
+  if(idx == 0xff)
+  {
+    idx = old;
+
+    for(i = 0; i < ARTNET_GROUPS * ARTNET_MAX_PORTS; i++)
+      if(st->portOwner[i] == idx)
+        st->portOwner[i] = 0xff;
+  }
+
+  memset(&st->sources[idx], 0, sizeof(artnet_source_t));
+  st->sources[idx].valid = true;
+  st->sources[idx].ip = ip;
+  st->sources[idx].universe = universe;
+  st->sources[idx].firstSeen = now;
+  st->sources[idx].rateStart = now;
+
+  return idx;
+}
+
+/**
+ * Counts an ArtDmx of a source
+ *
+ * Sequence 0 means the source doesn't use it, else
+ * it goes 1 to 255 and back to 1.
+ */
+static void artnetSourceCount(artnet_source_t *src, uint8_t seq, systime_t now)
+{
+  sysinterval_t elapsed = chTimeDiffX(src->rateStart, now);
+
+  if(elapsed >= TIME_MS2I(1000))
+  {
+    src->rate = (src->rateCount * 1000UL) / TIME_I2MS(elapsed);
+    src->rateCount = 0;
+    src->rateStart = now;
+  }
+
+  if(seq != 0 && src->seq != 0 && seq != (src->seq == 255 ? 1 : src->seq + 1))
+    src->seqGaps++;
+
+  src->seq = seq;
+  src->packets++;
+  src->rateCount++;
+  src->lastSeen = now;
+}
+
+/**
+ * Does a source get the port ?
+ *
+ * It does if it owns it, or if the owner was silent
+ * for the port timeout, then it takes over. An owner
+ * sending a universe the port no longer outputs is
+ * gone as well.
+ *
+ * uint8_t port - the port index, see ARTNET_PORT_INDEX
+ * uint8_t idx  - the source entry
+ */
+static bool artnetSourceOwns(artnet_status_t *st, uint8_t port, uint8_t idx, systime_t now)
+{
+  artnet_group_t *grp = &st->cfg->groups[port / ARTNET_MAX_PORTS];
+  uint8_t owner = st->portOwner[port];
+  uint16_t timeout = st->cfg->ownerTimeoutMs[port];
+
+  if(owner == idx)
+    return true;
+
+  if(owner != 0xff)
+  {
+    if(timeout == 0)
+      timeout = ARTNET_OWNER_TIMEOUT_MS;
+
+    if(st->sources[owner].universe == artnetPortAddress(grp, port % ARTNET_MAX_PORTS) &&
+       chTimeDiffX(st->sources[owner].lastSeen, now) < TIME_MS2I(timeout))
+    {
+      st->sources[idx].rejected++;
+      return false;
+    }
+
+    st->sources[owner].owns &= ~(1UL << port);
+
+#if ARTNET_USE_CAPTURE
+    artnetCaptureFire(st, ARTNET_CAPTURE_TRIG_SOURCE);
+#endif
+  }
+
+  st->portOwner[port] = idx;
+  st->sources[idx].owns |= (1UL << port);
+
+  return true;
+}
+
+/**
+ * Ownership timeout of a patched universe
+ *
+ * The longest of the ports it is patched to, so no port
+ * fails over sooner than its config asks.
+ *
+ * uint16_t portAddress - the universe
+ *
+ * returns the timeout in ms
+ */
+static uint16_t artnetPatchTimeout(artnet_status_t *st, uint16_t portAddress)
+{
+  artnet_patch_table_t *tbl = &st->patch[st->patchActive];
+  uint16_t timeout = 0;
+  uint8_t i;
+
+  for(i = 0; i < tbl->spanCount; i++)
+  {
+    artnet_patch_span_t *span = &tbl->span[i];
+    uint16_t ms = st->cfg->ownerTimeoutMs[span->port];
+
+    if(span->portAddress < portAddress) continue;
+    if(span->portAddress > portAddress) break;
+
+    if(ms == 0)
+      ms = ARTNET_OWNER_TIMEOUT_MS;
+    if(ms > timeout)
+      timeout = ms;
+  }
+
+  return (timeout != 0) ? timeout : ARTNET_OWNER_TIMEOUT_MS;
+}
+
+/**
+ * Does a source get its universe for the soft patch ?
+ *
+ * One source per universe, until it is silent for the
+ * longest timeout of the ports the universe is patched
+ * to, then the next one takes over.
+ *
+ * uint8_t idx - the source entry
+ */
+static bool artnetSourceHolds(artnet_status_t *st, uint8_t idx, systime_t now)
+{
+  artnet_source_t *src = &st->sources[idx];
+  uint16_t timeout = 0;
+  uint8_t i;
+
+  if(src->holds)
+    return true;
+
+  for(i = 0; i < ARTNET_SOURCES; i++)
+  {
+    artnet_source_t *other = &st->sources[i];
+
+    if(i == idx || !other->valid || !other->holds || other->universe != src->universe)
+      continue;
+
+    // Only looked up when there is someone to take over from
+    if(timeout == 0)
+      timeout = artnetPatchTimeout(st, src->universe);
+
+    if(chTimeDiffX(other->lastSeen, now) < TIME_MS2I(timeout))
+    {
+      src->rejected++;
+      return false;
+    }
+
+    other->holds = false;
+
+#if ARTNET_USE_CAPTURE
+    artnetCaptureFire(st, ARTNET_CAPTURE_TRIG_SOURCE);
+#endif
+  }
+
+  src->holds = true;
+
+  return true;
+}
+
+/**
+ * Soft patch a received universe
+ *
+ * Copies its spans into the patched outputs, then
+ * outputs each port it touched. Ports with sACN
+ * selected take it from sACN only, others from Art-Net.
+ *
+ * Art-Net sources hold the universe, not the ports, as
+ * a patched port may take several. Each port's sequence
+ * checks follow its lowest universe.
+ *
+ * uint16_t portAddress - Port-Address of the data
+ * uint16_t len         - how many slots
+ * uint8_t *data        - the slots
+ * bool sacn            - did it come from sACN ?
+ * uint8_t seq          - received sequence
+ * uint8_t *idx         - ArtDmx source entry, 0xff if not looked up yet, NULL for sACN
+ */
+static void artnetPatchDmx(artnet_status_t *st, uint16_t portAddress, uint16_t len, uint8_t *data, bool sacn,
+                           uint8_t seq, uint8_t *idx, systime_t now)
+{
+  artnet_patch_table_t *tbl = &st->patch[st->patchActive];
+  uint32_t touched = 0;   // One bit per port, ARTNET_GROUPS up to 8
+  bool held = false;
+  uint8_t i;
+
+  for(i = 0; i < tbl->spanCount; i++)
+  {
+    artnet_patch_span_t *span = &tbl->span[i];
+    artnet_group_t *grp = &st->cfg->groups[span->port / ARTNET_MAX_PORTS];
+
+    // Sorted, our run of spans is contiguous
+    if(span->portAddress < portAddress) continue;
+    if(span->portAddress > portAddress) break;
+
+    if(span->src >= len) continue;
+    if(((grp->outputStatus[span->port % ARTNET_MAX_PORTS] & ARTNET_OUTPUT_SACN) != 0) != sacn) continue;
+
+    // Once, before anything is copied
+    if(idx != NULL && !held)
+    {
+      if(*idx == 0xff)
+      {
+        ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+        *idx = artnetSourceFind(st, ipv4->srcIp, portAddress, now);
+        artnetSourceCount(&st->sources[*idx], seq, now);
+      }
+
+      if(!artnetSourceHolds(st, *idx, now))
+        return;
+
+      held = true;
+    }
+
+#if ARTNET_USE_CAPTURE
+    if(!(touched & (1UL << span->port)) && tbl->primary[span->port] == portAddress)
+      artnetCaptureSeq(st, span->port, seq, sacn);
+#endif
+
+    uint16_t n = len - span->src;
+    if(n > span->len) n = span->len;
+
+    memcpy(&st->patchOut[span->port][span->dst], &data[span->src], n);
+    touched |= (1UL << span->port);
+  }
+
+  for(i = 0; touched != 0; i++, touched >>= 1)
+  {
+    if(touched & 1)
+      artnetOutput(st, i, tbl->length[i], st->patchOut[i]);
+  }
+}
+
+/**
+ * ArtDmx
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | Application specific.
+ *                  | Unicast Transmit      | Yes
+ *                  | Directed Broadcast    | No
+ * --------------------------------------------------------------------------------------
+ * Node             | Receive               | Application specific
+ *                  | Unicast Transmit      | Yes
+ *                  | Broadcast             | No
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | Application specific.
+ *                  | Unicast Transmit      | Yes
+ *                  | Broadcast             | No
+ * --------------------------------------------------------------------------------------
+ *
+ * ArtDmx is the data packet used to transfer DMX512 data. The format is identical for 
+ * Node to Controller, Node to Node and Controller to Node.
+ * The Data is output through the DMX O/P port corresponding to the Universe setting. In 
+ * the absence of received ArtDmx packets, each DMX O/P port re-transmits the same 
+ * frame continuously.
+ *
+ * The first complete DMX frame received at each input port is placed in an ArtDmx packet 
+ * as above and transmitted as an ArtDmx packet containing the relevant Universe parameter.
+ * Each subsequent DMX frame containing new data (different length or different contents) 
+ * is also transmitted as an ArtDmx packet.
+ *
+ * Nodes do not transmit ArtDmx for DMX 512 inputs that have not received data since power on.
+ * However, an input that is active but not changing, will re-transmit the last valid ArtDmx 
+ * packet at approximately 4-second intervals.
+ *
+ * (Note. In order to converge the needs of Art-Net and sACN it is recommended that Art-Net 
+ * devices actually use a re-transmit time of 800mS to 1000mS).
+ *
+ * A DMX input that fails will not continue to transmit ArtDmx data.
+ *
+ * Unicast Subscription:
+ * ---------------------
+ *
+ * ArtDmx packets must be unicast to subscribers of the specific universe contained in
+ * the ArtDmx packet. 
+ * The transmitting device must regularly ArtPoll the network to detect any change in 
+ * devices which are subscribed. Nodes that are subscribed will list the subscription 
+ * universe in the ArtPollReply. 
+ * Subscribed means any universes listed in either the Swin orSwout array.
+ * If there are no subscribers to a universe that the transmitter wishes to send, then the 
+ * ArtDmx must not be broadcast.
+ * If the number of universe subscribers exceeds 40 for a given universe, the transmitting 
+ * device may broadcast.
+ *
+ * Refresh Rate:
+ * -------------
+ * The ArtDmx packet is intended to transfer DMX512 data. For this reason, the ArtDmx 
+ * packet for a specific IP Address should not be transmitted at a repeat rate faster 
+ * than the maximum repeat rate of a DMX packet containing 512 data slots.
+ *
+ * Synchronous Data:
+ * -----------------
+ * In video or media-wall applications, the ability to synchronise multiple universes of 
+ * ArtDmx is beneficial. This can be achieved with the ArtSync packet.
+ *
+ * Data Merging:
+ * -------------
+ * The Art-Net protocol allows multiple nodes or controllers to transmit ArtDmx data to the 
+ * same universe.
+ * A node can detect this situation by comparing the IP addresses of received ArtDmx 
+ * packets. If ArtDmx packets addressed to the same Universe are received from different IP
+ * addresses, a potential conflict exists.
+ *
+ * The Node can legitimately handle this situation using one of two methods:
+ *   - Consider this to be an error condition and await user intervention.
+ *   - Automatically merge the data.
+ *
+ * Nodes should document the approach that is implemented in the product user guide.
+ * The Merge option is preferred as it provides a higher level of functionality.
+ * Merge is implemented in either LTP or HTP mode as specified by the ArtAddress packet.
+ *
+ * Merge mode is implemented as follows:
+ *
+ *   - If ArtDmx is received from differing IP addresses, the data is merged to the DMX 
+ *     output. In this situation, ArtPollReply-GoodOutput-Bit3 is set. 
+ *     If Art-Poll-TalkToMe Bit 1 is set, an ArtPollReply should be transmitted when merging 
+ *     commences.
+ *
+ * Exit from Merge mode is handled as follows:
+ *
+ * If ArtAddress AcCancelMerge is received, the Next ArtDmx message received ends Merge mode. 
+ * The Node then discards any ArtDmx packets received from an IP address that does not match 
+ * the IP address of the ArtDmx packet that terminated Merge mode.
+ * If either (but not both) sources of ArtDmx stop, the failed source is held in the 
+ * merge buffer for 10 seconds. If, during the 10 second timeout, the failed source 
+ * returns, Merge mode continues. If the failed source does not recover, at the end 
+ * of the timeout period, the Node exits Merge mode.
+ * If both sources of ArtDmx fail, the output holds the last merge result.
+ * Merging is limited to two sources, any additional sources will be ignored by the Node.
+ * The Merge implementation allows for the following two key modes of operation.
+ *
+ *   - Combined Control: Two Controllers (Consoles) can operate on a network and 
+ *     merge data to multiple Nodes.
+ *   - Backup: One Controller (Console) can monitor the network for a failure of the 
+ *     primary Controller. If a failure occurs, it can use the ArtAddress AcCancelMerge 
+ *     command to take instant control of the network. 
+ *
+ * When a node provides multiple DMX512 inputs, it is the responsibility of the Node to 
+ * handle merging of data. This is because the Node will have only one IP address. If this 
+ * were not handled at the Node, ArtDmx packets with identical IP addresses and identical 
+ * universe numbers, but conflicting level data would be transmitted to the network.
+ * 
+ * uint16_t len - the packet length
+ */
+static void artnetHandleDmx(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len)
+{
+  uint8_t i = 0, j = 0, idx = 0xff;
+  uint16_t universe = ((artnet->dmx.net & 0x7f) << 8) | artnet->dmx.sub_uni;
+  systime_t curr = chVTGetSystemTimeX();
+
+  if(len < sizeof(struct artnet_dmx_t) ||
+     sizeof(struct artnet_dmx_t) + ntohs(artnet->dmx.length) > len)
+    return;
+
+  // Whoever it is for, and whoever owns it
+  artnetStatsUpdate(st, universe, artnet->dmx.seq, false, curr);
+
+  // What port are we working on ?
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      // Is it for us ?
+      if(!artnetIsOutputPort(grp, j, artnet->dmx.net, artnet->dmx.sub_uni))
+        continue;
+
+      // Selected for sACN, that one feeds it
+      if(grp->outputStatus[j] & ARTNET_OUTPUT_SACN)
+        continue;
+
+      if(artnetIsPatched(st, ARTNET_PORT_INDEX(i, j)))
+        continue;
+
+      // From who is this ? counted once, for the first port
+      if(idx == 0xff)
+      {
+        ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+        idx = artnetSourceFind(st, ipv4->srcIp, universe, curr);
+        artnetSourceCount(&st->sources[idx], artnet->dmx.seq, curr);
+      }
+
+      if(!artnetSourceOwns(st, ARTNET_PORT_INDEX(i, j), idx, curr))
+        continue;
+
+#if ARTNET_USE_CAPTURE
+      artnetCaptureSeq(st, ARTNET_PORT_INDEX(i, j), artnet->dmx.seq, false);
+#endif
+
+      artnetOutput(st, ARTNET_PORT_INDEX(i, j), ntohs(artnet->dmx.length), artnet->dmx.data);
+    }
+  }
+  artnetPatchDmx(st, universe, ntohs(artnet->dmx.length), artnet->dmx.data, false, artnet->dmx.seq, &idx, curr);
+  artnetPixelDmx(st, universe, ntohs(artnet->dmx.length), artnet->dmx.data, false);
+}
+
+/**
+ * ArtNzs
+ *
+ * DMX512 with a non zero start code, text, SIP or
+ * manufacturer frames. Goes to the same ports as ArtDmx
+ * for its Port-Address, to the group start code callback.
+ * Ports fed by sACN or the soft patch don't take it, and
+ * only from the source owning the port.
+ */
+static void artnetHandleNzs(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len)
+{
+  uint8_t i, j, idx = 0xff;
+  uint16_t slots = ntohs(artnet->nzs.length);
+  uint16_t universe = ((artnet->nzs.net & 0x7f) << 8) | artnet->nzs.sub_uni;
+  systime_t curr = chVTGetSystemTimeX();
+
+  if(len < sizeof(struct artnet_nzs_t) || slots < 1 || slots > ARTNET_DMX_LENGTH ||
+     sizeof(struct artnet_nzs_t) + slots > len)
+    return;
+
+  // Not for DMX nor RDM
+  if(artnet->nzs.startCode == 0 || artnet->nzs.startCode == RDM_START_CODE)
+    return;
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      if(!artnetIsOutputPort(grp, j, artnet->nzs.net, artnet->nzs.sub_uni))
+        continue;
+
+      if((grp->outputStatus[j] & ARTNET_OUTPUT_SACN) || artnetIsPatched(st, ARTNET_PORT_INDEX(i, j)))
+        continue;
+
+      // Same owner as its ArtDmx, not counted as one
+      if(idx == 0xff)
+      {
+        ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+        idx = artnetSourceFind(st, ipv4->srcIp, universe, curr);
+      }
+
+      if(!artnetSourceOwns(st, ARTNET_PORT_INDEX(i, j), idx, curr))
+        continue;
+
+      artnetOutputNzs(st, ARTNET_PORT_INDEX(i, j), artnet->nzs.startCode, slots, artnet->nzs.data);
+    }
+  }
+}
+
+/**
+ * ArtFirmwareReply to the controller uploading
+ *
+ * uint8_t type - artnet_firmware_reply_en
+ */
+static void artnetFirmwareReply(artnet_status_t *st, uint8_t type)
+{
+  artnet_firmware_upload_t *fw = &st->firmware;
+  artnet_tx_t *tx = artnetTxAlloc(st);
+  artnet_packet_u *reply;
+
+  fw->lastReply = chVTGetSystemTimeX();
+
+  if(tx == NULL)
+    return;
+
+  reply = (artnet_packet_u*)tx->data;
+  memset(reply, 0, sizeof(struct artnet_firmware_reply_t));
+  memcpy(reply->firmwarereply.id, "Art-Net\0", 8);
+  reply->firmwarereply.opCode = ARTNET_OPCODE_FIRMWAREREPLY;
+  reply->firmwarereply.prot_ver_hi = ARTNET_VERSION;
+  reply->firmwarereply.type = type;
+
+  artnetTxQueue(st, tx, fw->mac, ntohl(fw->ip), sizeof(struct artnet_firmware_reply_t));
+}
+
+/**
+ * Ends the upload, telling the controller
+ */
+static void artnetFirmwareEnd(artnet_status_t *st, bool ok)
+{
+  artnet_firmware_upload_t *fw = &st->firmware;
+
+  if(!ok)
+    st->reportCode = ARTNET_RCFIRMWAREFAIL;
+
+  chSysLock();
+  fw->state = ok ? ARTNET_FIRMWARE_DONE : ARTNET_FIRMWARE_FAILED;
+  fw->count = 0;
+  chSysUnlock();
+
+  artnetFirmwareReply(st, ok ? ARTNET_FIRMWARE_ALLGOOD : ARTNET_FIRMWARE_FAIL);
+  dbgf(":: ARTNET :: Firmware upload %s, %d bytes\r\n", ok ? "done" : "failed", fw->written);
+}
+
+/**
+ * Writes a block to the bank and reads it back
+ *
+ * Sectors are erased as the image reaches them.
+ */
+static bool artnetFirmwareWrite(artnet_status_t *st, artnet_firmware_block_t *blk)
+{
+  artnet_firmware_upload_t *fw = &st->firmware;
+  artnet_flash_t *flash = st->cfg->firmwareBank;
+  uint8_t check[64];
+  uint16_t k;
+
+  while(fw->erased < fw->written + blk->len)
+  {
+    if(!flash->erase(flash->arg, fw->erased / flash->sectorSize))
+      return false;
+    fw->erased += flash->sectorSize;
+  }
+
+  if(!flash->write(flash->arg, fw->written, blk->data, blk->len))
+    return false;
+
+  for(k = 0; k < blk->len; k += sizeof(check))
+  {
+    uint16_t n = blk->len - k;
+
+    if(n > sizeof(check))
+      n = sizeof(check);
+
+    if(!flash->read(flash->arg, fw->written + k, check, n) || memcmp(check, &blk->data[k], n) != 0)
+      return false;
+  }
+
+  fw->written += blk->len;
+  return true;
+}
+
+/**
+ * Thread writing uploaded firmware to flash
+ *
+ * Apart from the housekeeping one, flash erases
+ * take long and would hold up outputs and RDM.
+ */
+static THD_FUNCTION(FirmwareThread, arg)
+{
+  artnet_status_t *st = (artnet_status_t*)arg;
+  artnet_firmware_upload_t *fw = &st->firmware;
+  chRegSetThreadName("ArtNetFirmware");
+
+  while (!chThdShouldTerminateX())
+  {
+    systime_t now = chVTGetSystemTimeX();
+
+    if(fw->state != ARTNET_FIRMWARE_RECEIVING)
+    {
+      chThdSleepMilliseconds(10);
+      continue;
+    }
+
+    // Paced replies
+    if(chTimeDiffX(fw->lastReply, now) < TIME_MS2I(ARTNET_FIRMWARE_PACE_MS))
+    {
+      chThdSleepMilliseconds(1);
+      continue;
+    }
+
+    // The image ran past its length, what is queued is no use
+    if(fw->failReq)
+    {
+      fw->failReq = false;
+      artnetFirmwareEnd(st, false);
+      continue;
+    }
+
+    if(fw->count > 0)
+    {
+      artnet_firmware_block_t *blk = &fw->queue[fw->head];
+
+      if(!artnetFirmwareWrite(st, blk))
+      {
+        artnetFirmwareEnd(st, false);
+        continue;
+      }
+
+      if(blk->last)
+      {
+        artnetFirmwareEnd(st, fw->written == fw->size &&
+                              (st->cfg->firmwarecb == NULL || st->cfg->firmwarecb(fw->ubea, fw->size)));
+        continue;
+      }
+
+      chSysLock();
+      fw->ackedBlock = blk->blockId;
+      fw->acked = true;
+      fw->head = (fw->head + 1) % ARTNET_FIRMWARE_QUEUE;
+      fw->count--;
+      chSysUnlock();
+
+      artnetFirmwareReply(st, ARTNET_FIRMWARE_BLOCKGOOD);
+      continue;
+    }
+
+    if(fw->reAck)
+    {
+      fw->reAck = false;
+      artnetFirmwareReply(st, ARTNET_FIRMWARE_BLOCKGOOD);
+      continue;
+    }
+
+    if(chTimeDiffX(fw->lastRx, now) >= TIME_MS2I(ARTNET_FIRMWARE_TIMEOUT_MS))
+    {
+      artnetFirmwareEnd(st, false);
+      continue;
+    }
+
+    chThdSleepMilliseconds(1);
+  }
+}
+
+/**
+ * ArtFirmwareMaster
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | Controller transmits to a specific node IP address.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Node             | Receive               | Reply with ArtFirmwareReply.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * One controller at a time, blocks in order. A block only
+ * goes to the firmware thread queue, the parser is back to
+ * DMX right away. A repeated block whose reply was lost is
+ * acknowledged again, anything out of order is ignored and
+ * left to the controller to resend. The last block may be
+ * padded past the image length, the padding is dropped, any
+ * other block running past it fails the upload.
+ *
+ * uint16_t len - the packet length
+ */
+static void artnetHandleFirmware(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len)
+{
+  artnet_firmware_upload_t *fw = &st->firmware;
+  ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+  uint8_t type = artnet->firmware.type;
+  uint16_t dlen;
+
+  if(st->cfg->firmwareBank == NULL || len < sizeof(struct artnet_firmware_t))
+    return;
+
+  dlen = len - sizeof(struct artnet_firmware_t);
+  if(dlen > ARTNET_FIRMWARE_BLOCK || (dlen & 1) || type > ARTNET_FIRMWARE_UBEA_LAST)
+    return;
+
+  if(type == ARTNET_FIRMWARE_FIRST || type == ARTNET_FIRMWARE_UBEA_FIRST)
+  {
+    uint32_t size = (((uint32_t)artnet->firmware.length[0] << 24) |
+                     ((uint32_t)artnet->firmware.length[1] << 16) |
+                     ((uint32_t)artnet->firmware.length[2] << 8) |
+                     artnet->firmware.length[3]) * 2;
+
+    if(fw->state == ARTNET_FIRMWARE_RECEIVING)
+    {
+      // Block 0 again, its reply was lost
+      if(fw->ip == ipv4->srcIp && fw->acked && fw->ackedBlock == 0 && artnet->firmware.blockId == 0)
+        fw->reAck = true;
+      return;
+    }
+
+    fw->ip = ipv4->srcIp;
+    memcpy(fw->mac, st->cfg->iface->buffer + 6, 6); // ethernet source
+
+    if(size == 0 || size > st->cfg->firmwareBank->sectorSize * st->cfg->firmwareBank->sectors ||
+       artnet->firmware.blockId != 0)
+    {
+      artnetFirmwareEnd(st, false);
+      return;
+    }
+
+    fw->ubea = (type == ARTNET_FIRMWARE_UBEA_FIRST);
+    fw->size = size;
+    fw->received = fw->written = fw->erased = 0;
+    fw->nextBlock = 0;
+    fw->acked = fw->reAck = fw->failReq = false;
+    fw->head = fw->count = 0;
+    fw->lastReply = chVTGetSystemTimeX() - TIME_MS2I(ARTNET_FIRMWARE_PACE_MS);
+
+    dbgf(":: ARTNET :: Firmware upload, %d bytes\r\n", size);
+
+    chSysLock();
+    fw->state = ARTNET_FIRMWARE_RECEIVING;
+    chSysUnlock();
+  }
+  else if(fw->state != ARTNET_FIRMWARE_RECEIVING || fw->ip != ipv4->srcIp || fw->failReq)
+    return;
+
+  if(artnet->firmware.blockId != fw->nextBlock)
+  {
+    if(fw->acked && artnet->firmware.blockId == fw->ackedBlock && fw->count == 0)
+      fw->reAck = true;
+    return;
+  }
+
+  // Stop and wait, the queue only fills if the flash is slow
+  if(fw->count >= ARTNET_FIRMWARE_QUEUE)
+    return;
+
+  bool last = (type == ARTNET_FIRMWARE_LAST || type == ARTNET_FIRMWARE_UBEA_LAST);
+
+  if(fw->received + dlen > fw->size)
+  {
+    if(!last)
+    {
+      fw->failReq = true;
+      return;
+    }
+
+    // Padded to a whole block
+    dlen = fw->size - fw->received;
+  }
+
+  artnet_firmware_block_t *blk = &fw->queue[(fw->head + fw->count) % ARTNET_FIRMWARE_QUEUE];
+
+  blk->blockId = artnet->firmware.blockId;
+  blk->last = last;
+  blk->len = dlen;
+  memcpy(blk->data, artnet->firmware.data, dlen);
+
+  fw->received += dlen;
+  fw->nextBlock++;
+  fw->lastRx = chVTGetSystemTimeX();
+
+  chSysLock();
+  fw->count++;
+  chSysUnlock();
+}
+
+/**
+ * ArtTimeCode
+ *
+ * Decoded and filtered of network jitter. The frame number
+ * gives when, after the last one, this frame should start,
+ * the arrival error corrects that by 1/8th. Jumps of more
+ * than two frames, or backwards, restart the filter.
+ *
+ * systime_t rx - when the packet was received
+ */
+static void artnetHandleTimeCode(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len, systime_t rx)
+{
+  static const uint32_t periodUs[4] = { 41667, 40000, 33367, 33333 };
+  static const uint8_t fps[4] = { 24, 25, 30, 30 };
+  artnet_tc_filter_t *flt = &st->tcFilter;
+  struct artnet_timecode_t *p = &artnet->timecode;
+  artnet_timecode_t tc;
+  uint32_t frame;
+
+  if(len < sizeof(struct artnet_timecode_t) || p->type > ARTNET_TC_SMPTE)
+    return;
+
+  if(p->frames >= fps[p->type] || p->seconds > 59 || p->minutes > 59 || p->hours > 23)
+    return;
+
+  if(st->cfg->timecodecb == NULL)
+    return;
+
+  tc.frames = p->frames;
+  tc.seconds = p->seconds;
+  tc.minutes = p->minutes;
+  tc.hours = p->hours;
+  tc.type = p->type;
+  tc.streamId = p->streamId;
+  tc.rxTime = rx;
+  tc.periodUs = periodUs[p->type];
+
+  frame = ((uint32_t)p->hours * 3600 + p->minutes * 60 + p->seconds) * fps[p->type] + p->frames;
+
+  // Drop frame skips frames 0 and 1 of every minute but each 10th
+  if(p->type == ARTNET_TC_DF)
+  {
+    uint32_t minutes = (uint32_t)p->hours * 60 + p->minutes;
+    frame -= 2 * (minutes - minutes / 10);
+  }
+
+  int32_t err = 0;
+
+  if(flt->locked && flt->type == p->type && frame > flt->baseFrame)
+  {
+    int64_t predicted = (int64_t)(frame - flt->baseFrame) * tc.periodUs;
+    int64_t actual = (int64_t)TIME_I2US(chTimeDiffX(flt->origin, rx)) - flt->baseUs;
+
+    if(actual - predicted > -2 * (int64_t)tc.periodUs && actual - predicted < 2 * (int64_t)tc.periodUs)
+    {
+      err = (int32_t)(actual - predicted);
+      predicted += err / 8;
+
+      // Microseconds, ticks would round every update
+      flt->baseUs += (uint32_t)predicted;
+      flt->baseFrame = frame;
+
+      // Whole seconds into origin, keeps the difference short
+      while(flt->baseUs >= 1000000)
+      {
+        flt->origin += TIME_MS2I(1000);
+        flt->baseUs -= 1000000;
+      }
+    }
+    else
+      flt->locked = false;
+  }
+  else if(flt->locked && flt->type == p->type && frame == flt->baseFrame)
+  {
+    // Repeated frame, nothing new to learn
+    err = (int32_t)((int64_t)TIME_I2US(chTimeDiffX(flt->origin, rx)) - flt->baseUs);
+  }
+  else
+    flt->locked = false;
+
+  if(!flt->locked)
+  {
+    flt->locked = true;
+    flt->type = p->type;
+    flt->origin = rx;
+    flt->baseUs = 0;
+    flt->baseFrame = frame;
+  }
+
+  tc.frameTime = flt->origin + TIME_US2I(flt->baseUs);
+  tc.errorUs = err;
+
+  st->cfg->timecodecb(&tc);
+}
+
+/**
+ * ArtTrigger
+ *
+ * Passed on when for every OEM or ours.
+ *
+ * systime_t rx - when the packet was received
+ */
+static void artnetHandleTrigger(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len, systime_t rx)
+{
+  struct artnet_trigger_t *p = &artnet->trigger;
+  artnet_trigger_t trig;
+
+  if(len < sizeof(struct artnet_trigger_t) || st->cfg->triggercb == NULL)
+    return;
+
+  trig.oem = (p->oemHi << 8) | p->oemLo;
+
+  if(trig.oem != 0xffff && trig.oem != ARTNET_OEM)
+    return;
+
+  trig.key = p->key;
+  trig.subKey = p->subKey;
+  trig.len = len - sizeof(struct artnet_trigger_t);
+  if(trig.len > ARTNET_DMX_LENGTH)
+    trig.len = ARTNET_DMX_LENGTH;
+  trig.data = p->data;
+  trig.rxTime = rx;
+
+  st->cfg->triggercb(&trig);
+}
+
+/**
+ * RDM checksum, start code included
+ *
+ * uint8_t *data - RDM packet without start code
+ * uint16_t len  - length up to the end of the parameter data
+ */
+static uint16_t artnetRdmChecksum(uint8_t *data, uint16_t len)
+{
+  uint16_t sum = RDM_START_CODE;
+
+  while(len--)
+    sum += *data++;
+
+  return sum;
+}
+
+/**
+ * Our own RDM UID, ESTA code plus the
+ * low bytes of the MAC address
+ *
+ * uint8_t *uid - where the 6 byte UID is stored
+ */
+static void artnetRdmUid(artnet_status_t *st, uint8_t *uid)
+{
+  uid[0] = (ESTA >> 8) & 0xff;
+  uid[1] = ESTA & 0xff;
+  memcpy(&uid[2], &st->cfg->iface->cfg->mac[2], 4);
+}
+
+/**
+ * Is the response to this PID static, so
+ * it can be answered from the cache ?
+ *
+ * uint8_t *argLen - where the request argument length is stored, may be NULL
+ */
+static bool artnetRdmIsStaticPid(uint16_t pid, uint8_t *argLen)
+{
+  uint8_t i;
+
+  for(i = 0; i < sizeof(gRdmStaticPids) / sizeof(gRdmStaticPids[0]); i++)
+  {
+    if(gRdmStaticPids[i].pid == pid)
+    {
+      if(argLen != NULL)
+        *argLen = gRdmStaticPids[i].argLen;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Looks up a cached response
+ *
+ * uint8_t *uid       - the responder UID
+ * uint16_t subDevice - the sub-device
+ * uint16_t pid       - the parameter id
+ * uint8_t *arg       - the request parameter data
+ * uint8_t argLen     - its length, must be what the PID takes
+ * uint8_t *pd        - where the parameter data is copied, may be NULL
+ * uint8_t *pdl       - where the parameter data length is stored
+ */
+static bool artnetRdmCacheGet(artnet_status_t *st, uint8_t *uid, uint16_t subDevice, uint16_t pid,
+                              uint8_t *arg, uint8_t argLen, uint8_t *pd, uint8_t *pdl)
+{
+  uint8_t i, need;
+  bool found = false;
+
+  if(!artnetRdmIsStaticPid(pid, &need) || argLen != need)
+    return false;
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_CACHE_ENTRIES; i++)
+  {
+    artnet_rdm_cache_t *entry = &st->rdmCache[i];
+
+    if(!entry->valid || entry->pid != pid || entry->subDevice != subDevice)
+      continue;
+
+    if(memcmp(entry->uid, uid, 6) != 0)
+      continue;
+
+    // The response starts with the argument it answers
+    if(argLen > 0 && (entry->pdl < argLen || memcmp(entry->pd, arg, argLen) != 0))
+      continue;
+
+    if(pd != NULL)
+      memcpy(pd, entry->pd, entry->pdl);
+    *pdl = entry->pdl;
+    found = true;
+    break;
+  }
+  chSysUnlock();
+
+  return found;
+}
+
+/**
+ * Stores a response of a static PID in the cache,
+ * replacing the entries round robin
+ */
+static void artnetRdmCachePut(artnet_status_t *st, uint8_t *uid, uint16_t subDevice, uint16_t pid, uint8_t *pd, uint8_t pdl)
+{
+  uint8_t dummy, argLen;
+
+  if(pdl > ARTNET_RDM_CACHE_PD || !artnetRdmIsStaticPid(pid, &argLen) || pdl < argLen)
+    return;
+
+  if(artnetRdmCacheGet(st, uid, subDevice, pid, pd, argLen, NULL, &dummy))
+    return;
+
+  chSysLock();
+  artnet_rdm_cache_t *entry = &st->rdmCache[st->rdmCacheNext];
+  st->rdmCacheNext = (st->rdmCacheNext + 1) % ARTNET_RDM_CACHE_ENTRIES;
+
+  memcpy(entry->uid, uid, 6);
+  entry->subDevice = subDevice;
+  entry->pid = pid;
+  entry->pdl = pdl;
+  memcpy(entry->pd, pd, pdl);
+  entry->valid = true;
+  chSysUnlock();
+}
+
+/**
+ * Drops the cached responses of a UID, or all
+ * of them if uid is NULL
+ *
+ * Some "static" PIDs depend on the personality,
+ * so any Set to a device flushes it.
+ */
+static void artnetRdmCacheFlush(artnet_status_t *st, uint8_t *uid)
+{
+  uint8_t i;
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_CACHE_ENTRIES; i++)
+    if(uid == NULL || memcmp(st->rdmCache[i].uid, uid, 6) == 0)
+      st->rdmCache[i].valid = false;
+  chSysUnlock();
+}
+
+/**
+ * Finds a UID in a port table of devices
+ *
+ * Returns the index or -1 if it's not there
+ */
+static int artnetRdmTodFind(artnet_rdm_tod_t *tod, uint8_t *uid)
+{
+  uint8_t i;
+
+  for(i = 0; i < tod->count; i++)
+    if(memcmp(tod->uid[i], uid, 6) == 0)
+      return i;
+
+  return -1;
+}
+
+/**
+ * Finds the port an RDM UID is attached to
+ *
+ * Looks it up in the tables of devices, if discovery
+ * hasn't found it yet the first RDM capable output
+ * port is used.
+ *
+ * uint8_t *uid  - the UID
+ * uint8_t *port - where the port index is stored
+ */
+static bool artnetRdmFindPort(artnet_status_t *st, uint8_t *uid, uint8_t *port)
+{
+  uint8_t i, j;
+
+  for(i = 0; i < ARTNET_GROUPS * ARTNET_MAX_PORTS; i++)
+  {
+    if(artnetRdmTodFind(&st->rdmTod[i], uid) >= 0)
+    {
+      *port = i;
+      return true;
+    }
+  }
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    if(grp->rdmcb == NULL)
+      continue;
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      if(grp->portType[j] & ARTNET_TYPE_OUTPUT)
+      {
+        *port = ARTNET_PORT_INDEX(i, j);
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Grabs a free RDM transaction
+ *
+ * The caller fills it in and hands it over
+ * with artnetRdmQueue(st).
+ */
+static artnet_rdm_trans_t *artnetRdmAlloc(artnet_status_t *st, uint8_t owner, uint8_t job)
+{
+  uint8_t i;
+  artnet_rdm_trans_t *trans = NULL;
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+  {
+    if(st->rdm[i].state == ARTNET_RDM_FREE)
+    {
+      trans = &st->rdm[i];
+      trans->state = ARTNET_RDM_RESERVED;
+      trans->owner = owner;
+      trans->job = job;
+      break;
+    }
+  }
+  chSysUnlock();
+
+  if(trans == NULL)
+    st->rdmDropped++;
+
+  return trans;
+}
+
+/**
+ * Queues a filled in transaction for the service
+ * thread to hand it to the port driver
+ */
+static void artnetRdmQueue(artnet_status_t *st, artnet_rdm_trans_t *trans)
+{
+  chSysLock();
+  trans->order = st->rdmOrder++;
+  trans->state = ARTNET_RDM_QUEUED;
+  chSysUnlock();
+}
+
+/**
+ * Builds an RDM request from us
+ *
+ * uint8_t *rdm       - where it's built, without start code
+ * uint8_t *dest      - destination UID
+ * uint8_t port       - port index
+ * uint16_t subDevice - sub-device
+ * uint8_t cc         - command class
+ * uint16_t pid       - parameter id
+ * uint8_t *pd        - parameter data
+ * uint8_t pdl        - parameter data length
+ *
+ * Returns the packet length, checksum included
+ */
+static uint16_t artnetRdmBuildRequest(artnet_status_t *st, uint8_t *rdm, uint8_t *dest, uint8_t port, uint16_t subDevice,
+                                      uint8_t cc, uint16_t pid, uint8_t *pd, uint8_t pdl)
+{
+  uint16_t len = RDM_OFFSET_PD + pdl;
+  uint16_t sum;
+
+  rdm[0] = RDM_SUB_START_CODE;
+  rdm[RDM_OFFSET_LENGTH] = len + 1;
+  memcpy(&rdm[RDM_OFFSET_DEST_UID], dest, 6);
+  artnetRdmUid(st, &rdm[RDM_OFFSET_SRC_UID]);
+  rdm[RDM_OFFSET_TN] = st->rdmTn++;
+  rdm[RDM_OFFSET_PORT] = (port % ARTNET_MAX_PORTS) + 1;
+  rdm[RDM_OFFSET_MSGCOUNT] = 0;
+  rdm[RDM_OFFSET_SUBDEVICE] = subDevice >> 8;
+  rdm[RDM_OFFSET_SUBDEVICE + 1] = subDevice & 0xff;
+  rdm[RDM_OFFSET_CC] = cc;
+  rdm[RDM_OFFSET_PID] = pid >> 8;
+  rdm[RDM_OFFSET_PID + 1] = pid & 0xff;
+  rdm[RDM_OFFSET_PDL] = pdl;
+
+  if(pdl > 0)
+    memcpy(&rdm[RDM_OFFSET_PD], pd, pdl);
+
+  sum = artnetRdmChecksum(rdm, len);
+  rdm[len++] = sum >> 8;
+  rdm[len++] = sum & 0xff;
+
+  return len;
+}
+
+/**
+ * Queues a reply built in a TX buffer back to
+ * whoever sent the packet being processed
+ *
+ * artnet_tx_t *tx - the reply
+ * uint16_t len    - its payload length
+ */
+static void artnetReplyToSender(artnet_status_t *st, artnet_tx_t *tx, uint16_t len)
+{
+  ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+  // Ethernet source
+  artnetTxQueue(st, tx, st->cfg->iface->buffer + 6, ntohl(ipv4->srcIp), len);
+}
+
+/**
+ * ArtTodData
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | Not allowed
+ *                  | Broadcast             | Not allowed
+ * --------------------------------------------------------------------------------------
+ * Node output      | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Output Gateway always Directed Broadcasts this packet.
+ * --------------------------------------------------------------------------------------
+ * Node input       | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | No Action.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ */
+static void artnetSendTodData(artnet_status_t *st, ustack_iface_t *iface)
+{
+  uint8_t k;
+  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+  uint8_t bcastMac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  const uint8_t max = (sizeof(artnet_packet_u) - sizeof(struct artnet_toddata_t)) / 6;
+
+  for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+  {
+    artnet_rdm_tod_t *tod = &st->rdmTod[k];
+    artnet_group_t *grp = &st->cfg->groups[k / ARTNET_MAX_PORTS];
+    uint8_t j = k % ARTNET_MAX_PORTS;
+    uint8_t sent = 0, block = 0, count;
+
+    if(!st->rdmDisc[k].todPending)
+      continue;
+
+    st->rdmDisc[k].todPending = false;
+
+    // Blocks of what fits in a packet, at least one even if empty
+    do
+    {
+      memcpy(artnet->toddata.id, "Art-Net\0", 8);
+      artnet->toddata.opCode = ARTNET_OPCODE_TODDATA;
+      artnet->toddata.prot_ver_hi = 0;
+      artnet->toddata.prot_ver_low = ARTNET_VERSION;
+      artnet->toddata.rdmver = 0x01;
+      artnet->toddata.port = j + 1;
+      memset(artnet->toddata.spare, 0, 6);
+      artnet->toddata.bindIndex = k / ARTNET_MAX_PORTS;
+      artnet->toddata.net = grp->net;
+      artnet->toddata.cmdResponse = ARTNET_TODFULL;
+      artnet->toddata.address = (grp->subnet << 4) | (grp->swout[j] & 0x0f);
+
+      chSysLock();
+      count = tod->count - sent;
+      if(count > max)
+        count = max;
+
+      artnet->toddata.uidTotalHi = 0;
+      artnet->toddata.uidTotalLo = tod->count;
+      memcpy(artnet->toddata.tod, tod->uid[sent], count * 6);
+      chSysUnlock();
+
+      artnet->toddata.blockCount = block++;
+      artnet->toddata.uidCount = count;
+
+      ustackUdpSend(iface,
+                    bcastMac,
+                    ustackGetDirectedBroadcast(st->cfg->iface->cfg->ip,
+                                               st->cfg->iface->cfg->netmask),
+                    st->cfg->port, st->cfg->port,
+                    sizeof(struct artnet_toddata_t) + count * 6);
+
+      sent += count;
+    } while(sent < tod->count);
+  }
+}
+
+/**
+ * Adds a device to a port table of devices,
+ * or marks it as seen if it's already there
+ */
+static void artnetRdmTodAdd(artnet_status_t *st, uint8_t port, uint8_t *uid)
+{
+  artnet_rdm_tod_t *tod = &st->rdmTod[port];
+  int idx = artnetRdmTodFind(tod, uid);
+
+  if(idx >= 0)
+  {
+    tod->seen[idx] = true;
+    return;
+  }
+
+  if(tod->count >= ARTNET_RDM_TOD_MAX)
+    return;
+
+  chSysLock();
+  memcpy(tod->uid[tod->count], uid, 6);
+  tod->seen[tod->count] = true;
+  tod->count++;
+  chSysUnlock();
+
+  st->rdmDisc[port].changed = true;
+}
+
+/**
+ * Drops from a port table of devices the ones
+ * that didn't answer in this discovery run
+ */
+static void artnetRdmTodPrune(artnet_status_t *st, uint8_t port)
+{
+  artnet_rdm_tod_t *tod = &st->rdmTod[port];
+  uint8_t i = 0;
+
+  while(i < tod->count)
+  {
+    if(tod->seen[i])
+    {
+      i++;
+      continue;
+    }
+
+    artnetRdmCacheFlush(st, tod->uid[i]);
+
+    chSysLock();
+    tod->count--;
+    memcpy(tod->uid[i], tod->uid[tod->count], 6);
+    tod->seen[i] = tod->seen[tod->count];
+    chSysUnlock();
+
+    st->rdmDisc[port].changed = true;
+  }
+}
+
+/**
+ * (Re)starts discovery on a port
+ *
+ * The run starts when the port has no discovery
+ * transaction on the wire. Known devices are kept
+ * and checked first, so the table is only updated
+ * with what came and went.
+ */
+static void artnetRdmDiscStart(artnet_status_t *st, uint8_t port)
+{
+  st->rdmDisc[port].restart = true;
+}
+
+/**
+ * Decodes a DISC_UNIQUE_BRANCH response
+ *
+ * uint8_t *data - the bytes received, preamble included
+ * uint8_t len   - how many
+ * uint8_t *uid  - where the UID is stored
+ *
+ * Returns false on a collision or a corrupt response
+ */
+static bool artnetRdmDiscDecode(uint8_t *data, uint8_t len, uint8_t *uid)
+{
+  uint8_t i = 0;
+  uint16_t sum = 0;
+
+  while(i < len && i < 7 && data[i] == 0xfe)
+    i++;
+
+  if(i >= len || data[i] != 0xaa)
+    return false;
+
+  data += i + 1;
+  len -= i + 1;
+
+  if(len < 16)
+    return false;
+
+  for(i = 0; i < 12; i++)
+    sum += data[i];
+
+  for(i = 0; i < 6; i++)
+    uid[i] = data[i * 2] & data[i * 2 + 1];
+
+  return sum == (((data[12] & data[13]) << 8) | (data[14] & data[15]));
+}
+
+/**
+ * Splits the UID block on the top of the
+ * discovery stack in two halves
+ */
+static void artnetRdmDiscSplit(artnet_rdm_disc_t *disc)
+{
+  uint64_t base = disc->stack[disc->depth - 1].base;
+  uint8_t bits = disc->stack[disc->depth - 1].bits;
+
+  disc->depth--;
+
+  if(bits == 0)
+    return;
+
+  bits--;
+  disc->stack[disc->depth].base = base + (1ULL << bits);
+  disc->stack[disc->depth++].bits = bits;
+  disc->stack[disc->depth].base = base;
+  disc->stack[disc->depth++].bits = bits;
+}
+
+/**
+ * Moves a port discovery forward with the
+ * result of the last step
+ */
+static void artnetRdmDiscResult(artnet_status_t *st, uint8_t port)
+{
+  artnet_rdm_disc_t *disc = &st->rdmDisc[port];
+  artnet_rdm_tod_t *tod = &st->rdmTod[port];
+  uint8_t uid[6];
+
+  switch(disc->state)
+  {
+    case ARTNET_DISC_UNMUTE:
+      // Broadcast, nobody answers
+      disc->index = 0;
+      disc->retries = 0;
+      disc->state = ARTNET_DISC_MUTE_KNOWN;
+      break;
+
+    case ARTNET_DISC_MUTE_KNOWN:
+      if(disc->resultLen > 0)
+      {
+        tod->seen[disc->index++] = true;
+        disc->retries = 0;
+      }
+      else if(++disc->retries >= ARTNET_RDM_DISC_RETRIES)
+      {
+        // Gone, pruned at the end
+        disc->index++;
+        disc->retries = 0;
+      }
+      break;
+
+    case ARTNET_DISC_BRANCH:
+      if(disc->resultLen == 0)
+      {
+        // Nobody left in this block
+        disc->depth--;
+        break;
+      }
+
+      if(artnetRdmDiscDecode(disc->resultData, disc->resultLen, uid))
+      {
+        uint64_t id = 0;
+        uint8_t i;
+
+        for(i = 0; i < 6; i++)
+          id = (id << 8) | uid[i];
+
+        uint64_t base = disc->stack[disc->depth - 1].base;
+        uint8_t bits = disc->stack[disc->depth - 1].bits;
+
+        if(id >= base && id - base < (1ULL << bits))
+        {
+          memcpy(disc->found, uid, 6);
+          disc->retries = 0;
+          disc->state = ARTNET_DISC_MUTE;
+          break;
+        }
+      }
+
+      // More than one answered
+      artnetRdmDiscSplit(disc);
+      break;
+
+    case ARTNET_DISC_MUTE:
+      if(disc->resultLen > 0)
+      {
+        // Muted, branch the same block again for the next one
+        artnetRdmTodAdd(st, port, disc->found);
+        disc->state = ARTNET_DISC_BRANCH;
+      }
+      else if(++disc->retries >= ARTNET_RDM_DISC_RETRIES)
+      {
+        // Won't mute, isolate it splitting the block
+        artnetRdmDiscSplit(disc);
+        disc->state = ARTNET_DISC_BRANCH;
+      }
+      break;
+  }
+
+  if(disc->state == ARTNET_DISC_MUTE_KNOWN && disc->index >= tod->count)
+  {
+    disc->stack[0].base = 0;
+    disc->stack[0].bits = 48;
+    disc->depth = 1;
+    disc->state = ARTNET_DISC_BRANCH;
+  }
+
+  if(disc->state == ARTNET_DISC_BRANCH && disc->depth == 0)
+    disc->state = ARTNET_DISC_END;
+}
+
+/**
+ * Issues the next discovery step of a port
+ */
+static void artnetRdmDiscIssue(artnet_status_t *st, uint8_t port)
+{
+  artnet_rdm_disc_t *disc = &st->rdmDisc[port];
+  artnet_rdm_tod_t *tod = &st->rdmTod[port];
+  artnet_rdm_trans_t *trans;
+  uint8_t all[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  uint8_t pd[12];
+  uint8_t i;
+
+  if(disc->state == ARTNET_DISC_END)
+  {
+    artnetRdmTodPrune(st, port);
+
+    if(disc->changed || disc->replyOnEnd)
+    {
+      disc->todPending = true;
+      artnetQueueSend(st, ARTNET_SEND_TODDATA);
+    }
+
+    disc->replyOnEnd = false;
+    disc->lastRun = chVTGetSystemTimeX();
+    disc->state = ARTNET_DISC_IDLE;
+    return;
+  }
+
+  trans = artnetRdmAlloc(st, ARTNET_RDM_OWNER_DISC, port);
+  if(trans == NULL)
+    return; // Try again next time
+
+  switch(disc->state)
+  {
+    case ARTNET_DISC_UNMUTE:
+      trans->len = artnetRdmBuildRequest(st, trans->data, all, port, 0, RDM_CC_DISCOVERY,
+                                         RDM_PID_DISC_UN_MUTE, NULL, 0);
+      break;
+
+    case ARTNET_DISC_MUTE_KNOWN:
+      trans->len = artnetRdmBuildRequest(st, trans->data, tod->uid[disc->index], port, 0, RDM_CC_DISCOVERY,
+                                         RDM_PID_DISC_MUTE, NULL, 0);
+      break;
+
+    case ARTNET_DISC_BRANCH:
+    {
+      uint64_t lower = disc->stack[disc->depth - 1].base;
+      uint64_t upper = lower + (1ULL << disc->stack[disc->depth - 1].bits) - 1;
+
+      for(i = 0; i < 6; i++)
+      {
+        pd[5 - i] = lower & 0xff;
+        pd[11 - i] = upper & 0xff;
+        lower >>= 8;
+        upper >>= 8;
+      }
+
+      trans->len = artnetRdmBuildRequest(st, trans->data, all, port, 0, RDM_CC_DISCOVERY,
+                                         RDM_PID_DISC_UNIQUE_BRANCH, pd, 12);
+      break;
+    }
+
+    case ARTNET_DISC_MUTE:
+      trans->len = artnetRdmBuildRequest(st, trans->data, disc->found, port, 0, RDM_CC_DISCOVERY,
+                                         RDM_PID_DISC_MUTE, NULL, 0);
+      break;
+  }
+
+  trans->tn = trans->data[RDM_OFFSET_TN];
+  trans->port = port;
+
+  disc->waiting = true;
+  artnetRdmQueue(st, trans);
+}
+
+/**
+ * Background discovery scheduler
+ *
+ * Steps every port discovery forward, one transaction at
+ * a time, as long as it's within its line time budget for
+ * the current time slice.
+ */
+static void artnetRdmDiscService(artnet_status_t *st)
+{
+  uint8_t k;
+  systime_t now = chVTGetSystemTimeX();
+
+  for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+  {
+    artnet_rdm_disc_t *disc = &st->rdmDisc[k];
+    artnet_group_t *grp = &st->cfg->groups[k / ARTNET_MAX_PORTS];
+    uint8_t j = k % ARTNET_MAX_PORTS;
+
+    if(grp->rdmcb == NULL || j >= grp->ports || !(grp->portType[j] & ARTNET_TYPE_OUTPUT))
+      continue;
+
+    if(disc->waiting)
+      continue;
+
+    if(disc->state == ARTNET_DISC_IDLE && disc->background &&
+       chTimeDiffX(disc->lastRun, now) >= TIME_MS2I(ARTNET_RDM_DISC_INTERVAL_MS))
+      disc->restart = true;
+
+    if(disc->restart)
+    {
+      memset(st->rdmTod[k].seen, 0, sizeof(st->rdmTod[k].seen));
+      disc->restart = false;
+      disc->result = false;
+      disc->changed = false;
+      disc->depth = 0;
+      disc->state = ARTNET_DISC_UNMUTE;
+    }
+
+    if(disc->result)
+    {
+      disc->result = false;
+
+      if(disc->state != ARTNET_DISC_IDLE)
+        artnetRdmDiscResult(st, k);
+    }
+
+    if(disc->state == ARTNET_DISC_IDLE)
+      continue;
+
+    if(chTimeDiffX(disc->periodStart, now) >= TIME_MS2I(ARTNET_RDM_DISC_PERIOD_MS))
+    {
+      disc->periodStart = now;
+      disc->used = 0;
+    }
+
+    // Leave the rest of the slice to DMX
+    if(disc->used >= TIME_MS2I(ARTNET_RDM_DISC_BUDGET_MS))
+      continue;
+
+    artnetRdmDiscIssue(st, k);
+  }
+}
+
+/**
+ * ArtTodRequest
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | No allowed
+ *                  | Broadcast             | Controller directed broadcast to all nodes.
+ * --------------------------------------------------------------------------------------
+ * Node output      | Receive               | Reply with ArtTodData
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Node input       | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Input Gateway Directed Broadcasts to all nodes.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | No Action.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * This packet is used to request the Table of RDM Devices (TOD). A Node receiving this 
+ * packet must not interpret it as forcing full discovery. Full discovery is only initiated at 
+ * power on or when an ArtTodControl.AtcFlush is received.
+ *
+ * The response is ArtTodData.
+ *
+ */
+static void artnetHandleToDRequest(artnet_status_t *st, artnet_packet_u *artnet)
+{
+  uint8_t i, j, a;
+  bool queued = false;
+
+  if(!st->cfg->rdmEnabled)
+    return;
+
+  // TodFull is the only command
+  if(artnet->todrequest.command != 0)
+    return;
+
+  if(artnet->todrequest.addcount > sizeof(artnet->todrequest.address))
+    return;
+
+  for(a = 0; a < artnet->todrequest.addcount; a++)
+  {
+    for(i = 0; i < ARTNET_GROUPS; i++)
+    {
+      artnet_group_t *grp = &st->cfg->groups[i];
+
+      if(grp->rdmcb == NULL)
+        continue;
+
+      for(j = 0; j < grp->ports; j++)
+      {
+        if(!artnetIsOutputPort(grp, j, artnet->todrequest.net, artnet->todrequest.address[a]))
+          continue;
+
+        // Not a discovery trigger, just what we know
+        st->rdmDisc[ARTNET_PORT_INDEX(i, j)].todPending = true;
+        queued = true;
+      }
+    }
+  }
+
+  if(queued)
+    artnetQueueSend(st, ARTNET_SEND_TODDATA);
+}
+
+/**
+ * ArtTodControl
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | Allowed
+ *                  | Broadcast             | Controller directed broadcast to all nodes.
+ * --------------------------------------------------------------------------------------
+ * Node output      | Receive               | Reply with ArtTodData
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Node input       | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Input Gateway Directed Broadcasts to all nodes.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | No Action.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * The ArtTodControl packet is used to send RDM control parameters over Art-Net. 
+ * The response is ArtTodData.
+ *
+ */
+static void artnetHandleToDControl(artnet_status_t *st, artnet_packet_u *artnet)
+{
+  uint8_t i, j;
+  bool queued = false;
+
+  if(!st->cfg->rdmEnabled)
+    return;
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    if(grp->rdmcb == NULL)
+      continue;
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      artnet_rdm_disc_t *disc = &st->rdmDisc[ARTNET_PORT_INDEX(i, j)];
+
+      if(!artnetIsOutputPort(grp, j, artnet->todcontrol.net, artnet->todcontrol.address))
+        continue;
+
+      switch(artnet->todcontrol.command)
+      {
+        case ARTNET_ATCFLUSH:
+          // Full discovery, the table is updated as it goes
+          // and sent when it's done
+          disc->replyOnEnd = true;
+          artnetRdmDiscStart(st, ARTNET_PORT_INDEX(i, j));
+          break;
+
+        case ARTNET_ATCEND:
+          disc->state = ARTNET_DISC_IDLE;
+          disc->todPending = true;
+          queued = true;
+          break;
+
+        case ARTNET_ATCINCON:
+          disc->background = true;
+          break;
+
+        case ARTNET_ATCINCOFF:
+          disc->background = false;
+          break;
+
+        default:
+          disc->todPending = true;
+          queued = true;
+          break;
+      }
+    }
+  }
+
+  if(queued)
+    artnetQueueSend(st, ARTNET_SEND_TODDATA);
+}
+
+/**
+ * ArtRdm
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | Allowed - Preferred
+ *                  | Broadcast             | Allowed
+ * --------------------------------------------------------------------------------------
+ * Node output      | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Allowed - Preferred
+ *                  | Broadcast             | Allowed
+ * --------------------------------------------------------------------------------------
+ * Node input       | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Allowed - Preferred
+ *                  | Broadcast             | Allowed
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | No Action.
+ *                  | Unicast Transmit      | Allowed - Preferred
+ *                  | Broadcast             | Allowed
+ * --------------------------------------------------------------------------------------
+ *
+ * The ArtRdm packet is used to transport all non-discovery RDM messages over Art-Net.
+ *
+ */
+static void artnetHandleRdm(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len)
+{
+  uint8_t i, j;
+  artnet_rdm_trans_t *trans;
+  uint16_t rdmlen;
+  uint8_t *rdm = artnet->rdm.rdmpacket;
+
+  if(!st->cfg->rdmEnabled)
+    return;
+
+  // ArProcess is the only command
+  if(artnet->rdm.command != 0)
+    return;
+
+  // Sanity check the RDM packet, message length does not count
+  // the checksum but counts the start code we don't have
+  if(len < sizeof(struct artnet_rdm_t) + RDM_MIN_LENGTH + 1)
+    return;
+
+  if(rdm[0] != RDM_SUB_START_CODE)
+    return;
+
+  rdmlen = rdm[RDM_OFFSET_LENGTH] + 1;
+  if(rdmlen < RDM_MIN_LENGTH + 1 || rdmlen > ARTNET_RDM_MAX_LENGTH ||
+     rdmlen > len - sizeof(struct artnet_rdm_t))
+    return;
+
+  // Which port is this for ?
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    if(grp->rdmcb == NULL)
+      continue;
+
+    for(j = 0; j < grp->ports; j++)
+      if(artnetIsOutputPort(grp, j, artnet->rdm.net, artnet->rdm.address))
+        break;
+
+    if(j < grp->ports)
+      break;
+  }
+
+  if(i == ARTNET_GROUPS)
+    return;
+
+  uint16_t subDevice = (rdm[RDM_OFFSET_SUBDEVICE] << 8) | rdm[RDM_OFFSET_SUBDEVICE + 1];
+  uint16_t pid = (rdm[RDM_OFFSET_PID] << 8) | rdm[RDM_OFFSET_PID + 1];
+
+  if(rdm[RDM_OFFSET_CC] == RDM_CC_SET)
+    artnetRdmCacheFlush(st, &rdm[RDM_OFFSET_DEST_UID]);
+
+  // Static PIDs are answered by us
+  uint8_t pd[ARTNET_RDM_CACHE_PD];
+  uint8_t pdl;
+
+  if(rdm[RDM_OFFSET_CC] == RDM_CC_GET &&
+     artnetRdmCacheGet(st, &rdm[RDM_OFFSET_DEST_UID], subDevice, pid, &rdm[RDM_OFFSET_PD], rdm[RDM_OFFSET_PDL],
+                       pd, &pdl))
+  {
+    artnet_tx_t *tx = artnetTxAlloc(st);
+    uint8_t *resp;
+    uint16_t sum;
+
+    st->rdmCacheHits++;
+
+    if(tx == NULL)
+      return;
+
+    // Request header, then the response in its place
+    memcpy(tx->data, artnet, sizeof(struct artnet_rdm_t) + RDM_OFFSET_PD);
+    resp = tx->data + sizeof(struct artnet_rdm_t);
+
+    memcpy(&resp[RDM_OFFSET_DEST_UID], &rdm[RDM_OFFSET_SRC_UID], 6);
+    memcpy(&resp[RDM_OFFSET_SRC_UID], &rdm[RDM_OFFSET_DEST_UID], 6);
+
+    resp[RDM_OFFSET_LENGTH] = RDM_MIN_LENGTH + pdl;
+    resp[RDM_OFFSET_PORT] = RDM_RESPONSE_ACK;
+    resp[RDM_OFFSET_MSGCOUNT] = 0;
+    resp[RDM_OFFSET_CC] = RDM_CC_GET_RESPONSE;
+    resp[RDM_OFFSET_PDL] = pdl;
+    memcpy(&resp[RDM_OFFSET_PD], pd, pdl);
+
+    rdmlen = RDM_OFFSET_PD + pdl;
+    sum = artnetRdmChecksum(resp, rdmlen);
+    resp[rdmlen++] = sum >> 8;
+    resp[rdmlen++] = sum & 0xff;
+
+    artnetReplyToSender(st, tx, sizeof(struct artnet_rdm_t) + rdmlen);
+    return;
+  }
+
+  // Queue it, the service thread hands it to the driver
+  // when the port is free
+  trans = artnetRdmAlloc(st, ARTNET_RDM_OWNER_ARTRDM, 0);
+  if(trans == NULL)
+    return;
+
+  ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+  trans->port = ARTNET_PORT_INDEX(i, j);
+  trans->tn = rdm[RDM_OFFSET_TN];
+  trans->net = artnet->rdm.net;
+  trans->address = artnet->rdm.address;
+  trans->srcIp = ipv4->srcIp;
+  memcpy(trans->srcMac, st->cfg->iface->buffer + 6, 6); // ethernet source
+  trans->len = rdmlen;
+  memcpy(trans->data, rdm, rdmlen);
+
+  artnetRdmQueue(st, trans);
+}
+
+/**
+ * Sends back, as ArtRdm, all the RDM responses
+ * we got from the drivers
+ *
+ * Queued with artnetQueueSend so it runs
+ * when the interface buffer is ours.
+ */
+static void artnetSendRdmReplies(artnet_status_t *st, ustack_iface_t *iface)
+{
+  uint8_t i;
+  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+
+  for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+  {
+    artnet_rdm_trans_t *trans = &st->rdm[i];
+
+    if(trans->state != ARTNET_RDM_DONE)
+      continue;
+
+    memcpy(artnet->rdm.id, "Art-Net\0", 8);
+    artnet->rdm.opCode = ARTNET_OPCODE_RDM;
+    artnet->rdm.prot_ver_hi = 0;
+    artnet->rdm.prot_ver_low = ARTNET_VERSION;
+    artnet->rdm.rdmver = 0x01;
+    artnet->rdm.filler = 0;
+    memset(artnet->rdm.spare, 0, 7);
+    artnet->rdm.net = trans->net;
+    artnet->rdm.command = 0;
+    artnet->rdm.address = trans->address;
+    memcpy(artnet->rdm.rdmpacket, trans->data, trans->len);
+
+    ustackUdpSend(iface,
+                  trans->srcMac,
+                  ntohl(trans->srcIp),
+                  st->cfg->port, st->cfg->port,
+                  sizeof(struct artnet_rdm_t) + trans->len);
+
+    trans->state = ARTNET_RDM_FREE;
+  }
+}
+
+/**
+ * ArtRdmSub
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No Action.
+ *                  | Unicast Transmit      | yes
+ *                  | Broadcast             | Not Allowed
+ * --------------------------------------------------------------------------------------
+ * Node output      | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Yes
+ *                  | Broadcast             | Not Allowed
+ * --------------------------------------------------------------------------------------
+ * Node input       | Receive               | No Action.
+ * gateway          | Unicast Transmit      | Yes
+ *                  | Broadcast             | Not Allowed
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | No Action.
+ *                  | Unicast Transmit      | Not Allowed
+ *                  | Broadcast             | Not Allowed
+ * --------------------------------------------------------------------------------------
+ *
+ * The ArtRdmSub packet is used to transfer Get, Set, GetResponse and SetResponse data 
+ * to and from multiple sub-devices within an RDM device. This packet is primarily used by 
+ * Art-Net devices that proxy or emulate RDM. It offers very significant bandwidth gains 
+ * over the approach of sending multiple ArtRdm packets.
+ *
+ * Please note that this packet was added at the release of Art-Net II. For backwards 
+ * compatibility it is only acceptable to implement this packet in addition to ArtRdm. It 
+ * must not be used instead of ArtRdm.
+ *
+ */
+static void artnetHandleRdmSub(artnet_status_t *st, artnet_packet_u *artnet, uint16_t len)
+{
+  uint8_t i, port;
+  artnet_rdmsub_job_t *job = NULL;
+  uint16_t subDevice, subCount, pid;
+
+  if(!st->cfg->rdmEnabled)
+    return;
+
+  if(len < sizeof(struct artnet_rdmsub_t))
+    return;
+
+  subDevice = ntohs(artnet->rdmsub.subDevice);
+  subCount = ntohs(artnet->rdmsub.subCount);
+  pid = ntohs(artnet->rdmsub.paramId);
+
+  if(subCount == 0 || subCount > ARTNET_RDMSUB_MAX)
+    return;
+
+  if(artnet->rdmsub.cmdClass == RDM_CC_SET)
+  {
+    if(len < sizeof(struct artnet_rdmsub_t) + subCount * 2)
+      return;
+
+    artnetRdmCacheFlush(st, artnet->rdmsub.uid);
+  }
+  else if(artnet->rdmsub.cmdClass != RDM_CC_GET)
+    return;
+
+  // All of it cached ? reply from the cache
+  if(artnet->rdmsub.cmdClass == RDM_CC_GET && artnetRdmIsStaticPid(pid, NULL))
+  {
+    uint8_t pd[ARTNET_RDM_CACHE_PD];
+    uint8_t pdl;
+
+    for(i = 0; i < subCount; i++)
+      if(!artnetRdmCacheGet(st, artnet->rdmsub.uid, subDevice + i, pid, NULL, 0, NULL, &pdl))
+        break;
+
+    if(i == subCount)
+    {
+      artnet_tx_t *tx = artnetTxAlloc(st);
+      artnet_packet_u *reply;
+
+      st->rdmCacheHits++;
+
+      if(tx == NULL)
+        return;
+
+      reply = (artnet_packet_u*)tx->data;
+      memcpy(reply, artnet, sizeof(struct artnet_rdmsub_t));
+      reply->rdmsub.cmdClass = RDM_CC_GET_RESPONSE;
+
+      for(i = 0; i < subCount; i++)
+      {
+        // Replaced meanwhile by a driver response, drop it
+        if(!artnetRdmCacheGet(st, artnet->rdmsub.uid, subDevice + i, pid, NULL, 0, pd, &pdl))
+        {
+          chSysLock();
+          tx->state = ARTNET_TX_FREE;
+          chSysUnlock();
+          return;
+        }
+
+        reply->rdmsub.data[i] = htons(pdl >= 2 ? (pd[0] << 8) | pd[1] : (pdl == 1 ? pd[0] : 0));
+      }
+
+      artnetReplyToSender(st, tx, sizeof(struct artnet_rdmsub_t) + subCount * 2);
+      return;
+    }
+  }
+
+  if(!artnetRdmFindPort(st, artnet->rdmsub.uid, &port))
+    return;
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDMSUB_JOBS; i++)
+  {
+    if(st->rdmSub[i].state == ARTNET_RDMSUB_FREE)
+    {
+      job = &st->rdmSub[i];
+      job->state = ARTNET_RDMSUB_RUNNING;
+      job->waiting = true;  // Hold the service thread until it's filled in
+      break;
+    }
+  }
+  chSysUnlock();
+
+  if(job == NULL)
+  {
+    st->rdmDropped++;
+    return;
+  }
+
+  ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+
+  job->port = port;
+  memcpy(job->uid, artnet->rdmsub.uid, 6);
+  job->cmdClass = artnet->rdmsub.cmdClass;
+  job->pid = pid;
+  job->subDevice = subDevice;
+  job->subCount = subCount;
+  job->next = 0;
+  job->srcIp = ipv4->srcIp;
+  memcpy(job->srcMac, st->cfg->iface->buffer + 6, 6); // ethernet source
+
+  for(i = 0; i < subCount; i++)
+    job->values[i] = (job->cmdClass == RDM_CC_SET) ? ntohs(artnet->rdmsub.data[i]) : 0;
+
+  job->waiting = false;
+}
+
+/**
+ * Sends back the finished ArtRdmSub jobs
+ *
+ * Queued with artnetQueueSend so it runs
+ * when the interface buffer is ours.
+ */
+static void artnetSendRdmSubReplies(artnet_status_t *st, ustack_iface_t *iface)
+{
+  uint8_t i;
+  uint16_t k;
+  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+
+  for(i = 0; i < ARTNET_RDMSUB_JOBS; i++)
+  {
+    artnet_rdmsub_job_t *job = &st->rdmSub[i];
+    uint16_t count = 0;
+
+    if(job->state != ARTNET_RDMSUB_DONE)
+      continue;
+
+    memcpy(artnet->rdmsub.id, "Art-Net\0", 8);
+    artnet->rdmsub.opCode = ARTNET_OPCODE_RDMSUB;
+    artnet->rdmsub.prot_ver_hi = 0;
+    artnet->rdmsub.prot_ver_low = ARTNET_VERSION;
+    artnet->rdmsub.rdmver = 0x01;
+    artnet->rdmsub.filler = 0;
+    memcpy(artnet->rdmsub.uid, job->uid, 6);
+    artnet->rdmsub.spare = 0;
+    artnet->rdmsub.cmdClass = job->cmdClass | 0x01; // Get/Set response
+    artnet->rdmsub.paramId = htons(job->pid);
+    artnet->rdmsub.subDevice = htons(job->subDevice);
+    artnet->rdmsub.subCount = htons(job->subCount);
+    memset(artnet->rdmsub.spare2, 0, 4);
+
+    // SetResponse carries no data
+    if(job->cmdClass == RDM_CC_GET)
+    {
+      count = job->subCount;
+      for(k = 0; k < count; k++)
+        artnet->rdmsub.data[k] = htons(job->values[k]);
+    }
+
+    ustackUdpSend(iface,
+                  job->srcMac,
+                  ntohl(job->srcIp),
+                  st->cfg->port, st->cfg->port,
+                  sizeof(struct artnet_rdmsub_t) + count * 2);
+
+    job->state = ARTNET_RDMSUB_FREE;
+  }
+}
+
+/**
+ * ArtRdmSub fan out
+ *
+ * Issues the next sub-device request of each running job,
+ * one at a time so a job never hogs the transaction table,
+ * answering static PIDs from the cache without touching
+ * the line.
+ */
+static void artnetRdmSubService(artnet_status_t *st)
+{
+  uint8_t i;
+  bool done = false;
+
+  for(i = 0; i < ARTNET_RDMSUB_JOBS; i++)
+  {
+    artnet_rdmsub_job_t *job = &st->rdmSub[i];
+
+    if(job->state != ARTNET_RDMSUB_RUNNING || job->waiting)
+      continue;
+
+    while(job->next < job->subCount)
+    {
+      uint16_t subDevice = job->subDevice + job->next;
+      uint8_t pd[ARTNET_RDM_CACHE_PD];
+      uint8_t pdl;
+
+      if(job->cmdClass == RDM_CC_GET && artnetRdmCacheGet(st, job->uid, subDevice, job->pid, NULL, 0, pd, &pdl))
+      {
+        job->values[job->next++] = pdl >= 2 ? (pd[0] << 8) | pd[1] : (pdl == 1 ? pd[0] : 0);
+        st->rdmCacheHits++;
+        continue;
+      }
+
+      artnet_rdm_trans_t *trans = artnetRdmAlloc(st, ARTNET_RDM_OWNER_SUB, i);
+      if(trans == NULL)
+        break; // Try again next time
+
+      uint8_t value[2] = { job->values[job->next] >> 8, job->values[job->next] & 0xff };
+
+      trans->len = artnetRdmBuildRequest(st, trans->data, job->uid, job->port, subDevice, job->cmdClass,
+                                         job->pid, value, (job->cmdClass == RDM_CC_SET) ? 2 : 0);
+      trans->tn = trans->data[RDM_OFFSET_TN];
+      trans->port = job->port;
+      artnetRdmQueue(st, trans);
+
+      job->next++;
+      job->waiting = true;
+      break;
+    }
+
+    if(job->next == job->subCount && !job->waiting)
+    {
+      job->state = ARTNET_RDMSUB_DONE;
+      done = true;
+    }
+  }
+
+  if(done)
+    artnetQueueSend(st, ARTNET_SEND_RDMSUBREPLIES);
+}
+
+/**
+ * RDM transaction housekeeping
+ *
+ * Retires the transactions whose responder didn't answer
+ * in time and hands the oldest queued request of each
+ * idle port to its driver. RDM is half duplex so only one
+ * transaction per port is on the wire.
+ */
+static void artnetRdmService(artnet_status_t *st)
+{
+  uint8_t i, k;
+  systime_t now = chVTGetSystemTimeX();
+  uint8_t busy[ARTNET_GROUPS * ARTNET_MAX_PORTS] = {0};
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+  {
+    artnet_rdm_trans_t *trans = &st->rdm[i];
+
+    if(trans->state != ARTNET_RDM_ACTIVE)
+      continue;
+
+    sysinterval_t timeout = TIME_MS2I((trans->owner == ARTNET_RDM_OWNER_DISC) ?
+                                      ARTNET_RDM_DISC_TIMEOUT_MS : ARTNET_RDM_TIMEOUT_MS);
+
+    if(chTimeDiffX(trans->stamp, now) >= timeout)
+    {
+      // The controller retries, we just free the slot
+      if(trans->owner == ARTNET_RDM_OWNER_SUB)
+        st->rdmSub[trans->job].waiting = false;
+
+      if(trans->owner == ARTNET_RDM_OWNER_DISC)
+      {
+        // Nobody answered is a result too
+        artnet_rdm_disc_t *disc = &st->rdmDisc[trans->job];
+
+        disc->used += chTimeDiffX(trans->stamp, now);
+        disc->resultLen = 0;
+        disc->result = true;
+        disc->waiting = false;
+      }
+      else
+        st->rdmTimeouts++;
+
+      trans->state = ARTNET_RDM_FREE;
+    }
+    else
+      busy[trans->port] = 1;
+  }
+  chSysUnlock();
+
+  for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+  {
+    artnet_rdm_trans_t *next = NULL;
+
+    if(busy[k])
+      continue;
+
+    chSysLock();
+    for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+    {
+      artnet_rdm_trans_t *trans = &st->rdm[i];
+
+      if(trans->state != ARTNET_RDM_QUEUED || trans->port != k)
+        continue;
+
+      if(next == NULL || (int16_t)(trans->order - next->order) < 0)
+        next = trans;
+    }
+
+    if(next != NULL)
+    {
+      next->state = ARTNET_RDM_ACTIVE;
+      next->stamp = now;
+    }
+    chSysUnlock();
+
+    if(next != NULL)
+    {
+      artnet_group_t *grp = &st->cfg->groups[k / ARTNET_MAX_PORTS];
+
+      // Driver must only queue it and return
+      grp->rdmcb(k, next->len, next->data);
+    }
+  }
+}
+
+/**
+ * ArtSync
+ *
+ * Packet strategy.
+ * 
+ * Entity           | Direction             | Action
+ * --------------------------------------------------------------------------------------
+ * Controller       | Receive               | No action.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Directed Broadcast    | Controller broadcasts this packet
+ *                                          | to synchronously transfer previous 
+ *                                          | ArtDmx packets to Node’s output.
+ * --------------------------------------------------------------------------------------
+ * Node             | Receive               | Transfer previous ArtDmx packets to output.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ * Media Server     | Receive               | Transfer previous ArtDmx packets to output.
+ *                  | Unicast Transmit      | Not allowed.
+ *                  | Broadcast             | Not allowed.
+ * --------------------------------------------------------------------------------------
+ *
+ * The Art Sync packet can be used to force nodes to 
+ * synchronously output ArtDmx packets to their outputs. 
+ * This is useful in video and media-wall applications.
+ * A controller that wishes to implement synchronous 
+ * transmission will unicast multiple universes of ArtDmx 
+ * and then broadcast an ArtSync to synchronously transfer 
+ * all the ArtDmx packets to the nodes’ outputs at the same time.
+ *
+ * Managing Synchronous and non-Synchronous modes
+ * 
+ * At power on or reset a node shalloperate in non-synchronous mode. 
+ * This means that ArtDmx packets will be immediately processed and output.
+ * When a node receives an ArtSync packet it should 
+ * transfer to synchronous operation. 
+ * This means that received ArtDmx packets will be buffered and output 
+ * when the next ArtSync is received.
+ * In order to allow transition between synchronous and non-synchronous 
+ * modes, a node shall time out to non-synchronous operation if an ArtSync 
+ * is not received for 4 seconds or more.
+ *
+ * Multiple controllers
+ *
+ * In order to allow for multiple controllers on a network, a node shall 
+ * compare the source IP of the ArtSync to the source IP of the most recent
+ * ArtDmx packet. The ArtSync shall be ignored if the IP addresses do not match.
+ * When a port is merging multiple streams of ArtDmx from different IP addresses, 
+ * ArtSync packets shall be ignored.
+ */
+static void artnetHandleSync(artnet_packet_u *artnet)
+{
+  (void)artnet;
+}
+
+/**
+ * sACN universe of a port
+ *
+ * Port-Address 0 is sACN universe 1, and so on.
+ *
+ * artnet_group_t grp - the group of the port
+ * uint8_t port       - the port number inside the group
+ */
+static uint16_t sacnPortUniverse(artnet_group_t *grp, uint8_t port)
+{
+  return (((grp->net & 0x7f) << 8) | ((grp->subnet & 0x0f) << 4) | (grp->swout[port] & 0x0f)) + 1;
+}
+
+/**
+ * Our sACN component id
+ *
+ * The configured one, or a version 4 style UUID
+ * built from the MAC address when it's not set.
+ *
+ * uint8_t *cid - where the 16 byte CID is stored
+ */
+static void sacnGetCid(artnet_status_t *st, uint8_t *cid)
+{
+  uint8_t i;
+
+  for(i = 0; i < 16; i++)
+    if(st->cfg->cid[i] != 0)
+      break;
+
+  if(i < 16)
+  {
+    memcpy(cid, st->cfg->cid, 16);
+    return;
+  }
+
+  memset(cid, 0, 16);
+  cid[0] = (ARTNET_OEM >> 8) & 0xff;
+  cid[1] = ARTNET_OEM & 0xff;
+  cid[6] = 0x40;
+  cid[8] = 0x80;
+  memcpy(&cid[10], st->cfg->iface->cfg->mac, 6);
+}
+
+/**
+ * Fills in the root layer of an sACN packet
+ *
+ * uint8_t *pkt   - the packet
+ * uint32_t vector - root layer vector
+ * uint16_t len   - the whole packet length
+ */
+static void sacnBuildRoot(artnet_status_t *st, uint8_t *pkt, uint32_t vector, uint16_t len)
+{
+  e131_packet_t *e131 = (e131_packet_t*)pkt;
+
+  e131->root.preamble_size = htons(0x0010);
+  e131->root.postamble_size = 0;
+  memcpy(e131->root.acn_pid, SACN_ACN_PID, 12);
+  e131->root.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, root.flength)));
+  e131->root.vector = htonl(vector);
+  sacnGetCid(st, e131->root.cid);
+}
+
+/**
+ * Adds a universe to a sorted list,
+ * unless it's already there
+ *
+ * Returns the new count
+ */
+static uint16_t sacnAddUniverse(uint16_t *universes, uint16_t count, uint16_t uni)
+{
+  uint16_t i;
+
+  for(i = 0; i < count; i++)
+    if(universes[i] == uni)
+      return count;
+
+  for(i = count; i > 0 && universes[i - 1] > uni; i--)
+    universes[i] = universes[i - 1];
+
+  universes[i] = uni;
+
+  return count + 1;
+}
+
+/**
+ * Lists the sACN universes we take, the ones
+ * of our ports and the ones we bridge to Art-Net
+ *
+ * uint16_t *universes - room for one per port and route,
+ *                       sorted and without repeats on return
+ *
+ * Returns how many
+ */
+static uint16_t sacnGetUniverses(artnet_status_t *st, uint16_t *universes)
+{
+  uint16_t count = 0;
+  uint8_t g, j;
+
+  for(g = 0; g < ARTNET_GROUPS; g++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[g];
+
+    for(j = 0; j < grp->ports; j++)
+      if(grp->outputStatus[j] & ARTNET_OUTPUT_SACN)
+        count = sacnAddUniverse(universes, count, sacnPortUniverse(grp, j));
+  }
+
+  for(j = 0; j < st->cfg->bridgeCount; j++)
+    if(st->cfg->bridge[j].dir == ARTNET_BRIDGE_TO_ARTNET)
+      count = sacnAddUniverse(universes, count, st->cfg->bridge[j].universe);
+
+  return count;
+}
+
+/**
+ * Lists the sACN universes we send, the streams
+ * of our input ports and the ones we bridge to sACN
+ *
+ * uint16_t *universes - room for one per port and route,
+ *                       sorted and without repeats on return
+ *
+ * Returns how many
+ */
+static uint16_t sacnGetSentUniverses(artnet_status_t *st, uint16_t *universes)
+{
+  uint16_t count = 0;
+  uint8_t j;
+
+  for(j = 0; j < ARTNET_GROUPS * ARTNET_MAX_PORTS; j++)
+    if(st->sacnTx[j].active)
+      count = sacnAddUniverse(universes, count, ntohs(st->sacnTx[j].pkt.frame.universe));
+
+  for(j = 0; j < st->cfg->bridgeCount; j++)
+    if(st->cfg->bridge[j].dir == ARTNET_BRIDGE_TO_SACN)
+      count = sacnAddUniverse(universes, count, st->cfg->bridge[j].universe);
+
+  return count;
+}
+
+/**
+ * Ethernet multicast MAC of an sACN universe
+ *
+ * 239.255.hi.lo maps to 01:00:5e:7f:hi:lo
+ */
+static void sacnUniverseMac(uint16_t universe, uint8_t *mac)
+{
+  mac[0] = 0x01;
+  mac[1] = 0x00;
+  mac[2] = 0x5e;
+  mac[3] = 0x7f;
+  mac[4] = universe >> 8;
+  mac[5] = universe & 0xff;
+}
+
+/**
+ * Bit of the 64 bit MAC multicast hash filter a MAC
+ * address lands on, upper 6 bits of the bit reversed
+ * ethernet CRC as the STM32 and most MACs use
+ */
+static uint8_t sacnMacHashBit(uint8_t *mac)
+{
+  uint32_t crc = 0xffffffff;
+  uint32_t rev = 0;
+  uint8_t i, b;
+
+  for(i = 0; i < 6; i++)
+  {
+    crc ^= mac[i];
+    for(b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+  }
+
+  crc = ~crc;
+
+  for(b = 0; b < 32; b++)
+  {
+    rev = (rev << 1) | (crc & 1);
+    crc >>= 1;
+  }
+
+  return rev >> 26;
+}
+
+/**
+ * Joins the multicast groups of the universes our ports
+ * take and leaves the ones they no longer do
+ *
+ * The stack is told through mcastcb, the MAC hash filter
+ * to program through mcastFiltercb. Runs from the service
+ * thread when sacnGroupsDirty is set.
+ */
+static void sacnUpdateGroups(artnet_status_t *st)
+{
+  uint16_t universes[ARTNET_GROUPS * ARTNET_MAX_PORTS + ARTNET_BRIDGE_ROUTES + 1];
+  uint16_t count, i, k, n = 0;
+  uint32_t hash[2] = { 0, 0 };
+  uint8_t mac[6];
+
+  count = sacnGetUniverses(st, universes);
+
+  // Nobody announcing it ? no point taking it
+  for(i = 0; i < count; i++)
+    if(!st->cfg->sacnJoinSent || sacnIsUniverseSent(st, universes[i]))
+      universes[n++] = universes[i];
+
+  universes[n++] = SACN_DISCOVERY_UNIVERSE;
+
+  // Leave
+  for(k = 0; k < st->sacnJoinedCount; k++)
+  {
+    for(i = 0; i < n; i++)
+      if(universes[i] == st->sacnJoined[k])
+        break;
+
+    if(i == n && st->cfg->mcastcb != NULL)
+    {
+      sacnUniverseMac(st->sacnJoined[k], mac);
+      st->cfg->mcastcb(false, ustackIpToA(239, 255, mac[4], mac[5]), mac);
+    }
+  }
+
+  // Join
+  for(i = 0; i < n; i++)
+  {
+    sacnUniverseMac(universes[i], mac);
+
+    uint8_t bit = sacnMacHashBit(mac);
+    hash[bit >> 5] |= 1UL << (bit & 0x1f);
+
+    for(k = 0; k < st->sacnJoinedCount; k++)
+      if(universes[i] == st->sacnJoined[k])
+        break;
+
+    if(k == st->sacnJoinedCount && st->cfg->mcastcb != NULL)
+      st->cfg->mcastcb(true, ustackIpToA(239, 255, mac[4], mac[5]), mac);
+  }
+
+  chSysLock();
+  memcpy(st->sacnJoined, universes, n * sizeof(uint16_t));
+  st->sacnJoinedCount = n;
+  chSysUnlock();
+
+  if(hash[0] != st->sacnHash[0] || hash[1] != st->sacnHash[1])
+  {
+    st->sacnHash[0] = hash[0];
+    st->sacnHash[1] = hash[1];
+
+    if(st->cfg->mcastFiltercb != NULL)
+      st->cfg->mcastFiltercb(hash[0], hash[1]);
+  }
+}
+
+/**
+ * Builds the headers of an sACN data packet,
+ * all layers, for a full universe
+ *
+ * e131_packet_t *pkt - the packet
+ * uint16_t universe  - the sACN universe
+ */
+static void sacnBuildData(artnet_status_t *st, e131_packet_t *pkt, uint16_t universe)
+{
+  uint16_t len = offsetof(e131_packet_t, dmp.prop_val) + 1 + ARTNET_DMX_LENGTH;
+
+  memset(pkt->raw, 0, sizeof(pkt->raw));
+
+  sacnBuildRoot(st, pkt->raw, SACN_VECTOR_ROOT_DATA, len);
+
+  pkt->frame.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, frame)));
+  pkt->frame.vector = htonl(SACN_VECTOR_FRAME_DATA);
+  memcpy(pkt->frame.source_name, st->cfg->longName, 64);
+  pkt->frame.source_name[63] = 0;
+  pkt->frame.priority = ARTNET_SACN_PRIORITY;
+  pkt->frame.universe = htons(universe);
+
+  pkt->dmp.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, dmp)));
+  pkt->dmp.vector = SACN_VECTOR_DMP_SET_PROPERTY;
+  pkt->dmp.type = 0xa1;
+  pkt->dmp.first_addr = 0;
+  pkt->dmp.addr_inc = htons(1);
+  pkt->dmp.prop_val_cnt = htons(1 + ARTNET_DMX_LENGTH);
+  pkt->dmp.prop_val[0] = 0;   // Null start code
+}
+
+/**
+ * E1.31 Universe Discovery
+ *
+ * Every SACN_DISCOVERY_INTERVAL_MS the universes we send as an sACN
+ * source are listed in discovery packets, sorted and SACN_DISCOVERY_PAGE
+ * per page, multicast to the discovery universe.
+ *
+ * Queued with artnetQueueSend so it runs
+ * when the interface buffer is ours.
+ */
+static void sacnSendDiscovery(artnet_status_t *st, ustack_iface_t *iface)
+{
+  e131_discovery_t *disc = (e131_discovery_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+  uint8_t mac[6] = { 0x01, 0x00, 0x5e, 0x7f, SACN_DISCOVERY_UNIVERSE >> 8, SACN_DISCOVERY_UNIVERSE & 0xff };
+  uint16_t universes[ARTNET_GROUPS * ARTNET_MAX_PORTS + ARTNET_BRIDGE_ROUTES];
+  uint16_t count, sent = 0, i;
+  uint8_t page = 0;
+
+  count = sacnGetSentUniverses(st, universes);
+
+  do
+  {
+    uint16_t n = count - sent;
+    if(n > SACN_DISCOVERY_PAGE)
+      n = SACN_DISCOVERY_PAGE;
+
+    uint16_t len = offsetof(e131_discovery_t, disc.universes) + n * 2;
+
+    sacnBuildRoot(st, disc->raw, SACN_VECTOR_ROOT_EXTENDED, len);
+
+    disc->frame.flength = htons(SACN_FLAGS | (len - offsetof(e131_discovery_t, frame)));
+    disc->frame.vector = htonl(SACN_VECTOR_FRAME_DISCOVERY);
+    memcpy(disc->frame.source_name, st->cfg->longName, 64);
+    disc->frame.source_name[63] = 0;
+    disc->frame.reserved = 0;
+
+    disc->disc.flength = htons(SACN_FLAGS | (len - offsetof(e131_discovery_t, disc)));
+    disc->disc.vector = htonl(SACN_VECTOR_DISCOVERY_LIST);
+    disc->disc.page = page++;
+    disc->disc.last_page = (count > 0) ? (count - 1) / SACN_DISCOVERY_PAGE : 0;
+
+    for(i = 0; i < n; i++)
+      disc->disc.universes[i] = htons(universes[sent + i]);
+
+    ustackUdpSend(iface,
+                  mac,
+                  ustackIpToA(239, 255, SACN_DISCOVERY_UNIVERSE >> 8, SACN_DISCOVERY_UNIVERSE & 0xff),
+                  st->cfg->sacnPort, SACN_PORT,
+                  len);
+
+    sent += n;
+  } while(sent < count);
+}
+
+/**
+ * Incoming universe discovery, keeps the
+ * table of who sends which universes
+ *
+ * uint16_t len - the packet length
+ */
+static void sacnHandleDiscovery(artnet_status_t *st, e131_discovery_t *disc, uint16_t len)
+{
+  uint8_t i;
+  sacn_disc_source_t *src = NULL;
+  ipv4_t *ipv4 = (ipv4_t*)(st->cfg->iface->buffer + sizeof(eth_frame_t));
+  systime_t now = chVTGetSystemTimeX();
+
+  if(len < offsetof(e131_discovery_t, disc.universes))
+    return;
+
+  if(ntohl(disc->disc.vector) != SACN_VECTOR_DISCOVERY_LIST)
+    return;
+
+  uint16_t n = ((ntohs(disc->disc.flength) & 0x0fff) - offsetof(e131_discovery_t, disc.universes) +
+                offsetof(e131_discovery_t, disc)) / 2;
+
+  if(n > SACN_DISCOVERY_PAGE || offsetof(e131_discovery_t, disc.universes) + n * 2 > len)
+    return;
+
+  // Known source, a free slot or the oldest one
+  for(i = 0; i < ARTNET_SACN_DISC_SOURCES; i++)
+  {
+    sacn_disc_source_t *s = &st->sacnSources[i];
+
+    if(s->valid && memcmp(s->cid, disc->root.cid, 16) == 0)
+    {
+      src = s;
+      break;
+    }
+
+    if(src == NULL || !s->valid ||
+       (src->valid && chTimeDiffX(s->lastSeen, now) > chTimeDiffX(src->lastSeen, now)))
+      src = s;
+  }
+
+  if(!src->valid || memcmp(src->cid, disc->root.cid, 16) != 0)
+  {
+    memcpy(src->cid, disc->root.cid, 16);
+    src->count = 0;
+  }
+
+  // Page 0 starts the list over
+  if(disc->disc.page == 0)
+    src->count = 0;
+
+  for(i = 0; i < n && src->count < ARTNET_SACN_DISC_UNIVERSES; i++)
+    src->universes[src->count++] = ntohs(disc->disc.universes[i]);
+
+  src->ip = ipv4->srcIp;
+  src->lastPage = disc->disc.last_page;
+  src->lastSeen = now;
+  src->valid = true;
+
+  if(st->cfg->sacnJoinSent)
+    st->sacnGroupsDirty = true;
+}
+
+/**
+ * Incoming sACN DMX data
+ *
+ * Delivered to the output ports with sACN selected
+ * (AcAcnSel) on the universe. No priority handling,
+ * preview data is ignored.
+ *
+ * uint16_t len - the packet length
+ *
+ * Returns true if it's good DMX data
+ */
+static bool sacnHandleData(artnet_status_t *st, e131_packet_t *e131, uint16_t len)
+{
+  uint8_t i, j;
+  systime_t curr = chVTGetSystemTimeX();
+
+  if(len < offsetof(e131_packet_t, dmp.prop_val) + 1)
+    return false;
+
+  if(ntohl(e131->frame.vector) != SACN_VECTOR_FRAME_DATA ||
+     e131->dmp.vector != SACN_VECTOR_DMP_SET_PROPERTY ||
+     e131->dmp.type != 0xa1 ||
+     ntohs(e131->dmp.first_addr) != 0 ||
+     ntohs(e131->dmp.addr_inc) != 1)
+    return false;
+
+  uint16_t count = ntohs(e131->dmp.prop_val_cnt);
+  uint16_t universe = ntohs(e131->frame.universe);
+
+  if(count < 1 || count > 513 || offsetof(e131_packet_t, dmp.prop_val) + count > len)
+    return false;
+
+  if(e131->frame.options & (SACN_OPTION_PREVIEW | SACN_OPTION_TERMINATED))
+    return false;
+
+  // Null start code only
+  if(e131->dmp.prop_val[0] != 0)
+    return false;
+
+  artnetStatsUpdate(st, universe, e131->frame.seq_number, true, curr);
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      if(!(grp->portType[j] & ARTNET_TYPE_OUTPUT) || !(grp->outputStatus[j] & ARTNET_OUTPUT_SACN))
+        continue;
+
+      if(sacnPortUniverse(grp, j) != universe)
+        continue;
+
+      // Patched ones are checked by artnetPatchDmx(st)
+      if(artnetIsPatched(st, ARTNET_PORT_INDEX(i, j)))
+        continue;
+
+#if ARTNET_USE_CAPTURE
+      artnetCaptureSeq(st, ARTNET_PORT_INDEX(i, j), e131->frame.seq_number, true);
+#endif
+
+      artnetOutput(st, ARTNET_PORT_INDEX(i, j), count - 1, &e131->dmp.prop_val[1]);
+    }
+  }
+
+  if(universe != 0)
+  {
+    artnetPatchDmx(st, universe - 1, count - 1, &e131->dmp.prop_val[1], true, e131->frame.seq_number, NULL, curr);
+    artnetPixelDmx(st, universe - 1, count - 1, &e131->dmp.prop_val[1], true);
+  }
+
+  return true;
+}
+
+/**
+ * sACN universe of an input port
+ *
+ * Same mapping as outputs, on the input switch.
+ */
+static uint16_t sacnPortInUniverse(artnet_group_t *grp, uint8_t port)
+{
+  return (((grp->net & 0x7f) << 8) | ((grp->subnet & 0x0f) << 4) | (grp->swin[port] & 0x0f)) + 1;
+}
+
+/**
+ * Sets the slot count of a source stream,
+ * patching the layer lengths that depend on it
+ */
+static void sacnSourceSetSlots(sacn_source_t *src, uint16_t slots)
+{
+  uint16_t len = offsetof(e131_packet_t, dmp.prop_val) + 1 + slots;
+
+  src->pkt.root.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, root.flength)));
+  src->pkt.frame.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, frame)));
+  src->pkt.dmp.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, dmp)));
+  src->pkt.dmp.prop_val_cnt = htons(1 + slots);
+}
+
+/**
+ * Sends the source streams that are due
+ *
+ * Queued with artnetQueueSend so it runs
+ * when the interface buffer is ours.
+ */
+static void sacnSendSources(artnet_status_t *st, ustack_iface_t *iface)
+{
+  uint8_t k;
+  systime_t now = chVTGetSystemTimeX();
+  e131_packet_t *e131 = (e131_packet_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+
+  st->sacnTxQueued = false;
+
+  for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+  {
+    sacn_source_t *src = &st->sacnTx[k];
+    uint8_t mac[6];
+    uint16_t universe, len;
+
+    if(!src->active)
+      continue;
+
+    sysinterval_t elapsed = chTimeDiffX(src->lastTx, now);
+
+    if(src->terminate == 0 &&
+       !(src->pending && elapsed >= TIME_MS2I(ARTNET_SACN_MIN_INTERVAL_MS)) &&
+       elapsed < TIME_MS2I(ARTNET_SACN_KEEPALIVE_MS))
+      continue;
+
+    chSysLock();
+    len = offsetof(e131_packet_t, dmp.prop_val) + ntohs(src->pkt.dmp.prop_val_cnt);
+    src->pkt.frame.seq_number = src->seq++;
+    src->pkt.frame.priority = src->priority;
+    src->pkt.frame.options = (src->terminate > 0) ? SACN_OPTION_TERMINATED : 0;
+    memcpy(e131->raw, src->pkt.raw, len);
+    src->pending = false;
+    chSysUnlock();
+
+    universe = ntohs(src->pkt.frame.universe);
+    sacnUniverseMac(universe, mac);
+
+    ustackUdpSend(iface,
+                  mac,
+                  ustackIpToA(239, 255, universe >> 8, universe & 0xff),
+                  st->cfg->sacnPort, SACN_PORT,
+                  len);
+
+    src->lastTx = now;
+
+    if(src->terminate > 0 && --src->terminate == 0)
+      src->active = false;
+  }
+}
+
+/**
+ * Queues a send when any source stream is due
+ */
+static void sacnSourceService(artnet_status_t *st)
+{
+  uint8_t k;
+  systime_t now = chVTGetSystemTimeX();
+
+  if(st->sacnTxQueued)
+    return;
+
+  for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+  {
+    sacn_source_t *src = &st->sacnTx[k];
+
+    if(!src->active)
+      continue;
+
+    sysinterval_t elapsed = chTimeDiffX(src->lastTx, now);
+
+    if(src->terminate > 0 ||
+       (src->pending && elapsed >= TIME_MS2I(ARTNET_SACN_MIN_INTERVAL_MS)) ||
+       elapsed >= TIME_MS2I(ARTNET_SACN_KEEPALIVE_MS))
+    {
+      st->sacnTxQueued = true;
+      artnetQueueSend(st, ARTNET_SEND_SACNSOURCES);
+      return;
+    }
+  }
+}
+
+/**
+ * Rewrites, in place, an ArtDmx payload into an sACN one
+ *
+ * The slots are moved once to where sACN has them and the
+ * prebuilt headers written in front, no other copy is made.
+ *
+ * uint8_t *payload  - the UDP payload holding the ArtDmx
+ * uint16_t universe - the sACN universe
+ * uint8_t seq       - sequence number
+ *
+ * Returns the sACN payload length, 0 if the ArtDmx is bad
+ */
+static uint16_t artnetBridgeToSacn(artnet_status_t *st, uint8_t *payload, uint16_t universe, uint8_t seq)
+{
+  artnet_packet_u *artnet = (artnet_packet_u*)payload;
+  e131_packet_t *e131 = (e131_packet_t*)payload;
+  uint16_t slots = ntohs(artnet->dmx.length);
+  uint16_t len = SACN_HEADER_LENGTH + slots;
+
+  if(slots > ARTNET_DMX_LENGTH)
+    return 0;
+
+  memmove(&e131->dmp.prop_val[1], artnet->dmx.data, slots);
+  memcpy(payload, st->bridgeHdr, SACN_HEADER_LENGTH);
+
+  e131->root.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, root.flength)));
+  e131->frame.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, frame)));
+  e131->frame.seq_number = seq;
+  e131->frame.universe = htons(universe);
+  e131->dmp.flength = htons(SACN_FLAGS | (len - offsetof(e131_packet_t, dmp)));
+  e131->dmp.prop_val_cnt = htons(1 + slots);
+
+  return len;
+}
+
+/**
+ * Rewrites, in place, an sACN data payload into an ArtDmx one
+ *
+ * uint8_t *payload     - the UDP payload holding the sACN packet
+ * uint16_t portAddress - the Art-Net Port-Address
+ * uint8_t seq          - sequence number
+ *
+ * Returns the ArtDmx payload length
+ */
+static uint16_t artnetBridgeToArtnet(uint8_t *payload, uint16_t portAddress, uint8_t seq)
+{
+  artnet_packet_u *artnet = (artnet_packet_u*)payload;
+  e131_packet_t *e131 = (e131_packet_t*)payload;
+  uint16_t slots = ntohs(e131->dmp.prop_val_cnt) - 1;
+
+  // ArtDmx wants an even length
+  if(slots & 1)
+    e131->dmp.prop_val[1 + slots++] = 0;
+
+  memmove(artnet->dmx.data, &e131->dmp.prop_val[1], slots);
+
+  memcpy(artnet->dmx.id, "Art-Net\0", 8);
+  artnet->dmx.opCode = ARTNET_OPCODE_DMX;
+  artnet->dmx.prot_ver_hi = 0;
+  artnet->dmx.prot_ver_low = ARTNET_VERSION;
+  artnet->dmx.seq = seq;
+  artnet->dmx.physical = 0;
+  artnet->dmx.sub_uni = portAddress & 0xff;
+  artnet->dmx.net = (portAddress >> 8) & 0x7f;
+  artnet->dmx.length = htons(slots);
+
+  return sizeof(struct artnet_dmx_t) + slots;
+}
+
+/**
+ * Bridges a received ArtDmx to sACN
+ *
+ * Must be the last thing done with the packet, it's
+ * rewritten in the interface buffer and sent from there.
+ * One route converts it, others for the same Port-Address
+ * only patch the universe.
+ *
+ * uint16_t rxlen - the ArtDmx packet length
+ */
+static void artnetBridgeDmx(artnet_status_t *st, artnet_packet_u *artnet, uint16_t rxlen)
+{
+  uint8_t i;
+  uint16_t len = 0;
+  uint16_t portAddress = ((artnet->dmx.net & 0x7f) << 8) | artnet->dmx.sub_uni;
+
+  // Slots past the packet would be whatever is in the buffer
+  if(rxlen < sizeof(struct artnet_dmx_t) ||
+     sizeof(struct artnet_dmx_t) + ntohs(artnet->dmx.length) > rxlen)
+    return;
+
+  for(i = 0; i < st->cfg->bridgeCount; i++)
+  {
+    artnet_bridge_route_t *route = &st->cfg->bridge[i];
+    e131_packet_t *e131 = (e131_packet_t*)artnet;
+    uint8_t mac[6];
+
+    if(route->dir != ARTNET_BRIDGE_TO_SACN || route->portAddress != portAddress)
+      continue;
+
+    if(len == 0)
+    {
+      len = artnetBridgeToSacn(st, artnet->raw, route->universe, st->bridgeSeq[i]++);
+      if(len == 0)
+        return;
+    }
+    else
+    {
+      e131->frame.universe = htons(route->universe);
+      e131->frame.seq_number = st->bridgeSeq[i]++;
+    }
+
+    sacnUniverseMac(route->universe, mac);
+    ustackUdpSend(st->cfg->iface,
+                  mac,
+                  ustackIpToA(239, 255, route->universe >> 8, route->universe & 0xff),
+                  st->cfg->sacnPort, SACN_PORT,
+                  len);
+  }
+}
+
+/**
+ * Bridges received sACN data to ArtDmx
+ *
+ * Same as artnetBridgeDmx, the other way.
+ */
+static void sacnBridgeData(artnet_status_t *st, e131_packet_t *e131)
+{
+  uint8_t i;
+  uint16_t len = 0;
+  uint16_t universe = ntohs(e131->frame.universe);
+
+  for(i = 0; i < st->cfg->bridgeCount; i++)
+  {
+    artnet_bridge_route_t *route = &st->cfg->bridge[i];
+    artnet_packet_u *artnet = (artnet_packet_u*)e131;
+
+    // ArtDmx is never broadcast, a route needs its node
+    if(route->dir != ARTNET_BRIDGE_TO_ARTNET || route->universe != universe || route->ip == 0)
+      continue;
+
+    if(len == 0)
+      len = artnetBridgeToArtnet(e131->raw, route->portAddress, st->bridgeSeq[i]++);
+    else
+    {
+      artnet->dmx.sub_uni = route->portAddress & 0xff;
+      artnet->dmx.net = (route->portAddress >> 8) & 0x7f;
+      artnet->dmx.seq = st->bridgeSeq[i]++;
+    }
+
+    ustackUdpSend(st->cfg->iface,
+                  route->mac,
+                  route->ip,
+                  st->cfg->port, ARTNET_PORT,
+                  len);
+  }
+}
+
+/**
+ * sACN housekeeping, universe discovery,
+ * expiring sources we don't hear from,
+ * multicast group membership and our streams
+ */
+static void sacnService(artnet_status_t *st)
+{
+  uint8_t i;
+  systime_t now = chVTGetSystemTimeX();
+
+  sacnSourceService(st);
+
+  if(chTimeDiffX(st->sacnDiscLast, now) >= TIME_MS2I(SACN_DISCOVERY_INTERVAL_MS))
+  {
+    st->sacnDiscLast = now;
+    artnetQueueSend(st, ARTNET_SEND_SACNDISCOVERY);
+  }
+
+  for(i = 0; i < ARTNET_SACN_DISC_SOURCES; i++)
+  {
+    sacn_disc_source_t *src = &st->sacnSources[i];
+
+    if(src->valid && chTimeDiffX(src->lastSeen, now) >= TIME_MS2I(ARTNET_SACN_DISC_TIMEOUT_MS))
+    {
+      src->valid = false;
+      st->sacnGroupsDirty = true;
+    }
+  }
+
+  if(st->sacnGroupsDirty)
+  {
+    st->sacnGroupsDirty = false;
+    sacnUpdateGroups(st);
+  }
+}
+
+/**
+ * Runs the queued sends of every instance
+ * on the interface, from the stack thread
+ */
+static void artnetSendQueued(ustack_iface_t *iface)
+{
+  uint8_t i, what;
+
+  for(i = 0; i < ARTNET_INSTANCES; i++)
+  {
+    artnet_status_t *st = gArtInstances[i];
+
+    if(st == NULL || st->cfg->iface != iface)
+      continue;
+
+    chSysLock();
+    what = st->sendPending;
+    st->sendPending = 0;
+    chSysUnlock();
+
+    if(what & ARTNET_SEND_POLLREPLY)
+      artnetSendPollReply(st);
+    if(what & (ARTNET_SEND_POLLREPLY | ARTNET_SEND_TXPOOL))
+      artnetTxSend(st, iface);
+    if(what & ARTNET_SEND_POLLREPLY)
+      artnetBootMark(st, ARTNET_BOOT_POLLREPLY);
+    if(what & ARTNET_SEND_TODDATA)
+      artnetSendTodData(st, iface);
+    if(what & ARTNET_SEND_RDMREPLIES)
+      artnetSendRdmReplies(st, iface);
+    if(what & ARTNET_SEND_RDMSUBREPLIES)
+      artnetSendRdmSubReplies(st, iface);
+    if(what & ARTNET_SEND_SACNSOURCES)
+      sacnSendSources(st, iface);
+    if(what & ARTNET_SEND_SACNDISCOVERY)
+      sacnSendDiscovery(st, iface);
+  }
+}
+
+/**
+ * Deferred startup work, from the housekeeping thread
+ *
+ * LED setup and the first ArtPollReply wait until the
+ * first DMX frame is out, or ARTNET_BOOT_DEFER_MS.
+ */
+static void artnetBootService(artnet_status_t *st)
+{
+  if(st->bootReached & (1 << ARTNET_BOOT_DONE))
+    return;
+
+  if(!(st->bootReached & (1 << ARTNET_BOOT_FIRSTDMX)) &&
+     chTimeDiffX(st->boot[ARTNET_BOOT_INIT], chVTGetSystemTimeX()) < TIME_MS2I(ARTNET_BOOT_DEFER_MS))
+    return;
+
+  if(st->cfg->ledGreen.port != 0 && st->cfg->ledGreen.pad != 0)
+    palSetPadMode(st->cfg->ledGreen.port, st->cfg->ledGreen.pad, PAL_MODE_OUTPUT_PUSHPULL);
+
+  if(st->cfg->ledRed.port != 0 && st->cfg->ledRed.pad != 0)
+    palSetPadMode(st->cfg->ledRed.port, st->cfg->ledRed.pad, PAL_MODE_OUTPUT_PUSHPULL);
+
+  // An ArtAddress may have set them already
+  if(st->statusLeds == 0)
+    artnetSetLedsNormal(st);
+
+  artnetQueueSend(st, ARTNET_SEND_POLLREPLY);
+
+  artnetBootMark(st, ARTNET_BOOT_DONE);
+}
+
+/**
+ * Storage thread
+ *
+ * Flash writes and erases take long, here they
+ * can't hold up the refresh nor RDM timeouts.
+ * The housekeeping thread and the parser hand
+ * their changes over through the snapshot, and
+ * the show staging buffers and read-ahead.
+ */
+static THD_FUNCTION(StorageThread, arg)
+{
+  artnet_status_t *st = (artnet_status_t*)arg;
+  chRegSetThreadName("ArtNetStorage");
+
+  while (!chThdShouldTerminateX())
+  {
+    artnetJournalService(st);
+
+#if ARTNET_USE_SHOW
+    artnetShowStorage(st);
+
+    // Keeping up with the recorder or the player
+    if(st->show.state != ARTNET_SHOW_IDLE)
+    {
+      chThdSleepMilliseconds(1);
+      continue;
+    }
+#endif
+
+    chThdSleepMilliseconds(10);
+  }
+}
+
+/**
+ * Housekeeping thread
+ *
+ * Everything that has to run without a packet
+ * arriving (timeouts, ...) runs from here so the
+ * RX path never waits.
+ */
+static THD_FUNCTION(ServiceThread, arg)
+{
+  artnet_status_t *st = (artnet_status_t*)arg;
+  chRegSetThreadName("ArtNet Service");
+
+  while (!chThdShouldTerminateX())
+  {
+    artnetBootService(st);
+
+    if(st->cfg->rdmEnabled)
+    {
+      artnetRdmDiscService(st);
+      artnetRdmSubService(st);
+      artnetRdmService(st);
+    }
+
+    if(st->cfg->sacnEnabled)
+      sacnService(st);
+
+    artnetRefreshService(st);
+
+#if ARTNET_USE_SHOW
+    artnetShowService(st);
+#endif
+
+    chThdSleepMilliseconds(ARTNET_SERVICE_PERIOD_MS);
+  }
+}
+
+/*******************************************/
+/* PUBLIC FUNCTIONS                        */
+/*******************************************/
+
+void artnetSendFirstPollReply(ustack_iface_t *iface)
+{
+  uint8_t i;
+
+  // Every node on the interface
+  for(i = 0; i < ARTNET_INSTANCES; i++)
+  {
+    if(gArtInstances[i] != NULL && gArtInstances[i]->cfg->iface == iface)
+    {
+      artnetSendPollReply(gArtInstances[i]);
+      artnetTxSend(gArtInstances[i], iface);
+    }
+  }
+}
+
+/**
+ * RDM response from a port driver
+ *
+ * Must be called from thread context, once per request handed
+ * to rdmcb, with the response without start code. Requests with
+ * no response just time out, no need to call this.
+ * DISC_UNIQUE_BRANCH responses are passed as received, preamble
+ * included, anything not decoding is taken as a collision.
+ *
+ * uint8_t port  - the port index as given to rdmcb
+ * uint16_t len  - the response length
+ * uint8_t *data - the response
+ */
+void artnetRdmResponse(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data)
+{
+  uint8_t i;
+  bool queued = false;
+
+  // Discovery responses, unique branch ones have no
+  // header, there is only one on the wire per port
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+  {
+    artnet_rdm_trans_t *trans = &st->rdm[i];
+
+    if(trans->state != ARTNET_RDM_ACTIVE || trans->port != port || trans->owner != ARTNET_RDM_OWNER_DISC)
+      continue;
+
+    artnet_rdm_disc_t *disc = &st->rdmDisc[trans->job];
+
+    disc->resultLen = (len > ARTNET_RDM_DISC_RESULT) ? ARTNET_RDM_DISC_RESULT : len;
+    memcpy(disc->resultData, data, disc->resultLen);
+    disc->used += chTimeDiffX(trans->stamp, chVTGetSystemTimeX());
+    disc->result = true;
+    disc->waiting = false;
+    trans->state = ARTNET_RDM_FREE;
+    queued = true;
+    break;
+  }
+  chSysUnlock();
+
+  if(queued)
+    return;
+
+  if(len < RDM_OFFSET_PD || len > ARTNET_RDM_MAX_LENGTH)
+    return;
+
+  uint16_t subDevice = (data[RDM_OFFSET_SUBDEVICE] << 8) | data[RDM_OFFSET_SUBDEVICE + 1];
+  uint16_t pid = (data[RDM_OFFSET_PID] << 8) | data[RDM_OFFSET_PID + 1];
+  uint8_t pdl = data[RDM_OFFSET_PDL];
+  bool ack = data[RDM_OFFSET_PORT] == RDM_RESPONSE_ACK;
+
+  if(RDM_OFFSET_PD + pdl > len)
+    return;
+
+  // Keep static PIDs around for the next console asking
+  if(ack && data[RDM_OFFSET_CC] == RDM_CC_GET_RESPONSE)
+    artnetRdmCachePut(st, &data[RDM_OFFSET_SRC_UID], subDevice, pid, &data[RDM_OFFSET_PD], pdl);
+
+  chSysLock();
+  for(i = 0; i < ARTNET_RDM_INFLIGHT; i++)
+  {
+    artnet_rdm_trans_t *trans = &st->rdm[i];
+
+    if(trans->state != ARTNET_RDM_ACTIVE || trans->port != port)
+      continue;
+
+    if(trans->tn != data[RDM_OFFSET_TN])
+      continue;
+
+    if(trans->owner == ARTNET_RDM_OWNER_SUB)
+    {
+      artnet_rdmsub_job_t *job = &st->rdmSub[trans->job];
+
+      // One request at a time, it's the previous one
+      if(ack && data[RDM_OFFSET_CC] == RDM_CC_GET_RESPONSE)
+        job->values[job->next - 1] = pdl >= 2 ? (data[RDM_OFFSET_PD] << 8) | data[RDM_OFFSET_PD + 1] :
+                                     (pdl == 1 ? data[RDM_OFFSET_PD] : 0);
+
+      job->waiting = false;
+      trans->state = ARTNET_RDM_FREE;
+      break;
+    }
+
+    memcpy(trans->data, data, len);
+    trans->len = len;
+    trans->state = ARTNET_RDM_DONE;
+    queued = true;
+    break;
+  }
+  chSysUnlock();
+
+  if(queued)
+    artnetQueueSend(st, ARTNET_SEND_RDMREPLIES);
+}
+
+/**
+ * Generates the curve tables of the config,
+ * call it after changing cfg->curves or cfg->curveRange
+ *
+ * The only place curves are computed, the output
+ * path is table lookups. Curves are off while it runs.
+ *
+ * Returns false if a curve or range is bad, none are used then
+ */
+bool artnetCurveApply(artnet_status_t *st)
+{
+  uint32_t ports = 0;
+  uint8_t i;
+  uint16_t v;
+
+  chSysLock();
+  st->curvePorts = 0;
+  chSysUnlock();
+
+  if(st->cfg->curveCount > ARTNET_CURVES || st->cfg->curveRangeCount > ARTNET_CURVE_RANGES)
+    return false;
+
+  for(i = 0; i < st->cfg->curveCount; i++)
+  {
+    artnet_curve_t *c = &st->cfg->curves[i];
+    float g = c->gamma / 10.0f;
+
+    if(c->type > ARTNET_CURVE_GAMMA || (c->type == ARTNET_CURVE_GAMMA && c->gamma == 0))
+      return false;
+
+    for(v = 0; v < 256; v++)
+    {
+      float x = v / 255.0f;
+      float y;
+
+      switch(c->type)
+      {
+        case ARTNET_CURVE_SQUARE:
+          y = x * x;
+          break;
+        case ARTNET_CURVE_SQRT:
+          y = sqrtf(x);
+          break;
+        case ARTNET_CURVE_GAMMA:
+          y = powf(x, g);
+          break;
+        default:
+          y = x;
+          break;
+      }
+
+      st->curveLut[i][v] = (uint8_t)(y * 255.0f + 0.5f);
+#if ARTNET_USE_CURVE16
+      st->curveLut16[i][v] = (uint16_t)(y * 65535.0f + 0.5f);
+#endif
+    }
+  }
+
+  for(i = 0; i < st->cfg->curveRangeCount; i++)
+  {
+    artnet_curve_range_t *r = &st->cfg->curveRange[i];
+
+    if(r->port >= ARTNET_GROUPS * ARTNET_MAX_PORTS || r->curve >= st->cfg->curveCount ||
+       r->count == 0 || r->first + r->count > ARTNET_DMX_LENGTH)
+      return false;
+
+    ports |= (1UL << r->port);
+  }
+
+  chSysLock();
+  st->curvePorts = ports;
+  chSysUnlock();
+
+  return true;
+}
+
+/**
+ * DMA buffer size a strip needs
+ *
+ * Bits on the wire plus the WS2812 reset, or the
+ * APA102 start and end frames.
+ */
+uint32_t artnetPixelBufferSize(artnet_pixel_strip_t *strip)
+{
+  uint32_t channels = (strip->order >= ARTNET_PIXEL_RGBW) ? 4 : 3;
+
+  switch(strip->wire)
+  {
+    case ARTNET_PIXEL_SPI3:
+      return strip->pixels * channels * 3 + ARTNET_PIXEL_RESET_BYTES;
+    case ARTNET_PIXEL_PWM:
+      return strip->pixels * channels * 8 + ARTNET_PIXEL_RESET_SLOTS;
+    case ARTNET_PIXEL_APA102:
+      return 4 + strip->pixels * 4 + (strip->pixels + 15) / 16;
+  }
+
+  return 0;
+}
+
+/**
+ * Compiles the pixel mapping of the config,
+ * call it after changing cfg->pixel
+ *
+ * Works out the universes of each strip and fills the
+ * parts of its buffer that never change, the strips are
+ * off while it runs.
+ *
+ * Returns false if a strip is bad, none are mapped then
+ */
+bool artnetPixelApply(artnet_status_t *st)
+{
+  uint8_t i, k;
+  uint32_t n;
+
+  chSysLock();
+  st->pixelActive = 0;
+  chSysUnlock();
+
+  if(st->cfg->pixelCount > ARTNET_PIXEL_STRIPS)
+    return false;
+
+  for(i = 0; i < st->cfg->pixelCount; i++)
+  {
+    artnet_pixel_strip_t *strip = &st->cfg->pixel[i];
+    artnet_pixel_map_t *map = &st->pixelMap[i];
+    uint32_t size = artnetPixelBufferSize(strip);
+
+    if(strip->order > ARTNET_PIXEL_GRBW || strip->wire > ARTNET_PIXEL_APA102 ||
+       strip->pixels == 0 || strip->buf == NULL || strip->size < size ||
+       strip->portAddress > 0x7fff || strip->start >= ARTNET_DMX_LENGTH)
+      return false;
+
+    map->channels = (strip->order >= ARTNET_PIXEL_RGBW) ? 4 : 3;
+    map->first = (ARTNET_DMX_LENGTH - strip->start) / map->channels;
+    map->per = ARTNET_DMX_LENGTH / map->channels;
+
+    if(map->first == 0 || (strip->wire == ARTNET_PIXEL_APA102 && map->channels != 3))
+      return false;
+
+    map->lastAddress = strip->portAddress;
+    if(strip->pixels > map->first)
+      map->lastAddress += (strip->pixels - map->first + map->per - 1) / map->per;
+
+    if(map->lastAddress > 0x7fff)
+      return false;
+
+    // Black until the first frame, then the reset or end frame
+    memset(strip->buf, 0, size);
+
+    switch(strip->wire)
+    {
+      case ARTNET_PIXEL_SPI3:
+        map->stride = map->channels * 3;
+        map->offset = 0;
+
+        for(n = 0; n < (uint32_t)strip->pixels * map->channels; n++)
+        {
+          strip->buf[n * 3] = gPixelSpi3[0] >> 16;
+          strip->buf[n * 3 + 1] = gPixelSpi3[0] >> 8;
+          strip->buf[n * 3 + 2] = gPixelSpi3[0];
+        }
+        break;
+
+      case ARTNET_PIXEL_PWM:
+        map->stride = map->channels * 8;
+        map->offset = 0;
+
+        // First bit in the first byte
+        for(k = 0; k < 16; k++)
+        {
+          uint8_t *b = (uint8_t*)&map->pwm[k];
+          uint8_t bit;
+
+          for(bit = 0; bit < 4; bit++)
+            b[bit] = (k & (0x08 >> bit)) ? strip->pwm1 : strip->pwm0;
+        }
+
+        memset(strip->buf, strip->pwm0, (uint32_t)strip->pixels * map->stride);
+        break;
+
+      case ARTNET_PIXEL_APA102:
+        map->stride = 4;
+        map->offset = 4;
+
+        for(n = 0; n < strip->pixels; n++)
+          strip->buf[4 + n * 4] = 0xe0 | (strip->brightness & 0x1f);
+
+        memset(&strip->buf[4 + strip->pixels * 4], 0xff, (strip->pixels + 15) / 16);
+        break;
+    }
+  }
+
+  chSysLock();
+  st->pixelActive = st->cfg->pixelCount;
+  chSysUnlock();
+
+  return true;
+}
+
+/**
+ * Compiles the soft patch of the config,
+ * call it after changing cfg->patch
+ *
+ * Entries are sorted by Port-Address, output port and
+ * source slot, then the ones continuing each other in
+ * source and destination merged, so a received universe
+ * is patched with a few block copies. A slot patched
+ * twice gets either of them.
+ *
+ * Built aside and swapped in, the one in use is kept
+ * if the patch is bad.
+ *
+ * Returns false if an entry is out of range
+ */
+bool artnetPatchApply(artnet_status_t *st)
+{
+  artnet_patch_table_t *tbl = &st->patch[st->patchActive ^ 1];
+  uint8_t i, k, n = 0;
+
+  if(st->cfg->patchCount > ARTNET_PATCH_ENTRIES)
+    return false;
+
+  memset(tbl, 0, sizeof(artnet_patch_table_t));
+
+  for(i = 0; i < st->cfg->patchCount; i++)
+  {
+    artnet_patch_t *e = &st->cfg->patch[i];
+    artnet_group_t *grp;
+
+    if(e->port >= ARTNET_GROUPS * ARTNET_MAX_PORTS)
+      return false;
+
+    grp = &st->cfg->groups[e->port / ARTNET_MAX_PORTS];
+
+    if((e->port % ARTNET_MAX_PORTS) >= grp->ports ||
+       !(grp->portType[e->port % ARTNET_MAX_PORTS] & ARTNET_TYPE_OUTPUT))
+      return false;
+
+    if(e->count == 0 ||
+       e->portAddress > 0x7fff ||
+       e->srcSlot + e->count > ARTNET_DMX_LENGTH ||
+       e->dstSlot + e->count > ARTNET_DMX_LENGTH)
+      return false;
+
+    // Insertion sort
+    for(k = n; k > 0; k--)
+    {
+      artnet_patch_span_t *p = &tbl->span[k - 1];
+
+      if(p->portAddress < e->portAddress ||
+         (p->portAddress == e->portAddress && p->port < e->port) ||
+         (p->portAddress == e->portAddress && p->port == e->port && p->src <= e->srcSlot))
+        break;
+
+      tbl->span[k] = *p;
+    }
+
+    tbl->span[k].portAddress = e->portAddress;
+    tbl->span[k].port = e->port;
+    tbl->span[k].src = e->srcSlot;
+    tbl->span[k].dst = e->dstSlot;
+    tbl->span[k].len = e->count;
+    n++;
+
+    if(e->dstSlot + e->count > tbl->length[e->port])
+      tbl->length[e->port] = e->dstSlot + e->count;
+  }
+
+  // Merge the contiguous ones
+  for(i = 0, k = 0; i < n; i++)
+  {
+    artnet_patch_span_t *c = &tbl->span[i];
+    artnet_patch_span_t *p = (k > 0) ? &tbl->span[k - 1] : NULL;
+
+    if(p != NULL &&
+       p->portAddress == c->portAddress &&
+       p->port == c->port &&
+       p->src + p->len == c->src &&
+       p->dst + p->len == c->dst)
+    {
+      p->len += c->len;
+      continue;
+    }
+
+    tbl->span[k++] = *c;
+  }
+
+  tbl->spanCount = k;
+
+  // Sorted, the first span of a port has its lowest universe
+  for(i = k; i > 0; i--)
+    tbl->primary[tbl->span[i - 1].port] = tbl->span[i - 1].portAddress;
+
+  // Ports patched or unpatched get their data elsewhere now
+  for(i = 0; i < ARTNET_GROUPS * ARTNET_MAX_PORTS; i++)
+    if((tbl->length[i] != 0) != (st->patch[st->patchActive].length[i] != 0))
+      artnetPortRelease(st, i);
+
+  chSysLock();
+  st->patchActive ^= 1;
+  chSysUnlock();
+
+  dbgf(":: ARTNET :: Soft patch, %d entries in %d spans\r\n", n, k);
+
+  return true;
+}
+
+/**
+ * Consistent copy of the node status and routing
+ *
+ * Never blocks the packet thread, retries if it
+ * published while we were copying. Thread context
+ * only, it sleeps a tick while a publish is open.
+ *
+ * artnet_snapshot_t *snap - where to copy it
+ */
+void artnetGetSnapshot(artnet_status_t *st, artnet_snapshot_t *snap)
+{
+  uint32_t seq;
+
+  do
+  {
+    // Publishing, let the writer finish even if it is
+    // below us, a yield alone only helps equal priorities
+    while((seq = st->snapSeq) & 1)
+      chThdSleep(1);
+
+    __sync_synchronize();
+    memcpy(snap, &st->snap, sizeof(artnet_snapshot_t));
+    __sync_synchronize();
+  } while(seq != st->snapSeq);
+}
+
+/**
+ * ArtFirmwareMaster upload progress
+ *
+ * uint32_t *written - bytes in flash, can be NULL
+ * uint32_t *size    - image length, can be NULL
+ *
+ * Returns artnet_firmware_state_en
+ */
+uint8_t artnetFirmwareState(artnet_status_t *st, uint32_t *written, uint32_t *size)
+{
+  if(written != NULL)
+    *written = st->firmware.written;
+  if(size != NULL)
+    *size = st->firmware.size;
+
+  return st->firmware.state;
+}
+
+/**
+ * Startup timeline
+ *
+ * uint32_t *us - ARTNET_BOOT_MILESTONES entries, us from
+ *                artnetInit to each milestone, 0xffffffff
+ *                for the ones not reached
+ */
+void artnetGetBootTimeline(artnet_status_t *st, uint32_t *us)
+{
+  uint8_t i;
+
+  for(i = 0; i < ARTNET_BOOT_MILESTONES; i++)
+  {
+    if(st->bootReached & (1 << i))
+      us[i] = TIME_I2US(chTimeDiffX(st->boot[ARTNET_BOOT_INIT], st->boot[i]));
+    else
+      us[i] = 0xffffffff;
+  }
+}
+
+/**
+ * Starts a node instance
+ *
+ * Each instance has its own status and config, bound
+ * to its interface and ports. Up to ARTNET_INSTANCES,
+ * with the same ports on different interfaces or
+ * different ports on the same one.
+ *
+ * artnet_status_t *st  - the instance status, zeroed
+ * artnet_config_t *cfg - its config
+ */
+void artnetInit(artnet_status_t *st, artnet_config_t *cfg)
+{
+  uint8_t i;
+
+  if(st == NULL || cfg == NULL)
+    return;
+
+  for(i = 0; i < ARTNET_INSTANCES; i++)
+    if(gArtInstances[i] == NULL || gArtInstances[i] == st)
+      break;
+
+  if(i == ARTNET_INSTANCES)
+  {
+    dbg("\r\n:: ARTNET :: No room for another instance");
+    return;
+  }
+
+  st->cfg = cfg;
+  st->bootReached = 0;
+  artnetBootMark(st, ARTNET_BOOT_INIT);
+
+  dbg("\r\n:: Starting ArtNet and sACN listening");
+
+  // Last config, before anything uses it
+  if(cfg->flash != NULL && artnetJournalLoad(st))
+    dbg("\r\n:: ARTNET :: Config loaded from journal");
+
+  // Only what DMX needs before binding, LEDs and
+  // the first ArtPollReply wait, see artnetBootService()
+  st->pollCount = 0;
+  artnetSourcesReset(st);
+  st->reportCode = ARTNET_RCPOWEROK;
+
+  // Output refresh buffers
+  {
+    uint8_t k;
+
+    for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+    {
+      st->output[k].dmx.write = 0;
+      st->output[k].dmx.pending = 1;
+      st->output[k].dmx.front = 2;
+      st->output[k].nzs.write = 0;
+      st->output[k].nzs.pending = 1;
+      st->output[k].nzs.front = 2;
+    }
+  }
+
+#if ARTNET_USE_CAPTURE
+  artnetCaptureArm(st, ARTNET_CAPTURE_TRIG_MANUAL);
+#endif
+
+#if ARTNET_USE_SHOW
+  st->show.state = ARTNET_SHOW_IDLE;
+  st->show.pending = 0xff;
+  st->lastOutput = chVTGetSystemTimeX();
+#endif
+
+  if(!artnetPatchApply(st))
+    dbg("\r\n:: ARTNET :: Bad soft patch, ignored");
+
+  if(!artnetCurveApply(st))
+    dbg("\r\n:: ARTNET :: Bad output curves, ignored");
+
+  if(!artnetPixelApply(st))
+    dbg("\r\n:: ARTNET :: Bad pixel mapping, ignored");
+
+  // Bridge sACN headers, only universe and sequence change
+  {
+    e131_packet_t hdr;
+
+    sacnBuildData(st, &hdr, 1);
+    memcpy(st->bridgeHdr, hdr.raw, SACN_HEADER_LENGTH);
+  }
+
+  artnetPublish(st);
+
+  // Visible to the parsers and queued sends from now on
+  gArtInstances[i] = st;
+
+  // Artnet
+  dbgf(":: ARTNET :: Binding Artnet to Port: %d\r\n", st->cfg->port);
+  if(!artnetPortShared(st, st->cfg->port))
+    ustackUdpAddListener(st->cfg->port, artnetParser);
+
+  if(st->cfg->sacnEnabled)
+  {
+    // sACN
+    dbgf(":: ARTNET :: Binding sACN to Port: %d\r\n", st->cfg->sacnPort);
+    if(!artnetPortShared(st, st->cfg->sacnPort))
+      ustackUdpAddListener(st->cfg->sacnPort, sacnParser);
+    st->sacnGroupsDirty = true;
+  }
+
+  artnetBootMark(st, ARTNET_BOOT_BOUND);
+
+  // Power on discovery, the service thread runs it in the background
+  if(st->cfg->rdmEnabled)
+  {
+    uint8_t k;
+
+    for(k = 0; k < ARTNET_GROUPS * ARTNET_MAX_PORTS; k++)
+      artnetRdmDiscStart(st, k);
+  }
+
+  if(st->cfg->firmwareBank != NULL && st->firmwareThread == NULL)
+    st->firmwareThread = chThdCreateFromHeap(NULL,
+                                             THD_WORKING_AREA_SIZE(512),
+                                             "ArtNetFirmware",
+                                             NORMALPRIO - 1,
+                                             FirmwareThread, st);
+
+  if((st->cfg->flash != NULL || st->cfg->showIo != NULL) && st->storageThread == NULL)
+    st->storageThread = chThdCreateFromHeap(NULL,
+                                            THD_WORKING_AREA_SIZE(1024),
+                                            "ArtNetStorage",
+                                            NORMALPRIO - 1,
+                                            StorageThread, st);
+
+  if(st->serviceThread == NULL)
+    st->serviceThread = chThdCreateFromHeap(NULL,
+                                            THD_WORKING_AREA_SIZE(512),
+                                            "ArtNetService",
+                                            NORMALPRIO,
+                                            ServiceThread, st);
+}
+
+/**
+ * Parses the artnet opcode, and calls it's respective
+ * function.
+ *
+ * uint16_t length - the packet length
+ * uint8_t data    - the packet data
+ */
+void artnetParser(ustack_iface_t *iface, uint16_t len)
+{
+  // First thing, timecode wants it as close to the wire as we can
+  systime_t rx = chVTGetSystemTimeX();
+
+  udp_t *udp = (udp_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t));
+  artnet_status_t *st = artnetFindInstance(iface, ntohs(udp->dstPort), false);
+
+  if(st == NULL)
+    return;
+
+#if ARTNET_USE_CAPTURE
+  artnetCapture(st, iface, len, rx);
+#endif
+
+  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+
+  uint16_t proto = ((artnet->header.prot_ver_hi << 8) & 0xff) |
+      (artnet->header.prot_ver_low & 0xff);
+  
+  // Anything below protocol version 14 should be ignored
+  if(proto < ARTNET_VERSION)
+    return;
+  
+  switch(artnet->header.opCode)
+  {
+    case ARTNET_OPCODE_POLL:
+      artnetSendPollReply(st);
+      break;
+    case ARTNET_OPCODE_SYNC:
+      artnetHandleSync(artnet);
+      break;
+    case ARTNET_OPCODE_IPPROG:
+      artnetHandleIPProg(st, artnet);
+      break;
+    case ARTNET_OPCODE_ADDRESS:
+      artnetHandleAddress(st, artnet);
+      break;
+    case ARTNET_OPCODE_DMX:
+      artnetHandleDmx(st, artnet, len);
+      artnetBridgeDmx(st, artnet, len);  // Last, it rewrites the packet
+      break;
+    case ARTNET_OPCODE_NZS:
+      artnetHandleNzs(st, artnet, len);
+      break;
+    case ARTNET_OPCODE_TIMECODE:
+      artnetHandleTimeCode(st, artnet, len, rx);
+      break;
+    case ARTNET_OPCODE_TRIGGER:
+      artnetHandleTrigger(st, artnet, len, rx);
+      break;
+    case ARTNET_OPCODE_FIRMWAREMASTER:
+      artnetHandleFirmware(st, artnet, len);
+      break;
+    case ARTNET_OPCODE_TODREQUEST:
+      artnetHandleToDRequest(st, artnet);
+      break;
+    case ARTNET_OPCODE_TODCONTROL:
+      artnetHandleToDControl(st, artnet);
+      break;
+    case ARTNET_OPCODE_RDM:
+      artnetHandleRdm(st, artnet, len);
+      break;
+    case ARTNET_OPCODE_RDMSUB:
+      artnetHandleRdmSub(st, artnet, len);
+      break;
+  };
+}
+
+/**
+ * Is any sACN source listing this universe
+ * in its universe discovery ?
+ *
+ * uint16_t universe - the sACN universe
+ */
+bool sacnIsUniverseSent(artnet_status_t *st, uint16_t universe)
+{
+  uint8_t i;
+  uint16_t j;
+
+  for(i = 0; i < ARTNET_SACN_DISC_SOURCES; i++)
+  {
+    sacn_disc_source_t *src = &st->sacnSources[i];
+
+    if(!src->valid)
+      continue;
+
+    for(j = 0; j < src->count; j++)
+      if(src->universes[j] == universe)
+        return true;
+  }
+
+  return false;
+}
+
+/**
+ * Received stream quality of a universe
+ *
+ * uint8_t idx - 0 to ARTNET_STATS_STREAMS - 1, the universe
+ *               and protocol are in the entry
+ *
+ * Returns false if the entry is not in use
+ */
+bool artnetGetStreamStats(artnet_status_t *st, uint8_t idx, artnet_stream_stats_t *stats)
+{
+  if(idx >= ARTNET_STATS_STREAMS)
+    return false;
+
+  memcpy(stats, &st->stats[idx], sizeof(artnet_stream_stats_t));
+  return stats->started;
+}
+
+/**
+ * Clears the stream quality of a universe
+ *
+ * uint8_t idx - the entry, 0xff for all
+ */
+void artnetResetStreamStats(artnet_status_t *st, uint8_t idx)
+{
+  if(idx == 0xff)
+    memset(st->stats, 0, sizeof(st->stats));
+  else if(idx < ARTNET_STATS_STREAMS)
+    memset(&st->stats[idx], 0, sizeof(artnet_stream_stats_t));
+}
+
+static uint8_t *artnetPut16(uint8_t *p, uint16_t v)
+{
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+
+static uint8_t *artnetPut32(uint8_t *p, uint32_t v)
+{
+  p = artnetPut16(p, v >> 16);
+  return artnetPut16(p, v);
+}
+
+/**
+ * Binary dump of the stream quality of all universes
+ *
+ * Big endian, to be collected from many nodes:
+ *   'A' 'S' version(1) streams(1) bins(1) binUs(2)
+ * then for each universe with frames:
+ *   flags(1, bit 0 sACN) universe(2) frames(4) lost(4)
+ *   reordered(4) avgUs(4) jitterUs(4) bins(4 each)
+ *
+ * uint8_t *buf  - where to write it
+ * uint16_t size - its size
+ *
+ * returns the length written, 0 if it doesn't fit
+ */
+uint16_t artnetStreamStatsDump(artnet_status_t *st, uint8_t *buf, uint16_t size)
+{
+  uint8_t *p = buf;
+  uint8_t i, k, streams = 0;
+
+  for(i = 0; i < ARTNET_STATS_STREAMS; i++)
+    if(st->stats[i].started)
+      streams++;
+
+  if(size < 7 + streams * (23 + ARTNET_STATS_BINS * 4))
+    return 0;
+
+  *p++ = 'A';
+  *p++ = 'S';
+  *p++ = 2;
+  *p++ = streams;
+  *p++ = ARTNET_STATS_BINS;
+  p = artnetPut16(p, ARTNET_STATS_BIN_US);
+
+  for(i = 0; i < ARTNET_STATS_STREAMS; i++)
+  {
+    artnet_stream_stats_t *stats = &st->stats[i];
+
+    if(!stats->started)
+      continue;
+
+    *p++ = stats->sacn ? 0x01 : 0x00;
+    p = artnetPut16(p, stats->universe);
+    p = artnetPut32(p, stats->frames);
+    p = artnetPut32(p, stats->lost);
+    p = artnetPut32(p, stats->reordered);
+    p = artnetPut32(p, stats->avgUs);
+    p = artnetPut32(p, stats->jitterUs);
+
+    for(k = 0; k < ARTNET_STATS_BINS; k++)
+      p = artnetPut32(p, stats->bins[k]);
+  }
+
+  return p - buf;
+}
+
+/**
+ * ArtDmx source entry
+ *
+ * The rate is 0 once the source is silent for two seconds.
+ *
+ * uint8_t idx - 0 to ARTNET_SOURCES - 1
+ */
+bool artnetGetSource(artnet_status_t *st, uint8_t idx, artnet_source_t *src)
+{
+  if(idx >= ARTNET_SOURCES || !st->sources[idx].valid)
+    return false;
+
+  memcpy(src, &st->sources[idx], sizeof(artnet_source_t));
+
+  if(chTimeDiffX(src->lastSeen, chVTGetSystemTimeX()) > TIME_MS2I(2000))
+    src->rate = 0;
+
+  return src->valid;
+}
+
+/**
+ * Sets the DMX output callback of a group
  *
- * A DMX input that fails will not continue to transmit ArtDmx data.
+ * uint8_t grp             - the group, up to ARTNET_GROUPS
+ * groupDmxCallback_t cb   - the callback, NULL to stop output
+ */
+void artnetSetGroupDmxCallback(artnet_status_t *st, uint8_t grp, groupDmxCallback_t cb)
+{
+  if(grp >= ARTNET_GROUPS)
+    return;
+
+  st->cfg->groups[grp].dmxcb = cb;
+}
+
+/**
+ * Sets the RDM callback of a group
  *
- * Unicast Subscription:
- * ---------------------
+ * uint8_t grp             - the group, up to ARTNET_GROUPS
+ * groupRdmCallback_t cb   - the callback, NULL to disable RDM
+ */
+void artnetSetGroupRdmCallback(artnet_status_t *st, uint8_t grp, groupRdmCallback_t cb)
+{
+  if(grp >= ARTNET_GROUPS)
+    return;
+
+  st->cfg->groups[grp].rdmcb = cb;
+}
+
+/**
+ * Source owning an output port
  *
- * ArtDmx packets must be unicast to subscribers of the specific universe contained in
- * the ArtDmx packet. 
- * The transmitting device must regularly ArtPoll the network to detect any change in 
- * devices which are subscribed. Nodes that are subscribed will list the subscription 
- * universe in the ArtPollReply. 
- * Subscribed means any universes listed in either the Swin orSwout array.
- * If there are no subscribers to a universe that the transmitter wishes to send, then the 
- * ArtDmx must not be broadcast.
- * If the number of universe subscribers exceeds 40 for a given universe, the transmitting 
- * device may broadcast.
+ * uint8_t port - the port index, see ARTNET_PORT_INDEX
  *
- * Refresh Rate:
- * -------------
- * The ArtDmx packet is intended to transfer DMX512 data. For this reason, the ArtDmx 
- * packet for a specific IP Address should not be transmitted at a repeat rate faster 
- * than the maximum repeat rate of a DMX packet containing 512 data slots.
+ * returns the source entry, see artnetGetSource(), -1 for none
+ */
+int8_t artnetGetPortOwner(artnet_status_t *st, uint8_t port)
+{
+  if(port >= ARTNET_GROUPS * ARTNET_MAX_PORTS || st->portOwner[port] == 0xff)
+    return -1;
+
+  return st->portOwner[port];
+}
+
+/**
+ * Copies an entry of the sACN source table
  *
- * Synchronous Data:
- * -----------------
- * In video or media-wall applications, the ability to synchronise multiple universes of 
- * ArtDmx is beneficial. This can be achieved with the ArtSync packet.
+ * uint8_t idx              - the entry, up to ARTNET_SACN_DISC_SOURCES
+ * sacn_disc_source_t *src  - where it's copied
  *
- * Data Merging:
- * -------------
- * The Art-Net protocol allows multiple nodes or controllers to transmit ArtDmx data to the 
- * same universe.
- * A node can detect this situation by comparing the IP addresses of received ArtDmx 
- * packets. If ArtDmx packets addressed to the same Universe are received from different IP
- * addresses, a potential conflict exists.
+ * Returns false if the entry is not in use
+ */
+bool sacnGetSource(artnet_status_t *st, uint8_t idx, sacn_disc_source_t *src)
+{
+  if(idx >= ARTNET_SACN_DISC_SOURCES || !st->sacnSources[idx].valid)
+    return false;
+
+  memcpy(src, &st->sacnSources[idx], sizeof(sacn_disc_source_t));
+  return src->valid;
+}
+
+/**
+ * Starts an sACN stream from an input port
  *
- * The Node can legitimately handle this situation using one of two methods:
- *   - Consider this to be an error condition and await user intervention.
- *   - Automatically merge the data.
+ * Builds the packet headers once, the universe comes from
+ * the port input switch. Data is sent as it's updated with
+ * sacnSourceUpdate(st), and every ARTNET_SACN_KEEPALIVE_MS
+ * when it doesn't change.
  *
- * Nodes should document the approach that is implemented in the product user guide.
- * The Merge option is preferred as it provides a higher level of functionality.
- * Merge is implemented in either LTP or HTP mode as specified by the ArtAddress packet.
+ * uint8_t port     - the port index, see ARTNET_PORT_INDEX
+ * uint8_t priority - stream priority, 0 to 200
+ */
+bool sacnSourceStart(artnet_status_t *st, uint8_t port, uint8_t priority)
+{
+  artnet_group_t *grp;
+  sacn_source_t *src;
+  uint8_t j = port % ARTNET_MAX_PORTS;
+
+  if(port >= ARTNET_GROUPS * ARTNET_MAX_PORTS)
+    return false;
+
+  grp = &st->cfg->groups[port / ARTNET_MAX_PORTS];
+  src = &st->sacnTx[port];
+
+  if(j >= grp->ports || !(grp->portType[j] & ARTNET_TYPE_INPUT))
+    return false;
+
+  chSysLock();
+  src->active = false;
+  chSysUnlock();
+
+  sacnBuildData(st, &src->pkt, sacnPortInUniverse(grp, j));
+  sacnSourceSetSlots(src, ARTNET_DMX_LENGTH);
+
+  src->priority = (priority > 200) ? 200 : priority;
+  src->terminate = 0;
+  src->pending = false;
+  src->lastTx = chVTGetSystemTimeX();
+
+  chSysLock();
+  src->active = true;
+  chSysUnlock();
+
+  return true;
+}
+
+/**
+ * New data for an sACN stream
  *
- * Merge mode is implemented as follows:
+ * Only marks the stream for sending when the data changed,
+ * the latest data wins if updated faster than it's sent.
  *
- *   - If ArtDmx is received from differing IP addresses, the data is merged to the DMX 
- *     output. In this situation, ArtPollReply-GoodOutput-Bit3 is set. 
- *     If Art-Poll-TalkToMe Bit 1 is set, an ArtPollReply should be transmitted when merging 
- *     commences.
+ * uint8_t port  - the port index
+ * uint16_t len  - how many slots
+ * uint8_t *data - the slots, no start code
+ */
+void sacnSourceUpdate(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data)
+{
+  sacn_source_t *src;
+
+  if(port >= ARTNET_GROUPS * ARTNET_MAX_PORTS || len > ARTNET_DMX_LENGTH)
+    return;
+
+  src = &st->sacnTx[port];
+
+  if(!src->active || src->terminate > 0)
+    return;
+
+  chSysLock();
+  if(ntohs(src->pkt.dmp.prop_val_cnt) != len + 1)
+  {
+    sacnSourceSetSlots(src, len);
+    src->pending = true;
+  }
+
+  if(memcmp(&src->pkt.dmp.prop_val[1], data, len) != 0)
+  {
+    memcpy(&src->pkt.dmp.prop_val[1], data, len);
+    src->pending = true;
+  }
+  chSysUnlock();
+}
+
+/**
+ * Changes the priority of an sACN stream
+ */
+void sacnSourceSetPriority(artnet_status_t *st, uint8_t port, uint8_t priority)
+{
+  if(port >= ARTNET_GROUPS * ARTNET_MAX_PORTS)
+    return;
+
+  st->sacnTx[port].priority = (priority > 200) ? 200 : priority;
+  st->sacnTx[port].pending = true;
+}
+
+/**
+ * Stops an sACN stream
  *
- * Exit from Merge mode is handled as follows:
+ * Receivers are told with three stream terminated
+ * packets, as the spec asks, before it goes quiet.
+ */
+void sacnSourceStop(artnet_status_t *st, uint8_t port)
+{
+  if(port >= ARTNET_GROUPS * ARTNET_MAX_PORTS)
+    return;
+
+  if(st->sacnTx[port].active)
+    st->sacnTx[port].terminate = 3;
+}
+
+#if ARTNET_USE_BENCHMARK
+/**
+ * Bridge conversion throughput
  *
- * If ArtAddress AcCancelMerge is received, the Next ArtDmx message received ends Merge mode. 
- * The Node then discards any ArtDmx packets received from an IP address that does not match 
- * the IP address of the ArtDmx packet that terminated Merge mode.
- * If either (but not both) sources of ArtDmx stop, the failed source is held in the 
- * merge buffer for 10 seconds. If, during the 10 second timeout, the failed source 
- * returns, Merge mode continues. If the failed source does not recover, at the end 
- * of the timeout period, the Node exits Merge mode.
- * If both sources of ArtDmx fail, the output holds the last merge result.
- * Merging is limited to two sources, any additional sources will be ignored by the Node.
- * The Merge implementation allows for the following two key modes of operation.
+ * Converts a full universe ArtDmx to sACN and back, in place
+ * as the bridge does, frames times. Run enough frames for the
+ * system tick to measure it.
  *
- *   - Combined Control: Two Controllers (Consoles) can operate on a network and 
- *     merge data to multiple Nodes.
- *   - Backup: One Controller (Console) can monitor the network for a failure of the 
- *     primary Controller. If a failure occurs, it can use the ArtAddress AcCancelMerge 
- *     command to take instant control of the network. 
+ * uint32_t frames - how many round trips
  *
- * When a node provides multiple DMX512 inputs, it is the responsibility of the Node to 
- * handle merging of data. This is because the Node will have only one IP address. If this 
- * were not handled at the Node, ArtDmx packets with identical IP addresses and identical 
- * universe numbers, but conflicting level data would be transmitted to the network.
- * 
+ * Returns universes converted per second
  */
-static void artnetHandleDmx(artnet_packet_u *artnet)
+uint32_t artnetBridgeBenchmark(artnet_status_t *st, uint32_t frames)
 {
-  uint8_t i = 0, j = 0;
+  static uint8_t payload[sizeof(e131_packet_t)];
+  artnet_packet_u *artnet = (artnet_packet_u*)payload;
+  uint32_t i;
+  uint16_t k;
 
-  // What port are we working on ?
-  for(i = 0; i < ARTNET_GROUPS; i++)
+  memset(payload, 0, sizeof(payload));
+  artnet->dmx.length = htons(ARTNET_DMX_LENGTH);
+  for(k = 0; k < ARTNET_DMX_LENGTH; k++)
+    artnet->dmx.data[k] = k & 0xff;
+
+  systime_t start = chVTGetSystemTimeX();
+
+  for(i = 0; i < frames; i++)
   {
-    artnet_group_t *grp = &gArtStatus.cfg->groups[i];
-    if(grp == NULL) return;
+    artnetBridgeToSacn(st, payload, 1, i & 0xff);
+    artnetBridgeToArtnet(payload, 0, i & 0xff);
+  }
 
-    if(grp->net != (artnet->dmx.net & 0x7f)) continue;
-    if(grp->subnet != (artnet->dmx.sub_uni >> 4)) continue;
-    
-    for(j = 0; j < grp->ports; j++)
-    {
-      // Is this an output ?
-      if(!(grp->portType[j] & (ARTNET_TYPE_OUTPUT & ARTNET_TYPE_DMX512)))
-        continue;
+  uint32_t us = TIME_I2US(chTimeDiffX(start, chVTGetSystemTimeX()));
 
-      // Is it for us ?
-      if(grp->swout[j] != (artnet->dmx.sub_uni & 0x0f))
-        continue;
+  if(us == 0)
+    return 0;
+
+  return (uint32_t)(((uint64_t)frames * 2 * 1000000) / us);
+}
 
-      // Should we handle seq field ? and ignore 'past' packets ??
+// Instance being loaded, dmxcb doesn't tell, one run at a time
+static artnet_status_t *gLoadInstance;
 
-      systime_t curr = chVTGetSystemTimeX();
-      ipv4_t *ipv4 = (ipv4_t*)(gArtStatus.cfg->iface->buffer + sizeof(eth_frame_t));
-      
-      // From who is this ?
-      if(gArtStatus.lastIpSrc != 0)
-      {
-        if((TIME_I2MS(gArtStatus.lastDmxPacket) + 2000) < curr) 
-          if(ipv4->srcIp != gArtStatus.lastIpSrc) return;
-      }
+/**
+ * Load generator dmxcb, measures and calls the real one
+ *
+ * Only the first delivery of an injected frame counts, the
+ * refresh repeating it is neither a delivery nor latency.
+ */
+static void artnetLoadDmx(uint8_t port, uint16_t len, uint8_t *data)
+{
+  artnet_status_t *st = gLoadInstance;
+  groupDmxCallback_t cb = st->loadDmxcb[port / ARTNET_MAX_PORTS];
 
-      gArtStatus.lastIpSrc = ipv4->srcIp;
-      gArtStatus.lastDmxPacket = curr;
+  if(st->loadPending[port])
+  {
+    uint32_t us = TIME_I2US(chTimeDiffX(st->loadInject[port], chVTGetSystemTimeX()));
+    uint32_t b = us / ARTNET_LOAD_BUCKET_US;
 
-      if(grp->dmxcb != NULL)
-        grp->dmxcb(i + j, ntohs(artnet->dmx.length), artnet->dmx.data);
-    }
+    st->loadPending[port] = false;
+    st->loadHist[(b < ARTNET_LOAD_BUCKETS) ? b : ARTNET_LOAD_BUCKETS - 1]++;
+    st->loadDelivered++;
+    if(us > st->loadMaxUs)
+      st->loadMaxUs = us;
   }
+
+  if(cb != NULL)
+    cb(port, len, data);
 }
 
 /**
- * ArtTodData
+ * Latency percentile from the histogram
  *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No Action.
- *                  | Unicast Transmit      | Not allowed
- *                  | Broadcast             | Not allowed
- * --------------------------------------------------------------------------------------
- * Node output      | Receive               | No Action.
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Output Gateway always Directed Broadcasts this packet.
- * --------------------------------------------------------------------------------------
- * Node input       | Receive               | No Action.
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | No Action.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
+ * uint32_t total - samples in it
+ * uint32_t per   - per thousand
+ */
+static uint32_t artnetLoadPercentile(artnet_status_t *st, uint32_t total, uint32_t per)
+{
+  uint64_t want = ((uint64_t)total * per + 999) / 1000;
+  uint64_t sum = 0;
+  uint16_t b;
+
+  for(b = 0; b < ARTNET_LOAD_BUCKETS; b++)
+  {
+    sum += st->loadHist[b];
+    if(sum >= want)
+      return (b + 1) * ARTNET_LOAD_BUCKET_US;
+  }
+
+  return ARTNET_LOAD_BUCKETS * ARTNET_LOAD_BUCKET_US;
+}
+
+/**
+ * Port the load generator expects a frame on
+ *
+ * uint16_t portAddress - the Port-Address
+ * bool sacn            - sent as sACN ?
  *
+ * Returns the port index, or 0xff if none
  */
-/*
-static void artnetSendTodData(void)
+static uint8_t artnetLoadPort(artnet_status_t *st, uint16_t portAddress, bool sacn)
 {
+  uint8_t i, j;
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    artnet_group_t *grp = &st->cfg->groups[i];
+
+    for(j = 0; j < grp->ports; j++)
+    {
+      if(sacn)
+      {
+        if((grp->portType[j] & ARTNET_TYPE_OUTPUT) && (grp->outputStatus[j] & ARTNET_OUTPUT_SACN) &&
+           sacnPortUniverse(grp, j) == portAddress + 1 && !artnetIsPatched(st, ARTNET_PORT_INDEX(i, j)))
+          return ARTNET_PORT_INDEX(i, j);
+      }
+      else if(artnetIsOutputPort(grp, j, portAddress >> 8, portAddress & 0xff) &&
+              !artnetIsPatched(st, ARTNET_PORT_INDEX(i, j)))
+        return ARTNET_PORT_INDEX(i, j);
+    }
+  }
+
+  return 0xff;
 }
-*/
 
 /**
- * ArtTodRequest
+ * Closed loop load generator
  *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No Action.
- *                  | Unicast Transmit      | No allowed
- *                  | Broadcast             | Controller directed broadcast to all nodes.
- * --------------------------------------------------------------------------------------
- * Node output      | Receive               | Reply with ArtTodData
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Node input       | Receive               | No Action.
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Input Gateway Directed Broadcasts to all nodes.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | No Action.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
+ * Builds the packets in the interface buffer and feeds them
+ * to artnetParser()/sacnParser() paced at the given rate,
+ * measuring how long frames take to reach dmxcb, through
+ * the refresh when the port has one. Run it with the stack
+ * thread stopped, the host build or the link down, it owns
+ * the interface buffer while running. Poll replies are
+ * sent from here, right after each ArtPoll.
  *
- * This packet is used to request the Table of RDM Devices (TOD). A Node receiving this 
- * packet must not interpret it as forcing full discovery. Full discovery is only initiated at 
- * power on or when an ArtTodControl.AtcFlush is received.
+ * const artnet_load_t *load - what to generate
+ * artnet_load_result_t *res - the results
+ */
+void artnetLoadRun(artnet_status_t *st, const artnet_load_t *load, artnet_load_result_t *res)
+{
+  ustack_iface_t *iface = st->cfg->iface;
+  ipv4_t *ipv4 = (ipv4_t*)(iface->buffer + sizeof(eth_frame_t));
+  uint8_t *payload = iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t);
+  artnet_packet_u *artnet = (artnet_packet_u*)payload;
+  udp_t *udp = (udp_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t));
+  e131_packet_t *e131 = (e131_packet_t*)payload;
+  uint8_t sources = load->sources ? load->sources : 1;
+  uint8_t seq = 0;
+  uint16_t u;
+  uint8_t i;
+
+  memset(res, 0, sizeof(artnet_load_result_t));
+
+  if(load->rateHz == 0)
+    return;
+
+  memset(st->loadHist, 0, sizeof(st->loadHist));
+  memset(st->loadPending, 0, sizeof(st->loadPending));
+  st->loadDelivered = 0;
+  st->loadMaxUs = 0;
+
+  gLoadInstance = st;
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+  {
+    st->loadDmxcb[i] = st->cfg->groups[i].dmxcb;
+    st->cfg->groups[i].dmxcb = artnetLoadDmx;
+  }
+
+  sysinterval_t period = TIME_US2I(1000000UL / load->rateHz);
+  sysinterval_t pollPeriod = load->pollsPerSec ? TIME_US2I(1000000UL / load->pollsPerSec) : 0;
+  systime_t start = chVTGetSystemTimeX();
+  systime_t round = start;
+  systime_t lastPoll = start;
+
+  while(chTimeDiffX(start, chVTGetSystemTimeX()) < TIME_MS2I(load->durationMs))
+  {
+    seq = (seq == 0xff) ? 1 : seq + 1;
+
+    for(u = 0; u < load->universes; u++)
+    {
+      bool sacn = (u % 100) < load->sacnPercent;
+      uint8_t port = artnetLoadPort(st, u, sacn);
+      uint16_t len;
+
+      ipv4->srcIp = htonl(0x0a000001 + (u % sources));   // 10.0.0.x
+      ipv4->dstIp = 0xffffffff;
+
+      if(sacn)
+      {
+        sacnBuildData(st, e131, u + 1);
+        e131->frame.seq_number = seq;
+        memset(&e131->dmp.prop_val[1], seq, ARTNET_DMX_LENGTH);
+        len = SACN_HEADER_LENGTH + ARTNET_DMX_LENGTH;
+      }
+      else
+      {
+        memcpy(artnet->dmx.id, "Art-Net\0", 8);
+        artnet->dmx.opCode = ARTNET_OPCODE_DMX;
+        artnet->dmx.prot_ver_hi = 0;
+        artnet->dmx.prot_ver_low = ARTNET_VERSION;
+        artnet->dmx.seq = seq;
+        artnet->dmx.physical = 0;
+        artnet->dmx.sub_uni = u & 0xff;
+        artnet->dmx.net = (u >> 8) & 0x7f;
+        artnet->dmx.length = htons(ARTNET_DMX_LENGTH);
+        memset(artnet->dmx.data, seq, ARTNET_DMX_LENGTH);
+        len = sizeof(struct artnet_dmx_t) + ARTNET_DMX_LENGTH;
+      }
+
+      // An earlier frame not out yet is a drop
+      if(port != 0xff)
+      {
+        st->loadInject[port] = chVTGetSystemTimeX();
+        st->loadPending[port] = true;
+        res->expected++;
+      }
+
+      udp->dstPort = htons(sacn ? st->cfg->sacnPort : st->cfg->port);
+
+      if(sacn)
+        sacnParser(iface, len);
+      else
+        artnetParser(iface, len);
+
+      res->packets++;
+    }
+
+    if(load->sync)
+    {
+      memset(artnet, 0, sizeof(struct artnet_sync_t));
+      memcpy(artnet->sync.id, "Art-Net\0", 8);
+      artnet->sync.opCode = ARTNET_OPCODE_SYNC;
+      artnet->header.prot_ver_low = ARTNET_VERSION;
+      udp->dstPort = htons(st->cfg->port);
+      artnetParser(iface, sizeof(struct artnet_sync_t));
+      res->packets++;
+    }
+
+    // Poll storm, as many as are due
+    while(pollPeriod != 0 && chTimeDiffX(lastPoll, chVTGetSystemTimeX()) >= pollPeriod)
+    {
+      memset(artnet, 0, sizeof(struct artnet_poll_t));
+      memcpy(artnet->poll.id, "Art-Net\0", 8);
+      artnet->poll.opCode = ARTNET_OPCODE_POLL;
+      artnet->poll.prot_ver_low = ARTNET_VERSION;
+      udp->dstPort = htons(st->cfg->port);
+      artnetParser(iface, sizeof(struct artnet_poll_t));
+
+      // The replies go out of the buffer we build in
+      artnetTxSend(st, iface);
+
+      res->packets++;
+      lastPoll += pollPeriod;
+    }
+
+    round = chThdSleepUntilWindowed(round, round + period);
+  }
+
+  // Let the refresh output what's pending
+  chThdSleepMilliseconds(50);
+
+  for(i = 0; i < ARTNET_GROUPS; i++)
+    st->cfg->groups[i].dmxcb = st->loadDmxcb[i];
+
+  res->delivered = st->loadDelivered;
+  res->dropped = (res->expected > res->delivered) ? res->expected - res->delivered : 0;
+  res->p50Us = artnetLoadPercentile(st, res->delivered, 500);
+  res->p99Us = artnetLoadPercentile(st, res->delivered, 990);
+  res->p999Us = artnetLoadPercentile(st, res->delivered, 999);
+  res->maxUs = st->loadMaxUs;
+}
+
+/**
+ * Saturation curve
  *
- * The response is ArtTodData.
+ * Runs the load with step more universes each time, up
+ * to maxUniverses, printing a table of the results.
  *
+ * Returns the most universes that had no drops and a p99
+ * under twice the one of the first run
  */
-static void artnetHandleToDRequest(artnet_packet_u *artnet)
+uint16_t artnetLoadSaturation(artnet_status_t *st, const artnet_load_t *load, uint16_t maxUniverses, uint16_t step)
 {
-  (void)artnet;
-  //RDMToD *tod = dmxGetRdmToD(1);
+  artnet_load_t run = *load;
+  artnet_load_result_t res;
+  uint32_t baseP99 = 0;
+  uint16_t best = 0;
+
+  if(step == 0)
+    return 0;
+
+  dbg("\r\n:: ARTNET :: universes | packets | expected | dropped | p50 us | p99 us | p999 us | max us\r\n");
+
+  for(run.universes = step; run.universes <= maxUniverses; run.universes += step)
+  {
+    artnetLoadRun(st, &run, &res);
+
+    dbgf(":: ARTNET :: %d | %d | %d | %d | %d | %d | %d | %d\r\n",
+         run.universes, res.packets, res.expected, res.dropped,
+         res.p50Us, res.p99Us, res.p999Us, res.maxUs);
+
+    if(baseP99 == 0)
+      baseP99 = res.p99Us;
+
+    if(res.dropped == 0 && res.p99Us <= 2 * baseP99)
+      best = run.universes;
+  }
+
+  return best;
 }
+#endif
 
+#if ARTNET_USE_CAPTURE
 /**
- * ArtTodControl
- *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No Action.
- *                  | Unicast Transmit      | Allowed
- *                  | Broadcast             | Controller directed broadcast to all nodes.
- * --------------------------------------------------------------------------------------
- * Node output      | Receive               | Reply with ArtTodData
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Node input       | Receive               | No Action.
- * gateway          | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Input Gateway Directed Broadcasts to all nodes.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | No Action.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- *
- * The ArtTodControl packet is used to send RDM control parameters over Art-Net. 
- * The response is ArtTodData.
+ * Clears the capture and starts recording again
  *
+ * uint8_t triggers - what freezes it, artnet_capture_trig_en
  */
-static void artnetHandleToDControl(artnet_packet_u *artnet)
+void artnetCaptureArm(artnet_status_t *st, uint8_t triggers)
 {
-  (void)artnet;
+  chSysLock();
+  st->captureFrozen = true;
+  chSysUnlock();
+
+  st->captureHead = 0;
+  st->captureCount = 0;
+  st->captureReason = 0;
+  st->capturePost = 0;
+  memset(st->captureSeq, 0, sizeof(st->captureSeq));
+  st->captureTriggers = triggers | ARTNET_CAPTURE_TRIG_MANUAL;
+
+  chSysLock();
+  st->captureFrozen = false;
+  chSysUnlock();
 }
 
 /**
- * ArtRdm
- *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No Action.
- *                  | Unicast Transmit      | Allowed - Preferred
- *                  | Broadcast             | Allowed
- * --------------------------------------------------------------------------------------
- * Node output      | Receive               | No Action.
- * gateway          | Unicast Transmit      | Allowed - Preferred
- *                  | Broadcast             | Allowed
- * --------------------------------------------------------------------------------------
- * Node input       | Receive               | No Action.
- * gateway          | Unicast Transmit      | Allowed - Preferred
- *                  | Broadcast             | Allowed
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | No Action.
- *                  | Unicast Transmit      | Allowed - Preferred
- *                  | Broadcast             | Allowed
- * --------------------------------------------------------------------------------------
- *
- * The ArtRdm packet is used to transport all non-discovery RDM messages over Art-Net.
- *
+ * Manual capture trigger, from a button or
+ * the show control
  */
-static void artnetHandleRdm(artnet_packet_u *artnet)
+void artnetCaptureTrigger(artnet_status_t *st)
 {
-  (void)artnet;
+  chSysLock();
+  artnetCaptureFire(st, ARTNET_CAPTURE_TRIG_MANUAL);
+  chSysUnlock();
 }
 
 /**
- * ArtRdmSub
- *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No Action.
- *                  | Unicast Transmit      | yes
- *                  | Broadcast             | Not Allowed
- * --------------------------------------------------------------------------------------
- * Node output      | Receive               | No Action.
- * gateway          | Unicast Transmit      | Yes
- *                  | Broadcast             | Not Allowed
- * --------------------------------------------------------------------------------------
- * Node input       | Receive               | No Action.
- * gateway          | Unicast Transmit      | Yes
- *                  | Broadcast             | Not Allowed
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | No Action.
- *                  | Unicast Transmit      | Not Allowed
- *                  | Broadcast             | Not Allowed
- * --------------------------------------------------------------------------------------
- *
- * The ArtRdmSub packet is used to transfer Get, Set, GetResponse and SetResponse data 
- * to and from multiple sub-devices within an RDM device. This packet is primarily used by 
- * Art-Net devices that proxy or emulate RDM. It offers very significant bandwidth gains 
- * over the approach of sending multiple ArtRdm packets.
- *
- * Please note that this packet was added at the release of Art-Net II. For backwards 
- * compatibility it is only acceptable to implement this packet in addition to ArtRdm. It 
- * must not be used instead of ArtRdm.
+ * Has the capture frozen ?
  *
+ * uint8_t *reason - what triggered it, can be NULL
  */
-static void artnetHandleRdmSub(artnet_packet_u *artnet)
+bool artnetCaptureFrozen(artnet_status_t *st, uint8_t *reason)
 {
-  (void)artnet;
+  if(reason != NULL)
+    *reason = st->captureReason;
+
+  return st->captureFrozen;
 }
 
 /**
- * ArtSync
- *
- * Packet strategy.
- * 
- * Entity           | Direction             | Action
- * --------------------------------------------------------------------------------------
- * Controller       | Receive               | No action.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Directed Broadcast    | Controller broadcasts this packet
- *                                          | to synchronously transfer previous 
- *                                          | ArtDmx packets to Node’s output.
- * --------------------------------------------------------------------------------------
- * Node             | Receive               | Transfer previous ArtDmx packets to output.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- * Media Server     | Receive               | Transfer previous ArtDmx packets to output.
- *                  | Unicast Transmit      | Not allowed.
- *                  | Broadcast             | Not allowed.
- * --------------------------------------------------------------------------------------
- *
- * The Art Sync packet can be used to force nodes to 
- * synchronously output ArtDmx packets to their outputs. 
- * This is useful in video and media-wall applications.
- * A controller that wishes to implement synchronous 
- * transmission will unicast multiple universes of ArtDmx 
- * and then broadcast an ArtSync to synchronously transfer 
- * all the ArtDmx packets to the nodes’ outputs at the same time.
- *
- * Managing Synchronous and non-Synchronous modes
- * 
- * At power on or reset a node shalloperate in non-synchronous mode. 
- * This means that ArtDmx packets will be immediately processed and output.
- * When a node receives an ArtSync packet it should 
- * transfer to synchronous operation. 
- * This means that received ArtDmx packets will be buffered and output 
- * when the next ArtSync is received.
- * In order to allow transition between synchronous and non-synchronous 
- * modes, a node shall time out to non-synchronous operation if an ArtSync 
- * is not received for 4 seconds or more.
+ * Writes the capture as a pcap file
  *
- * Multiple controllers
+ * Freezes it first. Through a callback so the target can
+ * send it out a serial port or a file, and the host
+ * build fwrite() it.
  *
- * In order to allow for multiple controllers on a network, a node shall 
- * compare the source IP of the ArtSync to the source IP of the most recent
- * ArtDmx packet. The ArtSync shall be ignored if the IP addresses do not match.
- * When a port is merging multiple streams of ArtDmx from different IP addresses, 
- * ArtSync packets shall be ignored.
+ * captureWriteCallback_t cb - called for each piece of the file
+ * void *arg                 - passed to cb
  */
-static void artnetHandleSync(artnet_packet_u *artnet)
+void artnetCaptureDump(artnet_status_t *st, captureWriteCallback_t cb, void *arg)
 {
-  (void)artnet;
-}
+  uint32_t hdr[6];
+  uint32_t rec[4];
+  uint16_t i, idx;
 
-/*******************************************/
-/* PUBLIC FUNCTIONS                        */
-/*******************************************/
+  chSysLock();
+  st->captureFrozen = true;
+  chSysUnlock();
 
-void artnetSendFirstPollReply(ustack_iface_t *iface)
-{
-  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
-  artnetSendPollReply(artnet);
+  hdr[0] = 0xa1b2c3d4;          // Microsecond timestamps, our byte order
+  hdr[1] = 2 | (4 << 16);       // Version 2.4
+  hdr[2] = 0;                   // GMT
+  hdr[3] = 0;                   // Accuracy
+  hdr[4] = ARTNET_CAPTURE_SNAPLEN;
+  hdr[5] = 1;                   // Ethernet
+  cb(arg, hdr, sizeof(hdr));
+
+  idx = (st->captureHead + ARTNET_CAPTURE_ENTRIES - st->captureCount) % ARTNET_CAPTURE_ENTRIES;
+
+  for(i = 0; i < st->captureCount; i++)
+  {
+    artnet_capture_t *cap = &st->capture[idx];
+    uint64_t us = TIME_I2US(cap->time);
+
+    rec[0] = us / 1000000;
+    rec[1] = us % 1000000;
+    rec[2] = (cap->len < ARTNET_CAPTURE_SNAPLEN) ? cap->len : ARTNET_CAPTURE_SNAPLEN;
+    rec[3] = cap->len;
+    cb(arg, rec, sizeof(rec));
+    cb(arg, cap->data, rec[2]);
+
+    idx = (idx + 1) % ARTNET_CAPTURE_ENTRIES;
+  }
 }
+#endif
 
+#if ARTNET_USE_SHOW
 /**
- * TODO
+ * Starts recording the show
  *
+ * Every frame output from then on, to cfg->showIo from
+ * its start. Stop it with artnetShowStop(st).
  *
+ * Returns false with no storage, or if it's busy
  */
-void artnetInit(artnet_config_t *cfg)
+bool artnetShowRecord(artnet_status_t *st)
 {
-  if(cfg == NULL)
-    return;
+  artnet_show_t *show = &st->show;
 
-  gArtStatus.cfg = cfg;
+  if(st->cfg->showIo == NULL || show->state != ARTNET_SHOW_IDLE)
+    return false;
 
-  dbg("\r\n:: Starting ArtNet and sACN listening");
+  memset(show->len, 0, sizeof(show->len));
+  memcpy(show->buf[0], ARTNET_SHOW_MAGIC, 4);
+  show->fill[0] = 4;
+  show->fill[1] = 0;
+  show->active = 0;
+  show->pending = 0xff;
+  show->offset = 0;
+  show->records = 0;
+  show->overrun = false;
+  show->last = chVTGetSystemTimeX();
 
-  if(cfg->ledGreen.port != 0 && cfg->ledGreen.pad != 0)
-    palSetPadMode(cfg->ledGreen.port, cfg->ledGreen.pad, PAL_MODE_OUTPUT_PUSHPULL);
+  chSysLock();
+  show->state = ARTNET_SHOW_RECORDING;
+  chSysUnlock();
 
-  if(cfg->ledRed.port != 0 && cfg->ledRed.pad != 0)
-    palSetPadMode(cfg->ledRed.port, cfg->ledRed.pad, PAL_MODE_OUTPUT_PUSHPULL);
+  return true;
+}
 
-  gArtStatus.pollCount = 0;
-  gArtStatus.lastDmxPacket = 0;
-  gArtStatus.lastIpSrc = 0;
-  artnetSetLedsNormal();
+/**
+ * Plays the recorded show
+ *
+ * Frames go out with their recorded timing, received
+ * DMX is ignored until artnetShowStop(st). Starts once
+ * the storage thread read the beginning, a show that
+ * doesn't decode stops then, see artnetShowState().
+ *
+ * bool loop - start again at the end
+ *
+ * Returns false with no storage, or if it's busy
+ */
+bool artnetShowPlay(artnet_status_t *st, bool loop)
+{
+  artnet_show_t *show = &st->show;
 
-  gArtStatus.reportCode = ARTNET_RCPOWEROK;
+  if(st->cfg->showIo == NULL || show->state != ARTNET_SHOW_IDLE)
+    return false;
 
-  // Artnet
-  dbgf(":: ARTNET :: Binding Artnet to Port: %d\r\n", gArtStatus.cfg->port);
-  ustackUdpAddListener(gArtStatus.cfg->port, artnetParser);
+  memset(show->len, 0, sizeof(show->len));
+  show->records = 0;
+  artnetShowRewind(st);
 
-  if(gArtStatus.cfg->sacnEnabled)
-  {
-    // sACN
-    dbgf(":: ARTNET :: Binding sACN to Port: %d\r\n", gArtStatus.cfg->sacnPort);
-    ustackUdpAddListener(gArtStatus.cfg->sacnPort, sacnParser);
-  }
+  show->loop = loop;
+  show->autoPlay = false;
+  show->stopReq = false;
+  show->last = chVTGetSystemTimeX();
+
+  chSysLock();
+  show->state = ARTNET_SHOW_PLAYING;
+  chSysUnlock();
 
-  ustackQueueSendPacket(artnetSendFirstPollReply);
+  return true;
 }
 
 /**
- * Parses the artnet opcode, and calls it's respective
- * function.
+ * Stops recording or playing
  *
- * uint16_t length - the packet length
- * uint8_t data    - the packet data
+ * Recording ends once the storage thread wrote the
+ * rest, playing once the housekeeping thread is past
+ * the record it may be outputting, see artnetShowState()
  */
-void artnetParser(ustack_iface_t *iface, uint16_t len)
+void artnetShowStop(artnet_status_t *st)
 {
-  (void)len;
-  (void)iface;
+  chSysLock();
+  if(st->show.state == ARTNET_SHOW_RECORDING)
+    st->show.state = ARTNET_SHOW_STOPPING;
+  else if(st->show.state == ARTNET_SHOW_PLAYING)
+    st->show.stopReq = true;
+  chSysUnlock();
+}
 
-  artnet_packet_u *artnet = (artnet_packet_u*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+/**
+ * Show recorder and player state
+ *
+ * bool *overrun - recording stopped early, storage full
+ *                 or not fast enough, can be NULL
+ *
+ * Returns artnet_show_state_en
+ */
+uint8_t artnetShowState(artnet_status_t *st, bool *overrun)
+{
+  if(overrun != NULL)
+    *overrun = st->show.overrun;
 
-  uint16_t proto = ((artnet->header.prot_ver_hi << 8) & 0xff) |
-      (artnet->header.prot_ver_low & 0xff);
-  
-  // Anything below protocol version 14 should be ignored
-  if(proto < ARTNET_VERSION)
-    return;
-  
-  switch(artnet->header.opCode)
-  {
-    case ARTNET_OPCODE_POLL:
-      artnetSendPollReply(artnet);
-      break;
-    case ARTNET_OPCODE_SYNC:
-      artnetHandleSync(artnet);
-      break;
-    case ARTNET_OPCODE_IPPROG:
-      artnetHandleIPProg(artnet);
-      break;
-    case ARTNET_OPCODE_ADDRESS:
-      artnetHandleAddress(artnet);
-      break;
-    case ARTNET_OPCODE_DMX:
-      artnetHandleDmx(artnet);
-      break;
-    case ARTNET_OPCODE_TODREQUEST:
-      artnetHandleToDRequest(artnet);
-      break;
-    case ARTNET_OPCODE_TODCONTROL:
-      artnetHandleToDControl(artnet);
-      break;
-    case ARTNET_OPCODE_RDM:
-      artnetHandleRdm(artnet);
-      break;
-    case ARTNET_OPCODE_RDMSUB:
-      artnetHandleRdmSub(artnet);
-      break;
-  };
+  return st->show.state;
 }
+#endif
 
 /**
- * TODO
+ * Parses the sACN root layer and calls the
+ * respective function.
  *
+ * uint16_t length - the packet length
  */
 void sacnParser(ustack_iface_t *iface, uint16_t len)
 {
-  (void)iface;
-  (void)len;
-  
-  // Universe is based on IP
-  //uint16_t puni = HTONS(UDPBUF->destipaddr[1]);
-  //dbgf("Got sACN Packet for Universe %d\r\n", puni);
-}
+  e131_packet_t *e131 = (e131_packet_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t) + sizeof(udp_t));
+  ipv4_t *ipv4 = (ipv4_t*)(iface->buffer + sizeof(eth_frame_t));
+  uint8_t *dst = (uint8_t*)&ipv4->dstIp;
+  udp_t *udp = (udp_t*)(iface->buffer + sizeof(eth_frame_t) + sizeof(ipv4_t));
+  artnet_status_t *st = artnetFindInstance(iface, ntohs(udp->dstPort), true);
+
+  if(st == NULL)
+    return;
+
+#if ARTNET_USE_CAPTURE
+  artnetCapture(st, iface, len, chVTGetSystemTimeX());
+#endif
+
+  // Multicast for a universe we didn't join, the MAC hash
+  // filter lets some through, drop it before anything else
+  if(dst[0] == 239 && dst[1] == 255)
+  {
+    uint16_t universe = (dst[2] << 8) | dst[3];
+    uint8_t i;
+
+    for(i = 0; i < st->sacnJoinedCount; i++)
+      if(st->sacnJoined[i] == universe)
+        break;
+
+    if(i == st->sacnJoinedCount)
+      return;
+  }
 
+  if(len < offsetof(e131_packet_t, frame.source_name))
+    return;
+
+  if(ntohs(e131->root.preamble_size) != 0x0010 || memcmp(e131->root.acn_pid, SACN_ACN_PID, 12) != 0)
+    return;
 
+  switch(ntohl(e131->root.vector))
+  {
+    case SACN_VECTOR_ROOT_DATA:
+      if(sacnHandleData(st, e131, len))
+        sacnBridgeData(st, e131);   // Last, it rewrites the packet
+      break;
+    case SACN_VECTOR_ROOT_EXTENDED:
+      if(ntohl(e131->frame.vector) == SACN_VECTOR_FRAME_DISCOVERY)
+        sacnHandleDiscovery(st, (e131_discovery_t*)e131, len);
+      break;
+  };
+}
@@ -12,6 +12,128 @@
 #define OEM 0x0000
 #define ESTA 0xffff
 
+// RDM proxy
+
+#define ARTNET_RDM_INFLIGHT 8         // How many ArtRdm transactions can be queued/in flight
+#define ARTNET_RDM_TIMEOUT_MS 50      // How long we wait for an RDM responder to answer
+#define ARTNET_RDMSUB_JOBS 2          // How many ArtRdmSub requests we handle at once
+#define ARTNET_RDMSUB_MAX 64          // Max sub-devices in one ArtRdmSub
+#define ARTNET_RDM_CACHE_ENTRIES 32   // Cached responses of read only PIDs
+#define ARTNET_RDM_CACHE_PD 32        // Max parameter data length we cache
+
+// RDM discovery
+
+#define ARTNET_RDM_TOD_MAX 32         // Max RDM devices per port
+#define ARTNET_RDM_DISC_PERIOD_MS 23  // Discovery time slice period, about one full DMX frame
+#define ARTNET_RDM_DISC_BUDGET_MS 5   // Line time discovery may use in each period
+#define ARTNET_RDM_DISC_TIMEOUT_MS 3  // Discovery response window
+#define ARTNET_RDM_DISC_RETRIES 3     // Mute retries before giving up on a device
+#define ARTNET_RDM_DISC_INTERVAL_MS 60000 // Background discovery interval, after AtcIncOn
+
+// sACN universe discovery
+
+#define ARTNET_SACN_DISC_SOURCES 8    // How many sACN sources we keep track of
+#define ARTNET_SACN_DISC_UNIVERSES 64 // Max universes we keep of each source
+#define ARTNET_SACN_DISC_TIMEOUT_MS 30000 // Source gone if not heard of in this time
+
+// sACN source
+
+#define ARTNET_SACN_PRIORITY 100      // Default priority of our sACN streams
+#define ARTNET_SACN_MIN_INTERVAL_MS 22 // Fastest we send a universe, about DMX full frame rate
+#define ARTNET_SACN_KEEPALIVE_MS 800  // Retransmit interval when data doesn't change
+
+// Art-Net <-> sACN bridge
+
+#define ARTNET_BRIDGE_ROUTES 8        // Max bridge routes
+#define ARTNET_USE_BENCHMARK FALSE    // Build artnetBridgeBenchmark() and the load generator
+#define ARTNET_LOAD_BUCKET_US 10      // Load generator latency histogram resolution
+#define ARTNET_LOAD_BUCKETS 1024      // Its buckets, the last one is everything above
+
+// Soft patch
+
+#define ARTNET_PATCH_ENTRIES 64       // Max patch entries in the config
+
+// ArtDmx sources
+
+#define ARTNET_SOURCES 16             // Sources kept, one per controller IP and universe
+#define ARTNET_OWNER_TIMEOUT_MS 2000  // Default port ownership timeout, when the port config has 0
+
+// Stream analytics
+
+#define ARTNET_STATS_STREAMS 8        // Received universes kept, one per universe and protocol
+#define ARTNET_STATS_STALE_MS 2000    // A full table only lets go of a universe silent this long
+#define ARTNET_STATS_BINS 32          // Inter-arrival histogram bins, the last one is everything above
+#define ARTNET_STATS_BIN_US 2000      // Width of each bin
+
+// Frame interpolation
+
+#define ARTNET_USE_INTERP FALSE       // Interpolate refreshed outputs between received frames
+#define ARTNET_INTERP_MAX_MS 100      // Slower sources are not interpolated, frames are output as they come
+#define ARTNET_INTERP_SNAPS 16        // Max slot ranges that never interpolate
+
+// Output curves
+
+#define ARTNET_CURVES 4               // Max curve tables in the config
+#define ARTNET_CURVE_RANGES 16        // Max port slot ranges with a curve
+#define ARTNET_USE_CURVE16 FALSE      // Also deliver 16 bit curved frames, to dmx16cb
+
+// Pixel mapping
+
+#define ARTNET_PIXEL_STRIPS 8         // Max LED strips in the config
+#define ARTNET_PIXEL_RESET_BYTES 32   // SPI low after a WS2812 frame, 106us at 2.4MHz
+#define ARTNET_PIXEL_RESET_SLOTS 80   // PWM low slots after a WS2812 frame, 100us at 800kHz
+
+// DMX output refresh
+
+#define ARTNET_REFRESH_BREAK_US 176   // Default break, when the port config has 0
+#define ARTNET_REFRESH_MAB_US 12      // Default mark after break, when the port config has 0
+
+// Packet capture
+
+#define ARTNET_USE_CAPTURE FALSE      // Capture received packets for post-mortem
+#define ARTNET_CAPTURE_ENTRIES 64     // Packets kept
+#define ARTNET_CAPTURE_SNAPLEN 96     // Bytes kept of each, from the ethernet header
+#define ARTNET_CAPTURE_POST 16        // Packets still captured after a trigger
+
+// Show recorder and player
+
+#define ARTNET_USE_SHOW FALSE         // Record received frames and play them back
+#define ARTNET_SHOW_BUF (ARTNET_GROUPS * ARTNET_MAX_PORTS * 530) // Each recorder staging buffer, holds a key frame of every port
+#define ARTNET_SHOW_READ 4096         // Player read-ahead, a power of 2 holding a few key frames
+#define ARTNET_SHOW_KEYFRAME_MS 2000  // Full frame of each port at least this often
+
+// Config journal
+
+#define ARTNET_JOURNAL_PERIOD_MS 1000 // How often config changes are written, coalescing bursts
+
+// Firmware upload
+
+#define ARTNET_FIRMWARE_BLOCK 1024    // Largest ArtFirmwareMaster block, 512 16 bit words
+#define ARTNET_FIRMWARE_QUEUE 2       // Blocks received and waiting to be written
+#define ARTNET_FIRMWARE_PACE_MS 2     // Least time between two ArtFirmwareReply
+#define ARTNET_FIRMWARE_TIMEOUT_MS 30000 // Upload failed if no block came in this time
+
+// Boot
+
+#define ARTNET_BOOT_DEFER_MS 200      // Longest LED setup and first ArtPollReply wait for the first DMX
+
+// TX buffers
+
+#define ARTNET_TX_BUFFERS (ARTNET_GROUPS + 3) // Replies waiting to be sent per instance, an ArtPollReply per group and 3 more
+#define ARTNET_TX_SIZE 256            // Largest reply, an ArtPollReply
+
+#if ARTNET_TX_BUFFERS < ARTNET_GROUPS
+#error "ARTNET_TX_BUFFERS must fit an ArtPollReply for each group"
+#endif
+
+// Instances
+
+#define ARTNET_INSTANCES 2            // Max nodes, each on its own interface or port
+
+// Housekeeping thread period
+
+#define ARTNET_SERVICE_PERIOD_MS 1
+
 // No user serviceable parts below
 
 #define ARTNET_VERSION 14
@@ -23,6 +145,25 @@
 #define ARTNET_PORT 6454
 #define SACN_PORT 5568
 
+#define ARTNET_RDM_MAX_LENGTH 256     // RDM packet without the start code, checksum included
+
+#define SACN_ACN_PID "ASC-E1.17\0\0\0"
+#define SACN_VECTOR_ROOT_DATA 0x00000004
+#define SACN_VECTOR_ROOT_EXTENDED 0x00000008
+#define SACN_VECTOR_FRAME_DATA 0x00000002
+#define SACN_VECTOR_FRAME_DISCOVERY 0x00000002
+#define SACN_VECTOR_DMP_SET_PROPERTY 0x02
+#define SACN_VECTOR_DISCOVERY_LIST 0x00000001
+#define SACN_OPTION_PREVIEW 0x80
+#define SACN_OPTION_TERMINATED 0x40
+#define SACN_DISCOVERY_UNIVERSE 64214
+#define SACN_DISCOVERY_INTERVAL_MS 10000
+#define SACN_DISCOVERY_PAGE 512       // Universes per discovery packet
+#define SACN_FLAGS 0x7000             // PDU flags, or'ed with the length
+#define SACN_HEADER_LENGTH 126        // Data packet up to the start code, included
+
+#define ARTNET_PORT_INDEX(grp, port) (((grp) * ARTNET_MAX_PORTS) + (port))
+
 #define ARTNET_OEM 0x04b6
 
 // Defines
@@ -44,6 +185,49 @@
 #define ARTNET_STATUS_RDM_ENABLED (1 << 1)
 #define ARTNET_STATUS_RDM_DISABLED (0 << 1)
 
+// RDM (E1.20) packet offsets, start code excluded as in ArtRdm
+
+#define RDM_START_CODE        0xcc
+#define RDM_SUB_START_CODE    0x01
+#define RDM_OFFSET_LENGTH     1
+#define RDM_OFFSET_DEST_UID   2
+#define RDM_OFFSET_SRC_UID    8
+#define RDM_OFFSET_TN         14
+#define RDM_OFFSET_PORT       15
+#define RDM_OFFSET_MSGCOUNT   16
+#define RDM_OFFSET_SUBDEVICE  17
+#define RDM_OFFSET_CC         19
+#define RDM_OFFSET_PID        20
+#define RDM_OFFSET_PDL        22
+#define RDM_OFFSET_PD         23
+#define RDM_MIN_LENGTH        24      // Message length of a packet with no parameter data
+
+#define RDM_CC_DISCOVERY      0x10
+#define RDM_CC_DISCOVERY_RESPONSE 0x11
+#define RDM_CC_GET            0x20
+#define RDM_CC_GET_RESPONSE   0x21
+#define RDM_CC_SET            0x30
+#define RDM_CC_SET_RESPONSE   0x31
+
+#define RDM_RESPONSE_ACK      0x00
+
+#define RDM_PID_DISC_UNIQUE_BRANCH          0x0001
+#define RDM_PID_DISC_MUTE                   0x0002
+#define RDM_PID_DISC_UN_MUTE                0x0003
+#define RDM_PID_SUPPORTED_PARAMETERS        0x0050
+#define RDM_PID_PARAMETER_DESCRIPTION       0x0051
+#define RDM_PID_PRODUCT_DETAIL_ID_LIST      0x0070
+#define RDM_PID_DEVICE_MODEL_DESCRIPTION    0x0080
+#define RDM_PID_MANUFACTURER_LABEL          0x0081
+#define RDM_PID_SOFTWARE_VERSION_LABEL      0x00c0
+#define RDM_PID_BOOT_SOFTWARE_VERSION_ID    0x00c1
+#define RDM_PID_BOOT_SOFTWARE_VERSION_LABEL 0x00c2
+#define RDM_PID_PERSONALITY_DESCRIPTION     0x00e1
+#define RDM_PID_SLOT_INFO                   0x0120
+#define RDM_PID_SLOT_DESCRIPTION            0x0121
+#define RDM_PID_DEFAULT_SLOT_VALUE          0x0122
+#define RDM_PID_SENSOR_DEFINITION           0x0200
+
 typedef enum
 {
   ARTNET_TYPE_DMX512        = 0x00,
@@ -164,6 +348,21 @@ typedef enum
 
 } artnet_node_address_command_en;
 
+typedef enum
+{
+  ARTNET_ATCNONE = 0x00,      // no action
+  ARTNET_ATCFLUSH,            // flush the TOD and run full discovery
+  ARTNET_ATCEND,              // end discovery
+  ARTNET_ATCINCON,            // enable background discovery
+  ARTNET_ATCINCOFF            // disable background discovery
+} artnet_tod_control_command_en;
+
+typedef enum
+{
+  ARTNET_TODFULL = 0x00,      // full TOD
+  ARTNET_TODNAK = 0xff        // TOD not available
+} artnet_tod_command_response_en;
+
 typedef enum
 {
   STNODE,
@@ -362,6 +561,53 @@ typedef union artnet_packet_u
     uint16_t    length;     // The length of the DMX512 data array. This value should be an even number in the range 2  512.
     uint8_t     data[];     // pointer to data
   } __attribute__((packed)) dmx;
+
+  // ArtNzs
+  struct artnet_nzs_t
+  {
+    uint8_t     id[8];
+    uint16_t    opCode;
+    uint8_t     prot_ver_hi;
+    uint8_t     prot_ver_low;
+    uint8_t     seq;
+    uint8_t     startCode;  // DMX512 start code, not 0 nor RDM
+    uint8_t     sub_uni;    // The low byte of the 15 bit Port-Address
+    uint8_t     net;        // The top 7 bits of the 15 bit Port-Address
+    uint16_t    length;     // The length of the data array, 1 to 512
+    uint8_t     data[];
+  } __attribute__((packed)) nzs;
+
+  // ArtTimeCode
+  struct artnet_timecode_t
+  {
+    uint8_t     id[8];
+    uint16_t    opCode;
+    uint8_t     prot_ver_hi;
+    uint8_t     prot_ver_low;
+    uint8_t     filler1;
+    uint8_t     streamId;   // 0 for the master stream
+    uint8_t     frames;     // 0 to 29, depending on type
+    uint8_t     seconds;
+    uint8_t     minutes;
+    uint8_t     hours;
+    uint8_t     type;       // artnet_timecode_type_en
+  } __attribute__((packed)) timecode;
+
+  // ArtTrigger
+  struct artnet_trigger_t
+  {
+    uint8_t     id[8];
+    uint16_t    opCode;
+    uint8_t     prot_ver_hi;
+    uint8_t     prot_ver_low;
+    uint8_t     filler1;
+    uint8_t     filler2;
+    uint8_t     oemHi;      // 0xffff is for every OEM
+    uint8_t     oemLo;
+    uint8_t     key;
+    uint8_t     subKey;
+    uint8_t     data[];     // Up to 512 bytes
+  } __attribute__((packed)) trigger;
   
   // Art Address
   struct artnet_address_t
@@ -428,7 +674,7 @@ typedef union artnet_packet_u
     uint8_t     uidTotalLo;
     uint8_t     blockCount;
     uint8_t     uidCount;
-    uint8_t     *tod[6];
+    uint8_t     tod[][6];
   } __attribute__((packed)) toddata;
 
   // Art RDM
@@ -444,7 +690,7 @@ typedef union artnet_packet_u
     uint8_t     net;
     uint8_t     command;
     uint8_t     address;
-    uint8_t     *rdmpacket;
+    uint8_t     rdmpacket[];  // RDM packet without the start code
   } __attribute__((packed)) rdm;
 
   // Art RDM Sub
@@ -456,16 +702,45 @@ typedef union artnet_packet_u
     uint8_t     prot_ver_low;
     uint8_t     rdmver;
     uint8_t     filler;
-    uint8_t     uid;
+    uint8_t     uid[6];
     uint8_t     spare;
     uint8_t     cmdClass;
-    uint8_t     paramId;
-    uint8_t     subDevice;
-    uint8_t     subCount;
+    uint16_t    paramId;    // Big endian
+    uint16_t    subDevice;  // Big endian, first sub-device
+    uint16_t    subCount;   // Big endian, how many sub-devices
     uint8_t     spare2[4];
-    uint16_t    *data;
+    uint16_t    data[];     // Big endian, subCount values on Set and GetResponse
   } __attribute__((packed)) rdmsub;
 
+  // ArtFirmwareMaster
+  struct artnet_firmware_t
+  {
+    uint8_t     id[8];
+    uint16_t    opCode;
+    uint8_t     prot_ver_hi;
+    uint8_t     prot_ver_low;
+    uint8_t     filler1;
+    uint8_t     filler2;
+    uint8_t     type;       // artnet_firmware_type_en
+    uint8_t     blockId;    // 0 for the first block, then counts up
+    uint8_t     length[4];  // Whole image in 16 bit words, big endian
+    uint8_t     spare[20];
+    uint8_t     data[];     // Up to 512 words, ARTNET_FIRMWARE_BLOCK bytes
+  } __attribute__((packed)) firmware;
+
+  // ArtFirmwareReply
+  struct artnet_firmware_reply_t
+  {
+    uint8_t     id[8];
+    uint16_t    opCode;
+    uint8_t     prot_ver_hi;
+    uint8_t     prot_ver_low;
+    uint8_t     filler1;
+    uint8_t     filler2;
+    uint8_t     type;       // artnet_firmware_reply_en
+    uint8_t     spare[21];
+  } __attribute__((packed)) firmwarereply;
+
   uint8_t raw[580];
 } artnet_packet_u;
 
@@ -505,10 +780,803 @@ typedef union {
   uint8_t raw[638]; /* raw buffer view: 638 bytes */
 } e131_packet_t;
 
+typedef union {
+  struct {
+    struct { /* ACN Root Layer: 38 bytes */
+      uint16_t preamble_size;    /* Preamble Size */
+      uint16_t postamble_size;   /* Post-amble Size */
+      uint8_t  acn_pid[12];      /* ACN Packet Identifier */
+      uint16_t flength;          /* Flags (high 4 bits) & Length (low 12 bits) */
+      uint32_t vector;           /* Layer Vector */
+      uint8_t  cid[16];          /* Component Identifier (UUID) */
+    } __attribute__((packed)) root;
+
+    struct { /* Framing Layer: 74 bytes */
+      uint16_t flength;          /* Flags (high 4 bits) & Length (low 12 bits) */
+      uint32_t vector;           /* Layer Vector */
+      uint8_t  source_name[64];  /* User Assigned Name of Source (UTF-8) */
+      uint32_t reserved;         /* Reserved (should be always 0) */
+    } __attribute__((packed)) frame;
+
+    struct { /* Universe Discovery Layer: 8 + 2 bytes per universe */
+      uint16_t flength;          /* Flags (high 4 bits) & Length (low 12 bits) */
+      uint32_t vector;           /* Layer Vector */
+      uint8_t  page;             /* Page number, from 0 */
+      uint8_t  last_page;        /* Number of the last page */
+      uint16_t universes[SACN_DISCOVERY_PAGE]; /* Sorted list of universes */
+    } __attribute__((packed)) disc;
+  } __attribute__((packed));
+
+  uint8_t raw[1144]; /* raw buffer view: 1144 bytes */
+} e131_discovery_t;
+
+/**
+ * sACN stream we source from an input port
+ *
+ * The packet is built once when the stream starts, each
+ * send only patches the sequence number, priority and data.
+ */
+typedef struct
+{
+  bool active;                     // Stream started
+  bool pending;                    // Data changed since last sent
+  uint8_t terminate;               // Stream terminated packets left to send
+  uint8_t seq;                     // Next sequence number
+  uint8_t priority;
+  systime_t lastTx;
+  e131_packet_t pkt;
+} sacn_source_t;
+
+/**
+ * sACN source seen through universe discovery
+ */
+typedef struct
+{
+  bool valid;
+  uint8_t cid[16];
+  uint32_t ip;                     // Source IP, network order
+  systime_t lastSeen;
+  uint8_t lastPage;                // Pages the source lists
+  uint16_t count;                  // Universes we have
+  uint16_t universes[ARTNET_SACN_DISC_UNIVERSES];
+} sacn_disc_source_t;
+
 // Callbacks
 
 typedef void (*groupDmxCallback_t)(uint8_t port, uint16_t len, uint8_t *data);
 typedef void (*groupRdmCallback_t)(uint8_t port, uint16_t len, uint8_t *data);
+typedef void (*groupNzsCallback_t)(uint8_t port, uint8_t startCode, uint16_t len, uint8_t *data);
+typedef void (*groupDmx16Callback_t)(uint8_t port, uint16_t len, uint16_t *data);
+typedef void (*mcastJoinCallback_t)(bool join, uint32_t group, uint8_t *mac);
+typedef void (*mcastFilterCallback_t)(uint32_t hashLow, uint32_t hashHigh);
+
+/**
+ * ArtRdm proxy transaction
+ *
+ * Requests are queued by the parser and handed to the port's
+ * rdmcb one at a time per port, responses come back through
+ * artnetRdmResponse() and are matched by transaction number.
+ */
+
+typedef enum
+{
+  ARTNET_RDM_FREE,
+  ARTNET_RDM_RESERVED,    // Being filled in
+  ARTNET_RDM_QUEUED,      // Waiting for the port to be free
+  ARTNET_RDM_ACTIVE,      // Handed to the driver, waiting for the response
+  ARTNET_RDM_DONE         // Response received, waiting to be sent back
+} artnet_rdm_state_en;
+
+typedef enum
+{
+  ARTNET_RDM_OWNER_ARTRDM, // Response goes back as ArtRdm
+  ARTNET_RDM_OWNER_SUB,    // Response is collected by an ArtRdmSub job
+  ARTNET_RDM_OWNER_DISC    // Response goes to the port discovery
+} artnet_rdm_owner_en;
+
+typedef struct
+{
+  uint8_t state;
+  uint8_t owner;          // Who gets the response
+  uint8_t job;            // ArtRdmSub job, when owner is ARTNET_RDM_OWNER_SUB
+  uint8_t port;           // Port index, see ARTNET_PORT_INDEX
+  uint8_t tn;             // RDM transaction number
+  uint8_t net;            // ArtRdm net
+  uint8_t address;        // ArtRdm address (sub-net + universe)
+  uint16_t order;         // Queue order, older first
+  uint16_t len;           // Length of data
+  uint32_t srcIp;         // Who asked
+  uint8_t srcMac[6];
+  systime_t stamp;        // When it was handed to the driver
+  uint8_t data[ARTNET_RDM_MAX_LENGTH]; // Request, replaced by the response
+} artnet_rdm_trans_t;
+
+/**
+ * ArtRdmSub job
+ *
+ * One ArtRdmSub fanned out as one RDM request per
+ * sub-device, replies collected in values and sent
+ * back as a single ArtRdmSub.
+ */
+
+typedef enum
+{
+  ARTNET_RDMSUB_FREE,
+  ARTNET_RDMSUB_RUNNING,  // Issuing sub-device requests
+  ARTNET_RDMSUB_DONE      // All answered or timed out, reply pending
+} artnet_rdmsub_state_en;
+
+typedef struct
+{
+  uint8_t state;
+  bool waiting;           // A transaction is on the wire
+  uint8_t port;           // Port index the UID lives on
+  uint8_t uid[6];
+  uint8_t cmdClass;
+  uint16_t pid;
+  uint16_t subDevice;     // First sub-device
+  uint16_t subCount;
+  uint16_t next;          // Next sub-device to ask, relative to subDevice
+  uint32_t srcIp;
+  uint8_t srcMac[6];
+  uint16_t values[ARTNET_RDMSUB_MAX];   // Host order
+} artnet_rdmsub_job_t;
+
+/**
+ * Table of RDM devices of a port
+ */
+typedef struct
+{
+  uint8_t count;
+  uint8_t uid[ARTNET_RDM_TOD_MAX][6];
+  bool seen[ARTNET_RDM_TOD_MAX];    // Answered in the running discovery
+} artnet_rdm_tod_t;
+
+/**
+ * Port discovery state machine
+ *
+ * Binary search over the UID space with an explicit stack
+ * of aligned UID blocks, one step (one RDM transaction) at
+ * a time and never more than ARTNET_RDM_DISC_BUDGET_MS of
+ * line time every ARTNET_RDM_DISC_PERIOD_MS so DMX keeps
+ * its refresh rate.
+ */
+
+typedef enum
+{
+  ARTNET_DISC_IDLE,
+  ARTNET_DISC_UNMUTE,       // Un-mute everyone
+  ARTNET_DISC_MUTE_KNOWN,   // Check the devices we already know
+  ARTNET_DISC_BRANCH,       // Unique branch on the top of the stack
+  ARTNET_DISC_MUTE,         // Mute a device just found
+  ARTNET_DISC_END           // Drop what's gone, report the TOD
+} artnet_disc_state_en;
+
+#define ARTNET_RDM_DISC_RESULT 40   // Enough for an encoded UID or a mute response
+
+typedef struct
+{
+  uint8_t state;
+  bool waiting;             // A transaction is on the wire
+  bool result;              // Transaction finished, resultLen 0 when nothing answered
+  bool restart;             // Start over when the port is free
+  bool background;          // AtcIncOn, discover every ARTNET_RDM_DISC_INTERVAL_MS
+  bool replyOnEnd;          // Send ArtTodData when done, even if nothing changed
+  bool todPending;          // Send ArtTodData
+  bool changed;             // TOD changed in this run
+  uint8_t depth;            // Stack entries
+  uint8_t index;            // Known device being checked
+  uint8_t retries;
+  uint8_t found[6];         // Device being muted
+  struct { uint64_t base; uint8_t bits; } stack[49]; // UID blocks left to search
+  uint8_t resultLen;
+  uint8_t resultData[ARTNET_RDM_DISC_RESULT];
+  systime_t periodStart;    // Current time slice
+  sysinterval_t used;       // Line time used in the current time slice
+  systime_t lastRun;        // When discovery last finished
+} artnet_rdm_disc_t;
+
+/**
+ * Cached response of a read only PID
+ */
+typedef struct
+{
+  bool valid;
+  uint8_t uid[6];
+  uint16_t subDevice;
+  uint16_t pid;
+  uint8_t pdl;
+  uint8_t pd[ARTNET_RDM_CACHE_PD];
+} artnet_rdm_cache_t;
+
+/**
+ * Art-Net <-> sACN bridge route
+ *
+ * ArtDmx for portAddress is re-sent as sACN universe, or
+ * sACN universe re-sent as ArtDmx for portAddress to ip
+ * (directed broadcast when 0).
+ */
+
+typedef enum
+{
+  ARTNET_BRIDGE_TO_SACN,
+  ARTNET_BRIDGE_TO_ARTNET
+} artnet_bridge_dir_en;
+
+typedef struct
+{
+  uint8_t dir;            // artnet_bridge_dir_en
+  uint16_t portAddress;   // 15 bit Art-Net Port-Address
+  uint16_t universe;      // sACN universe
+  uint32_t ip;            // ArtDmx destination, unicast only, 0 disables the route
+  uint8_t mac[6];         // ArtDmx destination MAC
+} artnet_bridge_route_t;
+
+/**
+ * ArtTimeCode types
+ */
+
+typedef enum
+{
+  ARTNET_TC_FILM = 0,     // 24 fps
+  ARTNET_TC_EBU,          // 25 fps
+  ARTNET_TC_DF,           // 29.97 fps drop frame
+  ARTNET_TC_SMPTE         // 30 fps
+} artnet_timecode_type_en;
+
+/**
+ * Decoded ArtTimeCode
+ *
+ * frameTime is when, by our clock, this frame started, the
+ * arrival times filtered of network jitter. With periodUs a
+ * frame's phase at any time is (now - frameTime) / periodUs.
+ */
+
+typedef struct
+{
+  uint8_t frames;
+  uint8_t seconds;
+  uint8_t minutes;
+  uint8_t hours;
+  uint8_t type;           // artnet_timecode_type_en
+  uint8_t streamId;
+  systime_t rxTime;       // When the packet was received
+  systime_t frameTime;    // Filtered start of this frame
+  uint32_t periodUs;      // Frame period
+  int32_t errorUs;        // Arrival minus filtered prediction
+} artnet_timecode_t;
+
+/**
+ * Decoded ArtTrigger, data points in the received packet
+ */
+
+typedef struct
+{
+  uint16_t oem;
+  uint8_t key;
+  uint8_t subKey;
+  uint16_t len;
+  uint8_t *data;
+  systime_t rxTime;       // When the packet was received
+} artnet_trigger_t;
+
+typedef void (*timecodeCallback_t)(const artnet_timecode_t *tc);
+typedef void (*triggerCallback_t)(const artnet_trigger_t *trig);
+
+/**
+ * Timecode jitter filter state
+ */
+
+typedef struct
+{
+  bool locked;
+  uint8_t type;
+  systime_t origin;       // Time the filter counts from
+  uint32_t baseUs;        // Filtered start of frame baseFrame, after origin
+  uint32_t baseFrame;     // Frame number since 00:00:00:00
+} artnet_tc_filter_t;
+
+/**
+ * Capture triggers
+ */
+
+typedef enum
+{
+  ARTNET_CAPTURE_TRIG_MANUAL = 0x01,  // artnetCaptureTrigger()
+  ARTNET_CAPTURE_TRIG_SEQ    = 0x02,  // ArtDmx or sACN sequence gap
+  ARTNET_CAPTURE_TRIG_SOURCE = 0x04   // ArtDmx source switched
+} artnet_capture_trig_en;
+
+/**
+ * Captured packet
+ */
+
+typedef struct
+{
+  systime_t time;         // When received
+  uint16_t len;           // Frame length, we keep up to ARTNET_CAPTURE_SNAPLEN
+  uint8_t data[ARTNET_CAPTURE_SNAPLEN];
+} artnet_capture_t;
+
+typedef void (*captureWriteCallback_t)(void *arg, const void *data, uint16_t len);
+
+/**
+ * Load generator run
+ *
+ * universes Port-Addresses from 0 at rateHz, spread over
+ * sources IPs, a share of them as sACN (universe is the
+ * Port-Address + 1). Only the ones our ports output are
+ * measured, the rest is load.
+ */
+
+typedef struct
+{
+  uint16_t universes;     // How many universes each round
+  uint16_t rateHz;        // Rounds per second
+  uint8_t sources;        // ArtDmx sources, 1 if 0
+  bool sync;              // ArtSync after each round
+  uint16_t pollsPerSec;   // ArtPoll storm, 0 for none
+  uint8_t sacnPercent;    // Universes sent as sACN
+  uint32_t durationMs;    // How long
+} artnet_load_t;
+
+typedef struct
+{
+  uint32_t packets;       // Packets injected
+  uint32_t expected;      // Frames for our ports
+  uint32_t delivered;     // Frames that reached dmxcb
+  uint32_t dropped;       // Expected minus delivered
+  uint32_t p50Us;         // Injection to dmxcb latency
+  uint32_t p99Us;
+  uint32_t p999Us;
+  uint32_t maxUs;
+} artnet_load_result_t;
+
+/**
+ * Flash for the config journal, or the firmware bank
+ *
+ * sectors erasable sectors of sectorSize bytes, at least 2
+ * for the journal, erased to 0xff. On a host build the
+ * callbacks can stand in with a file.
+ */
+
+typedef struct
+{
+  bool (*read)(void *arg, uint32_t offset, void *data, uint32_t len);
+  bool (*write)(void *arg, uint32_t offset, const void *data, uint32_t len);
+  bool (*erase)(void *arg, uint8_t sector);
+  void *arg;
+  uint32_t sectorSize;
+  uint8_t sectors;
+} artnet_flash_t;
+
+/**
+ * ArtDmx source of one universe
+ *
+ * Each controller IP sending a universe has its entry,
+ * the oldest one is replaced when the table is full.
+ * A port is owned by the source it last took frames
+ * from, until that one is silent for the port timeout.
+ */
+
+typedef struct
+{
+  bool valid;
+  uint32_t ip;            // Controller IP, network order
+  uint16_t universe;      // 15 bit Port-Address
+  uint8_t seq;            // Last sequence, 0 when the source doesn't use it
+  uint32_t owns;          // Ports it owns, one bit per port index
+  bool holds;             // Holds its universe for the soft patch
+  systime_t firstSeen;
+  systime_t lastSeen;
+  uint32_t packets;       // ArtDmx received
+  uint32_t rejected;      // Of those, dropped because someone else owns the port
+  uint32_t seqGaps;       // Sequence numbers missed or out of order
+  uint16_t rate;          // Packets per second, over the last second
+  uint16_t rateCount;     // Packets in the current second
+  systime_t rateStart;    // When the current second started
+} artnet_source_t;
+
+/**
+ * Received stream quality of a universe
+ *
+ * Updated for every frame received on the universe, from
+ * Art-Net or sACN, whatever it feeds: ports, the soft
+ * patch, pixels or the bridge. Losses are sequence numbers skipped,
+ * late or repeated ones are counted apart. Rate and
+ * jitter are running averages of the inter-arrival time.
+ */
+
+typedef struct
+{
+  bool started;           // Got a frame since the last reset
+  bool sacn;              // sACN, else Art-Net
+  uint16_t universe;      // The universe, 15 bit Port-Address for Art-Net
+  uint8_t seq;            // Last frame sequence
+  systime_t last;         // Its arrival
+  uint32_t frames;        // Frames received
+  uint32_t lost;          // Frames missed, from sequence gaps
+  uint32_t reordered;     // Frames late or repeated
+  uint32_t avgUs;         // Inter-arrival average, 1/8 gain, the rate is 1000000 / avgUs
+  uint32_t jitterUs;      // Inter-arrival mean deviation, 1/16 gain
+  uint32_t bins[ARTNET_STATS_BINS]; // Inter-arrival histogram, ARTNET_STATS_BIN_US wide
+} artnet_stream_stats_t;
+
+/**
+ * ArtFirmwareMaster upload
+ *
+ * Blocks are queued by the parser and written, erasing
+ * sectors as needed, and read back by the firmware thread
+ * to the inactive bank, cfg->firmwareBank. Each one is
+ * acknowledged when it's in flash, so the controller goes
+ * as fast as the flash, never faster than one reply every
+ * ARTNET_FIRMWARE_PACE_MS. After the last one firmwarecb
+ * decides if the image is good and makes it the active one.
+ */
+
+typedef enum
+{
+  ARTNET_FIRMWARE_FIRST = 0x00,
+  ARTNET_FIRMWARE_CONT = 0x01,
+  ARTNET_FIRMWARE_LAST = 0x02,
+  ARTNET_FIRMWARE_UBEA_FIRST = 0x03,
+  ARTNET_FIRMWARE_UBEA_CONT = 0x04,
+  ARTNET_FIRMWARE_UBEA_LAST = 0x05
+} artnet_firmware_type_en;
+
+typedef enum
+{
+  ARTNET_FIRMWARE_BLOCKGOOD = 0x00,
+  ARTNET_FIRMWARE_ALLGOOD = 0x01,
+  ARTNET_FIRMWARE_FAIL = 0xff
+} artnet_firmware_reply_en;
+
+typedef enum
+{
+  ARTNET_FIRMWARE_IDLE = 0,
+  ARTNET_FIRMWARE_RECEIVING,
+  ARTNET_FIRMWARE_DONE,
+  ARTNET_FIRMWARE_FAILED
+} artnet_firmware_state_en;
+
+typedef bool (*firmwareCallback_t)(bool ubea, uint32_t len);
+
+typedef struct
+{
+  uint8_t blockId;
+  bool last;              // Last block of the image
+  uint16_t len;
+  uint8_t data[ARTNET_FIRMWARE_BLOCK];
+} artnet_firmware_block_t;
+
+typedef struct
+{
+  uint8_t state;          // artnet_firmware_state_en
+  bool ubea;              // Uploading the UBEA, not the firmware
+  uint32_t ip;            // Controller uploading, network order
+  uint8_t mac[6];
+  uint8_t nextBlock;      // Block id expected next
+  bool acked;             // A block was acknowledged
+  uint8_t ackedBlock;     // The last one
+  bool reAck;             // Acknowledge it again, its reply was lost
+  bool failReq;           // Fail the upload, set by the parser, done by the thread
+  uint32_t size;          // Image length
+  uint32_t received;      // Bytes queued
+  uint32_t written;       // Bytes in flash
+  uint32_t erased;        // Bytes erased, from the bank start
+  systime_t lastRx;       // Last block received
+  systime_t lastReply;    // Last reply sent
+  uint8_t head;           // Next block to write
+  uint8_t count;          // Blocks queued
+  artnet_firmware_block_t queue[ARTNET_FIRMWARE_QUEUE];
+} artnet_firmware_upload_t;
+
+/**
+ * Show storage, flash or a file
+ *
+ * Written from the start in order, read back in order.
+ */
+
+typedef struct
+{
+  bool (*read)(void *arg, uint32_t offset, uint8_t *data, uint16_t len);
+  bool (*write)(void *arg, uint32_t offset, const uint8_t *data, uint16_t len);
+  void *arg;
+  uint32_t size;          // Bytes available
+} artnet_show_io_t;
+
+/**
+ * Show recorder and player
+ *
+ * Stream format, after the 'A' 'S' 'H' '1' header,
+ * one record per port frame, numbers are LEB128:
+ *   type(1) port(1) ms since the previous record
+ *   ARTNET_SHOW_KEY   - length, the slots
+ *   ARTNET_SHOW_DELTA - runs, then for each: slots skipped
+ *                       after the previous one, count, slots
+ * and ARTNET_SHOW_END, or erased flash, at the end.
+ *
+ * A port's first frame is a key frame, then one every
+ * ARTNET_SHOW_KEYFRAME_MS or when a delta isn't smaller.
+ * Only the current frame of each port is kept, to diff
+ * against when recording and to patch when playing.
+ */
+
+typedef enum
+{
+  ARTNET_SHOW_IDLE = 0,
+  ARTNET_SHOW_RECORDING,
+  ARTNET_SHOW_STOPPING,   // Recording, the storage thread writes what's left
+  ARTNET_SHOW_PLAYING
+} artnet_show_state_en;
+
+typedef enum
+{
+  ARTNET_SHOW_END = 0x00,
+  ARTNET_SHOW_KEY = 0x01,
+  ARTNET_SHOW_DELTA = 0x02
+} artnet_show_record_en;
+
+typedef struct
+{
+  uint8_t state;          // artnet_show_state_en
+  bool loop;              // Play again from the start at the end
+  bool autoPlay;          // Playing because DMX stopped, see cfg->showAutoPlayMs
+  volatile bool stopReq;  // Player asked to stop, the housekeeping thread does it
+  bool overrun;           // Recording stopped, storage full or too slow
+  uint32_t offset;        // Next byte to write, or to read
+  uint32_t records;       // Records written or played
+  systime_t last;         // Time of the last record
+  sysinterval_t wait;     // Player, from last to the next record
+  volatile bool putting;  // Recorder adding a record, from the packet thread
+  systime_t key[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Last key frame of each port
+  uint16_t len[ARTNET_GROUPS * ARTNET_MAX_PORTS];  // Current frame length, 0 for none yet
+  uint8_t frame[ARTNET_GROUPS * ARTNET_MAX_PORTS][ARTNET_DMX_LENGTH]; // Current frame
+  uint8_t buf[2][ARTNET_SHOW_BUF]; // Recorder staging
+  uint16_t fill[2];       // Bytes in each
+  uint8_t active;         // Staging buffer being filled
+  uint8_t pending;        // Staging buffer to write, 0xff for none
+  bool started;           // Player read the header and the first record header
+  uint8_t ra[ARTNET_SHOW_READ]; // Player read-ahead, filled by the storage thread
+  volatile uint16_t raHead;     // Bytes put, by the storage thread
+  volatile uint16_t raTail;     // Bytes taken, by the housekeeping thread
+  volatile bool raEof;          // Storage read to its end
+  volatile bool raReset;        // Refill from the start, the player waits
+  uint8_t nextType;       // Record the player has read the header of
+  uint8_t nextPort;
+} artnet_show_t;
+
+/**
+ * DMX output refresh of a port
+ *
+ * With a rate, frames are output by the housekeeping
+ * thread at that rate, the last one received repeated
+ * when the source idles. Never faster than the line
+ * takes a frame with this break and MAB, the output
+ * driver should generate the same timing.
+ */
+
+typedef struct
+{
+  uint16_t rateHz;        // Refresh rate, 0 outputs each frame as it arrives
+  uint16_t breakUs;       // Break length
+  uint16_t mabUs;         // Mark after break length
+  bool interpolate;       // Fade between received frames, see ARTNET_USE_INTERP
+  uint8_t snapDelta;      // Slots changing more than this jump, 0 never
+} artnet_refresh_t;
+
+/**
+ * Slot range of an output port that's never
+ * interpolated, gobos, strobes, modes...
+ */
+
+typedef struct
+{
+  uint8_t port;           // Output port index
+  uint16_t first;         // First slot, 0 based
+  uint16_t count;         // How many slots
+} artnet_interp_snap_t;
+
+/**
+ * Interpolation of a refreshed output
+ *
+ * Each refresh outputs from + (to - from) * t, t going
+ * from 0 to 1 in the time between the last two received
+ * frames. A new frame starts from what's being output,
+ * so fades have one source frame of latency.
+ */
+
+typedef struct
+{
+  bool started;           // Got a frame
+  uint16_t len;           // Its length
+  systime_t start;        // When it was received
+  sysinterval_t span;     // Time between received frames, 1/4 gain
+  uint8_t from[ARTNET_DMX_LENGTH];
+  uint8_t to[ARTNET_DMX_LENGTH];
+  uint8_t out[ARTNET_DMX_LENGTH];
+#if ARTNET_USE_CURVE16
+  uint16_t out16[ARTNET_DMX_LENGTH]; // Full 16 bit output, for dmx16cb
+#endif
+} artnet_interp_t;
+
+/**
+ * Frames of one start code
+ *
+ * Triple buffered, received frames go to write, which is
+ * swapped with pending, the refresh swaps pending with
+ * front and outputs front. The latest frame wins.
+ */
+
+typedef struct
+{
+  uint8_t buf[3][ARTNET_DMX_LENGTH];
+  uint16_t len[3];
+  uint8_t code[3];        // Start code
+  uint8_t write;          // Buffer being written
+  uint8_t pending;        // Latest complete frame
+  uint8_t front;          // Buffer being output
+  bool fresh;             // Pending is newer than front
+  uint16_t coalesced;     // Frames replaced before being output
+} artnet_frames_t;
+
+/**
+ * Output of a port, its DMX frames and the alternate
+ * start code (ArtNzs) ones interleaved with them
+ */
+
+typedef struct
+{
+  artnet_frames_t dmx;
+  artnet_frames_t nzs;
+  bool valid;             // DMX front has a frame
+  bool nzsQueued;         // NZS front not yet output
+  systime_t last;         // When the current period started
+  sysinterval_t period;   // Length of the current period
+} artnet_output_t;
+
+/**
+ * Output curve
+ *
+ * Tables are generated once by artnetCurveApply(), then
+ * a range of slots of an output port goes through one
+ * of them on its way to dmxcb. Slots with no range are
+ * output as received.
+ */
+
+typedef enum
+{
+  ARTNET_CURVE_LINEAR = 0,
+  ARTNET_CURVE_SQUARE,    // Square law dimmers
+  ARTNET_CURVE_SQRT,      // Inverse square law
+  ARTNET_CURVE_GAMMA      // LED gamma correction
+} artnet_curve_en;
+
+typedef struct
+{
+  uint8_t type;           // artnet_curve_en
+  uint8_t gamma;          // ARTNET_CURVE_GAMMA exponent in tenths, 22 for 2.2
+} artnet_curve_t;
+
+typedef struct
+{
+  uint8_t port;           // Output port index
+  uint8_t curve;          // Index in cfg->curves
+  uint16_t first;         // First slot, 0 based
+  uint16_t count;         // How many slots
+} artnet_curve_range_t;
+
+/**
+ * LED strip fed from received universes
+ *
+ * Pixels start at slot start of portAddress and go on
+ * in the next universes from slot 0, never split across
+ * two. DMX slots are always R, G, B (, W), order is the
+ * order on the wire. Each universe is encoded straight
+ * into buf as it's received, cb gets the buffer after
+ * the strip's last universe.
+ *
+ * ARTNET_PIXEL_SPI3   - WS2812 / SK6812 over SPI at 2.4MHz,
+ *                       3 SPI bits per bit, reset appended
+ * ARTNET_PIXEL_PWM    - WS2812 / SK6812 over a timer DMA,
+ *                       one compare byte per bit, reset appended
+ * ARTNET_PIXEL_APA102 - APA102 SPI frames, order BGR usually
+ */
+
+typedef enum
+{
+  ARTNET_PIXEL_RGB = 0,
+  ARTNET_PIXEL_RBG,
+  ARTNET_PIXEL_GRB,
+  ARTNET_PIXEL_GBR,
+  ARTNET_PIXEL_BRG,
+  ARTNET_PIXEL_BGR,
+  ARTNET_PIXEL_RGBW,
+  ARTNET_PIXEL_GRBW
+} artnet_pixel_order_en;
+
+typedef enum
+{
+  ARTNET_PIXEL_SPI3 = 0,
+  ARTNET_PIXEL_PWM,
+  ARTNET_PIXEL_APA102
+} artnet_pixel_wire_en;
+
+typedef void (*pixelCallback_t)(uint8_t strip, uint8_t *buf, uint32_t len);
+
+typedef struct
+{
+  uint16_t portAddress;   // First universe, 15 bit Port-Address, sACN universe - 1
+  uint16_t start;         // First slot in it, 0 based
+  uint16_t pixels;        // Pixels in the strip
+  uint8_t order;          // artnet_pixel_order_en
+  uint8_t wire;           // artnet_pixel_wire_en
+  bool sacn;              // Universes come from sACN, else Art-Net
+  uint8_t pwm0;           // ARTNET_PIXEL_PWM compare value of a 0 bit
+  uint8_t pwm1;           // and of a 1 bit
+  uint8_t brightness;     // ARTNET_PIXEL_APA102 global brightness, 0 to 31
+  uint8_t *buf;           // DMA buffer, see artnetPixelBufferSize()
+  uint32_t size;          // Its size
+  pixelCallback_t cb;     // Strip frame ready in buf
+} artnet_pixel_strip_t;
+
+/**
+ * Strip compiled by artnetPixelApply()
+ */
+
+typedef struct
+{
+  uint16_t lastAddress;   // Port-Address of the strip's last universe
+  uint16_t first;         // Pixels in the first universe
+  uint16_t per;           // Pixels in each of the next ones
+  uint8_t channels;       // DMX slots per pixel
+  uint8_t stride;         // Buffer bytes per pixel
+  uint8_t offset;         // Buffer bytes before the first pixel
+  uint32_t pwm[16];       // ARTNET_PIXEL_PWM compare bytes of each nibble
+} artnet_pixel_map_t;
+
+/**
+ * Soft patch entry
+ *
+ * count slots of portAddress, from srcSlot, go to
+ * output port (see ARTNET_PORT_INDEX) from dstSlot.
+ * Slots are 0 based. A port with any entry outputs
+ * only what's patched to it.
+ */
+
+typedef struct
+{
+  uint16_t portAddress;   // 15 bit Art-Net Port-Address, sACN universe - 1
+  uint16_t srcSlot;       // First slot in the received universe
+  uint8_t port;           // Output port index
+  uint16_t dstSlot;       // First slot in the output
+  uint16_t count;         // How many slots
+} artnet_patch_t;
+
+/**
+ * Compiled soft patch
+ *
+ * Entries merged into the fewest contiguous copies,
+ * sorted by Port-Address so each received universe
+ * is a run of spans.
+ */
+
+typedef struct
+{
+  uint16_t portAddress;
+  uint16_t src;
+  uint16_t dst;
+  uint16_t len;
+  uint8_t port;
+} artnet_patch_span_t;
+
+typedef struct
+{
+  uint8_t spanCount;
+  artnet_patch_span_t span[ARTNET_PATCH_ENTRIES];
+  uint16_t length[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Output length of each port, 0 if not patched
+  uint16_t primary[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Lowest Port-Address patched to each, its sequence checks follow it
+} artnet_patch_table_t;
 
 /**
  * Struct defining our artnet groups
@@ -531,6 +1599,10 @@ typedef struct artnet_group_t
   uint8_t swout[4];
   groupDmxCallback_t dmxcb;
   groupRdmCallback_t rdmcb;
+  groupNzsCallback_t nzscb;   // Alternate start code frames, ArtNzs
+#if ARTNET_USE_CURVE16
+  groupDmx16Callback_t dmx16cb; // Same frames as dmxcb, 16 bit curves applied
+#endif
 } artnet_group_t;
 
 /**
@@ -557,14 +1629,160 @@ typedef struct
   bool rdmEnabled;        // Does this node support RDM ?
   bool sacnEnabled;       // Is sACN enabled ?
 
+  uint8_t cid[16];        // sACN component id, derived from the MAC if all 0
+  bool sacnJoinSent;      // Join only the universes some source lists in its discovery
+
+  mcastJoinCallback_t mcastcb;       // IGMP join/leave of an sACN multicast group
+  mcastFilterCallback_t mcastFiltercb; // MAC multicast hash filter to program
+
+  timecodeCallback_t timecodecb;     // ArtTimeCode received
+  triggerCallback_t triggercb;       // ArtTrigger for us received
+
   artnet_group_t groups[ARTNET_GROUPS];
+
+  uint8_t bridgeCount;    // Bridge routes in use
+  artnet_bridge_route_t bridge[ARTNET_BRIDGE_ROUTES];
+
+  artnet_refresh_t refresh[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Output refresh of each port
+  uint16_t ownerTimeoutMs[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Source failover of each port, 0 for ARTNET_OWNER_TIMEOUT_MS
+
+  uint8_t patchCount;     // Soft patch entries in use, see artnetPatchApply()
+  artnet_patch_t patch[ARTNET_PATCH_ENTRIES];
+
+  uint8_t interpSnapCount; // Slot ranges never interpolated
+  artnet_interp_snap_t interpSnap[ARTNET_INTERP_SNAPS];
+
+  uint8_t curveCount;     // Curve tables in use, see artnetCurveApply()
+  artnet_curve_t curves[ARTNET_CURVES];
+  uint8_t curveRangeCount; // Slot ranges with a curve
+  artnet_curve_range_t curveRange[ARTNET_CURVE_RANGES];
+
+  uint8_t pixelCount;     // LED strips in use, see artnetPixelApply()
+  artnet_pixel_strip_t pixel[ARTNET_PIXEL_STRIPS];
+
+  artnet_flash_t *flash;  // Config journal, NULL keeps it in RAM only
+
+  artnet_flash_t *firmwareBank;   // Inactive firmware bank, NULL refuses uploads
+  firmwareCallback_t firmwarecb;  // Upload complete, check and activate it
+
+  artnet_show_io_t *showIo; // Show storage, see ARTNET_USE_SHOW
+  uint16_t showAutoPlayMs;  // Loop the show when no DMX came for this long, 0 never
 } artnet_config_t;
 
+/**
+ * Node status and routing, as the application sees it
+ *
+ * Published by the packet thread after it changes any
+ * of it, read with artnetGetSnapshot() from any thread.
+ */
+
+typedef struct
+{
+  uint8_t shortName[ARTNET_SHORT_NAME_LENGTH];
+  uint8_t longName[ARTNET_LONG_NAME_LENGTH];
+  uint32_t ip;
+  uint32_t netmask;
+  uint16_t port;
+  uint8_t statusLeds;
+  uint8_t reportCode;
+  struct
+  {
+    uint8_t ports;
+    uint8_t net;
+    uint8_t subnet;
+    uint8_t portType[ARTNET_MAX_PORTS];
+    uint8_t outputStatus[ARTNET_MAX_PORTS];
+    uint8_t swin[ARTNET_MAX_PORTS];
+    uint8_t swout[ARTNET_MAX_PORTS];
+  } groups[ARTNET_GROUPS];
+} artnet_snapshot_t;
+
+/**
+ * Config we persist, as last written to the journal
+ */
+
+typedef struct
+{
+  uint8_t shortName[ARTNET_SHORT_NAME_LENGTH];
+  uint8_t longName[ARTNET_LONG_NAME_LENGTH];
+  uint32_t ip;
+  uint32_t netmask;
+  uint16_t port;
+  struct
+  {
+    uint8_t net;
+    uint8_t subnet;
+    uint8_t outputStatus[ARTNET_MAX_PORTS];
+    uint8_t swin[ARTNET_MAX_PORTS];
+    uint8_t swout[ARTNET_MAX_PORTS];
+  } groups[ARTNET_GROUPS];
+} artnet_persist_t;
+
+/**
+ * Startup milestones
+ */
+
+typedef enum
+{
+  ARTNET_BOOT_INIT = 0,       // artnetInit entered
+  ARTNET_BOOT_BOUND,          // Listeners bound, DMX accepted
+  ARTNET_BOOT_POLLREPLY,      // First ArtPollReply sent
+  ARTNET_BOOT_FIRSTDMX,       // First DMX frame reached dmxcb
+  ARTNET_BOOT_DONE,           // Deferred startup work done
+  ARTNET_BOOT_MILESTONES
+} artnet_boot_en;
+
+/**
+ * Sends queued to the stack, run in its thread
+ * for each instance with the bit set
+ */
+
+typedef enum
+{
+  ARTNET_SEND_POLLREPLY       = 0x01,
+  ARTNET_SEND_TODDATA         = 0x02,
+  ARTNET_SEND_RDMREPLIES      = 0x04,
+  ARTNET_SEND_RDMSUBREPLIES   = 0x08,
+  ARTNET_SEND_SACNSOURCES     = 0x10,
+  ARTNET_SEND_SACNDISCOVERY   = 0x20,
+  ARTNET_SEND_TXPOOL          = 0x40
+} artnet_send_en;
+
+/**
+ * TX buffer
+ *
+ * Replies are built here instead of over the request
+ * in the interface buffer, and copied to it when the
+ * stack thread sends them, in the order queued.
+ */
+
+typedef enum
+{
+  ARTNET_TX_FREE,
+  ARTNET_TX_FILLING,      // Reply being built
+  ARTNET_TX_QUEUED        // Waiting for the stack thread
+} artnet_tx_state_en;
+
+typedef struct
+{
+  uint8_t state;
+  uint16_t order;         // Queue order
+  uint8_t mac[6];         // Destination
+  uint32_t ip;            // Destination, host order
+  uint16_t port;          // Art-Net port when queued
+  uint16_t len;
+  uint8_t data[ARTNET_TX_SIZE]; // UDP payload
+} artnet_tx_t;
+
 /**
  * struct holding the artnet status
  *
  * instead of having global variables lying around
  * let's keep it tidy all inside a struct.
+ *
+ * One per node instance, passed to everything.
+ * Instances share nothing, the parsers find theirs
+ * by interface and port.
  */
 typedef struct
 {
@@ -574,22 +1792,154 @@ typedef struct
   struct uip_udp_conn *sacnConn;   // sACN connection
 
   uint16_t pollCount;              // ArtPoll count
-  systime_t lastDmxPacket;          // time of last DMX Packet
-  uint32_t lastIpSrc;         // The IP of the first DMX packet
+  artnet_source_t sources[ARTNET_SOURCES]; // ArtDmx sources, see artnetGetSource()
+  artnet_stream_stats_t stats[ARTNET_STATS_STREAMS]; // Received stream quality of each universe
+  uint8_t portOwner[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Source owning each port, 0xff for none
   
   thread_t *locateThread;          // Thread pointer to our led blink thread
+  thread_t *serviceThread;         // Housekeeping thread (RDM timeouts, ...)
+
+  artnet_rdm_trans_t rdm[ARTNET_RDM_INFLIGHT]; // ArtRdm transactions
+  uint16_t rdmOrder;               // Next transaction queue order
+  uint8_t rdmTn;                   // Transaction number of our own requests
+  artnet_rdmsub_job_t rdmSub[ARTNET_RDMSUB_JOBS]; // ArtRdmSub jobs
+  artnet_rdm_cache_t rdmCache[ARTNET_RDM_CACHE_ENTRIES]; // Read only PID responses
+  uint8_t rdmCacheNext;            // Next cache entry to replace
+  uint16_t rdmCacheHits;           // Requests answered from the cache
+  artnet_rdm_tod_t rdmTod[ARTNET_GROUPS * ARTNET_MAX_PORTS];   // RDM devices of each port
+  artnet_rdm_disc_t rdmDisc[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Discovery of each port
+
+  systime_t sacnDiscLast;          // When we last sent universe discovery
+  sacn_disc_source_t sacnSources[ARTNET_SACN_DISC_SOURCES]; // Who sends what
+
+  sacn_source_t sacnTx[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Streams of our input ports
+  bool sacnTxQueued;               // A send of due streams is queued
+
+  uint8_t bridgeHdr[SACN_HEADER_LENGTH]; // sACN headers the bridge writes in front of the data
+  uint8_t bridgeSeq[ARTNET_BRIDGE_ROUTES]; // Sequence of each bridge route
+
+  artnet_patch_table_t patch[2];   // Compiled soft patch, in use and being built
+  uint8_t patchActive;             // Which one is in use
+  uint32_t curvePorts;             // Ports with a curve, one bit each, 0 while compiling
+  uint8_t curveLut[ARTNET_CURVES][256]; // 8 bit tables
+  uint8_t curveOut[ARTNET_GROUPS * ARTNET_MAX_PORTS][ARTNET_DMX_LENGTH]; // Curved frame of each port
+#if ARTNET_USE_CURVE16
+  uint16_t curveLut16[ARTNET_CURVES][256]; // 16 bit tables
+  uint16_t curveOut16[ARTNET_GROUPS * ARTNET_MAX_PORTS][ARTNET_DMX_LENGTH];
+#endif
+  uint8_t pixelActive;             // LED strips compiled, 0 while compiling
+  artnet_pixel_map_t pixelMap[ARTNET_PIXEL_STRIPS];
+  uint8_t patchOut[ARTNET_GROUPS * ARTNET_MAX_PORTS][ARTNET_DMX_LENGTH]; // Patched outputs
+
+  artnet_output_t output[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Refreshed outputs
+#if ARTNET_USE_INTERP
+  artnet_interp_t interp[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Interpolation of refreshed outputs
+#endif
+
+  artnet_tc_filter_t tcFilter;     // Timecode jitter filter
+
+#if ARTNET_USE_BENCHMARK
+  systime_t loadInject[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // When each port's frame was injected
+  bool loadPending[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Injected frame not delivered yet
+  uint32_t loadHist[ARTNET_LOAD_BUCKETS]; // Injection to dmxcb latency
+  uint32_t loadDelivered;          // Frames that reached dmxcb
+  uint32_t loadMaxUs;              // Worst latency
+  groupDmxCallback_t loadDmxcb[ARTNET_GROUPS]; // The callbacks we stand in for
+#endif
+
+#if ARTNET_USE_SHOW
+  artnet_show_t show;              // Show recorder and player
+  systime_t lastOutput;            // When received DMX was last output
+#endif
+
+#if ARTNET_USE_CAPTURE
+  artnet_capture_t capture[ARTNET_CAPTURE_ENTRIES]; // Capture ring
+  uint16_t captureHead;            // Next entry written
+  uint16_t captureCount;           // Entries in use
+  uint8_t captureTriggers;         // Armed triggers, artnet_capture_trig_en
+  uint8_t captureReason;           // What triggered, 0 if not yet
+  uint8_t capturePost;             // Entries left until frozen
+  bool captureFrozen;              // Stopped recording
+  uint8_t captureSeq[ARTNET_GROUPS * ARTNET_MAX_PORTS]; // Last sequence of each output port
+#endif
+
+  bool sacnGroupsDirty;            // Multicast groups need updating
+  uint8_t sacnJoinedCount;         // Multicast groups joined
+  uint16_t sacnJoined[ARTNET_GROUPS * ARTNET_MAX_PORTS + ARTNET_BRIDGE_ROUTES + 1]; // Their universes, discovery included
+  uint32_t sacnHash[2];            // MAC hash filter of the joined groups
+  uint16_t rdmDropped;             // Requests dropped, table full
+  uint16_t rdmTimeouts;            // Requests with no response
+
+  uint8_t sendPending;             // Queued sends, artnet_send_en
+  artnet_tx_t tx[ARTNET_TX_BUFFERS]; // Replies waiting to be sent
+  uint16_t txOrder;                // Next queue order
+  uint16_t txDropped;              // Replies dropped, no TX buffer free
 
   uint8_t statusLeds;              // LED Status
 
   uint8_t reportCode;              // Report code
   uint8_t report[64];              // String holding the report text
+
+  artnet_persist_t journal;        // Config as in the journal
+  uint8_t journalSector;           // Sector being appended
+  uint32_t journalGen;             // Its generation, the highest valid wins
+  uint32_t journalOffset;          // Where the next record goes
+  bool journalReady;               // Loaded, appending allowed
+  bool journalCompact;             // Compact before appending, left by the load
+  systime_t journalLast;           // Last check for changes
+  thread_t *storageThread;         // Journal flash writes
+
+  artnet_firmware_upload_t firmware; // ArtFirmwareMaster upload
+  thread_t *firmwareThread;        // Writes it to flash
+
+  systime_t boot[ARTNET_BOOT_MILESTONES]; // When each startup milestone was reached
+  uint8_t bootReached;             // Milestones reached, one bit each
+
+  volatile uint32_t snapSeq;       // Snapshot sequence, odd while being written
+  artnet_snapshot_t snap;          // Published status and routing
 } artnet_status_t;
 
-void artnetInit(artnet_config_t *cfg);
+void artnetInit(artnet_status_t *st, artnet_config_t *cfg);
 void artnetParser(ustack_iface_t *iface, uint16_t len);
 void sacnParser(ustack_iface_t *iface, uint16_t len);
-void artnetSetGroupDmxCallback(uint8_t grp, groupDmxCallback_t cb);
-void artnetSetGroupRdmCallback(uint8_t grp, groupRdmCallback_t cb);
+void artnetSetGroupDmxCallback(artnet_status_t *st, uint8_t grp, groupDmxCallback_t cb);
+void artnetSetGroupRdmCallback(artnet_status_t *st, uint8_t grp, groupRdmCallback_t cb);
 void artnetSendFirstPollReply(ustack_iface_t *iface);
+void artnetRdmResponse(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data);
+bool sacnIsUniverseSent(artnet_status_t *st, uint16_t universe);
+bool artnetGetSource(artnet_status_t *st, uint8_t idx, artnet_source_t *src);
+int8_t artnetGetPortOwner(artnet_status_t *st, uint8_t port);
+bool artnetGetStreamStats(artnet_status_t *st, uint8_t idx, artnet_stream_stats_t *stats);
+void artnetResetStreamStats(artnet_status_t *st, uint8_t idx);
+uint16_t artnetStreamStatsDump(artnet_status_t *st, uint8_t *buf, uint16_t size);
+bool sacnGetSource(artnet_status_t *st, uint8_t idx, sacn_disc_source_t *src);
+bool sacnSourceStart(artnet_status_t *st, uint8_t port, uint8_t priority);
+void sacnSourceUpdate(artnet_status_t *st, uint8_t port, uint16_t len, uint8_t *data);
+void sacnSourceSetPriority(artnet_status_t *st, uint8_t port, uint8_t priority);
+void sacnSourceStop(artnet_status_t *st, uint8_t port);
+bool artnetPatchApply(artnet_status_t *st);
+bool artnetCurveApply(artnet_status_t *st);
+uint32_t artnetPixelBufferSize(artnet_pixel_strip_t *strip);
+bool artnetPixelApply(artnet_status_t *st);
+void artnetGetSnapshot(artnet_status_t *st, artnet_snapshot_t *snap);
+void artnetGetBootTimeline(artnet_status_t *st, uint32_t *us);
+uint8_t artnetFirmwareState(artnet_status_t *st, uint32_t *written, uint32_t *size);
+#if ARTNET_USE_BENCHMARK
+uint32_t artnetBridgeBenchmark(artnet_status_t *st, uint32_t frames);
+void artnetLoadRun(artnet_status_t *st, const artnet_load_t *load, artnet_load_result_t *res);
+uint16_t artnetLoadSaturation(artnet_status_t *st, const artnet_load_t *load, uint16_t maxUniverses, uint16_t step);
+#endif
+#if ARTNET_USE_CAPTURE
+void artnetCaptureArm(artnet_status_t *st, uint8_t triggers);
+void artnetCaptureTrigger(artnet_status_t *st);
+bool artnetCaptureFrozen(artnet_status_t *st, uint8_t *reason);
+void artnetCaptureDump(artnet_status_t *st, captureWriteCallback_t cb, void *arg);
+#endif
+#if ARTNET_USE_SHOW
+bool artnetShowRecord(artnet_status_t *st);
+bool artnetShowPlay(artnet_status_t *st, bool loop);
+void artnetShowStop(artnet_status_t *st);
+uint8_t artnetShowState(artnet_status_t *st, bool *overrun);
+#endif
 
 #endif